@@ -9,6 +9,9 @@
 
 #include<stdio.h>
 
+// most data held for the slower side, in each direction
+#define BUFFER_MAX 65536
+
 class App::Private
 {
 public:
@@ -26,6 +29,9 @@ App::App(int mode, const QString &host, int port, const QString &serv, const QSt
 	d->c = new BConsole;
 	connect(d->c, SIGNAL(connectionClosed()), SLOT(con_connectionClosed()));
 	connect(d->c, SIGNAL(readyRead()), SLOT(con_readyRead()));
+	connect(d->c, SIGNAL(writeResumed()), SLOT(st_readyRead()));
+	d->c->setReadLimit(BUFFER_MAX);
+	d->c->setWriteLimit(BUFFER_MAX);
 	d->bs = 0;
 
 	d->mode = mode;
@@ -91,6 +97,9 @@ void App::st_connected()
 	connect(d->bs, SIGNAL(connectionClosed()), SLOT(st_connectionClosed()));
 	connect(d->bs, SIGNAL(delayedCloseFinished()), SLOT(st_delayedCloseFinished()));
 	connect(d->bs, SIGNAL(readyRead()), SLOT(st_readyRead()));
+	connect(d->bs, SIGNAL(writeResumed()), SLOT(con_readyRead()));
+	d->bs->setReadLimit(BUFFER_MAX);
+	d->bs->setWriteLimit(BUFFER_MAX);
 }
 
 void App::st_connectionClosed()
@@ -106,6 +115,9 @@ void App::st_delayedCloseFinished()
 
 void App::st_readyRead()
 {
+	// leave it with the stream while the console catches up
+	if(d->c->isWritePaused() || d->bs->bytesAvailable() == 0)
+		return;
 	QByteArray a = d->bs->read();
 	d->c->write(a);
 }
@@ -126,6 +138,8 @@ void App::con_connectionClosed()
 
 void App::con_readyRead()
 {
+	if(d->bs->isWritePaused() || d->c->bytesAvailable() == 0)
+		return;
 	QByteArray a = d->c->read();
 	d->bs->write(a);
 }
@@ -7,32 +7,42 @@ INCLUDEPATH += util network sasl
 
 HEADERS = \
 	util/bytestream.h \
+	util/bufferpool.h \
+	util/reactor.h \
 	util/base64.h \
 	util/sha1.h \
 	util/bconsole.h \
 	util/qrandom.h \
 	network/ndns.h \
+	network/dnsclient.h \
 	network/srvresolver.h \
 	network/bsocket.h \
 	network/httpconnect.h \
 	network/httppoll.h \
+	network/httpparser.h \
 	network/servsock.h \
+	network/workerpool.h \
 	network/socks.h \
 	sasl/qsasl.h \
 	adconn.h
 
 SOURCES = \
 	util/bytestream.cpp \
+	util/bufferpool.cpp \
+	util/reactor.cpp \
 	util/base64.cpp \
 	util/sha1.cpp \
 	util/bconsole.cpp \
 	util/qrandom.cpp \
 	network/ndns.cpp \
+	network/dnsclient.cpp \
 	network/srvresolver.cpp \
 	network/bsocket.cpp \
 	network/httpconnect.cpp \
 	network/httppoll.cpp \
+	network/httpparser.cpp \
 	network/servsock.cpp \
+	network/workerpool.cpp \
 	network/socks.cpp \
 	sasl/qsasl.cpp \
 	adconn.cpp
@@ -0,0 +1,721 @@
+#include"bench.h"
+
+#include<qapplication.h>
+#include<qptrlist.h>
+#include<qtimer.h>
+#include<qguardedptr.h>
+#include<qca.h>
+#include"bytestream.h"
+#include"bufferpool.h"
+#include"base64.h"
+#include"bsocket.h"
+#include"servsock.h"
+#include"socks.h"
+#include"httpconnect.h"
+#include"httppoll.h"
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/time.h>
+
+// most data queued on the sending stream at once
+#define WINDOW (64 * 1024)
+
+#define MEGABYTE (1024.0 * 1024.0)
+
+#if defined(__GLIBC__) && !defined(NO_MALLOC_COUNT)
+# define HAVE_MALLOC_COUNT
+#endif
+
+//----------------------------------------------------------------------------
+// counters
+//----------------------------------------------------------------------------
+#ifdef HAVE_MALLOC_COUNT
+static Q_ULLONG allocs = 0;
+
+// count every allocation in the process, including Qt's, by standing in for
+//   the allocator entry points
+extern "C" {
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+
+void *malloc(size_t size) throw()
+{
+	++allocs;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) throw()
+{
+	++allocs;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) throw()
+{
+	++allocs;
+	return __libc_realloc(p, size);
+}
+}
+#endif
+
+class Sample
+{
+public:
+	long usecs;
+	Q_ULLONG syscalls;
+	Q_ULLONG allocs;
+	ByteStreamStats stats;
+	BufferPoolStats pool;
+};
+
+static long usecs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// read and write calls made by the process so far, or -1 if the kernel
+//   doesn't tell
+static Q_LLONG proc_syscalls()
+{
+	FILE *f = fopen("/proc/self/io", "r");
+	if(!f)
+		return -1;
+	Q_LLONG total = 0;
+	int found = 0;
+	char line[128];
+	while(fgets(line, sizeof(line), f)) {
+		if(!strncmp(line, "syscr:", 6) || !strncmp(line, "syscw:", 6)) {
+			total += atoll(line + 6);
+			++found;
+		}
+	}
+	fclose(f);
+	return (found == 2 ? total : -1);
+}
+
+static bool have_proc_syscalls()
+{
+	return (proc_syscalls() != -1);
+}
+
+static Sample sample()
+{
+	Sample s;
+	s.stats = ByteStream::totalStats();
+	s.pool = BufferPool::stats();
+	Q_LLONG n = proc_syscalls();
+	if(n != -1)
+		s.syscalls = n;
+	else
+		s.syscalls = s.stats.readCalls + s.stats.writeCalls;
+#ifdef HAVE_MALLOC_COUNT
+	s.allocs = allocs;
+#else
+	s.allocs = 0;
+#endif
+	s.usecs = usecs();
+	return s;
+}
+
+static int find_header_end(const QByteArray &a)
+{
+	for(int n = 0; n + 3 < (int)a.size(); ++n) {
+		if(!memcmp(a.data() + n, "\r\n\r\n", 4))
+			return n;
+	}
+	return -1;
+}
+
+static QString find_header(const QStringList &lines, const QString &var)
+{
+	for(QStringList::ConstIterator it = lines.begin(); it != lines.end(); ++it) {
+		int n = (*it).find(':');
+		if(n != -1 && (*it).left(n).stripWhiteSpace().lower() == var)
+			return (*it).mid(n + 1).stripWhiteSpace();
+	}
+	return QString::null;
+}
+
+// a poll key is good if it hashes to the one before it
+static bool follows(const QByteArray &last, const QString &key)
+{
+	if(last.isEmpty())
+		return true;
+	QByteArray raw = Base64::stringToArray(key);
+	return (QCA::SHA1::hash(Base64::encode(raw)) == last);
+}
+
+//----------------------------------------------------------------------------
+// StubConn
+//----------------------------------------------------------------------------
+class StubConn::Private
+{
+public:
+	Private() {}
+
+	ByteStream *bs;
+	Mode mode;
+	bool inHeader;
+	QByteArray buf;
+
+	// the poll request being answered
+	bool pending, held, keepAlive, http11;
+
+	// send "100 Continue" ahead of each reply to an HTTP/1.1 request
+	bool interim;
+	QString key, newkey;
+	int size;
+};
+
+StubConn::StubConn(ByteStream *bs, Mode mode, bool interim)
+:QObject(0)
+{
+	d = new Private;
+	d->bs = bs;
+	d->mode = mode;
+	d->interim = interim;
+	d->inHeader = (mode == Connect);
+	d->pending = false;
+	d->held = false;
+
+	connect(bs, SIGNAL(readyRead()), SLOT(bs_readyRead()));
+	connect(bs, SIGNAL(connectionClosed()), SLOT(bs_connectionClosed()));
+	connect(bs, SIGNAL(delayedCloseFinished()), SLOT(bs_delayedCloseFinished()));
+	connect(bs, SIGNAL(error(int)), SLOT(bs_error(int)));
+	if(mode == Socks) {
+		connect(bs, SIGNAL(incomingMethods(int)), SLOT(sc_incomingMethods(int)));
+		connect(bs, SIGNAL(incomingConnectRequest(const QString &, int)), SLOT(sc_incomingConnectRequest(const QString &, int)));
+	}
+}
+
+StubConn::~StubConn()
+{
+	delete d->bs;
+	delete d;
+}
+
+bool StubConn::isHeld() const
+{
+	return d->held;
+}
+
+QString StubConn::key() const
+{
+	return d->key;
+}
+
+QString StubConn::newKey() const
+{
+	return d->newkey;
+}
+
+void StubConn::accept(int rtt)
+{
+	// the reply goes back a round trip later
+	d->held = false;
+	QTimer::singleShot(rtt, this, SLOT(reply()));
+	if(d->size > 0)
+		received(d->size);
+}
+
+void StubConn::bs_readyRead()
+{
+	if(d->mode == Poll)
+		processPoll();
+	else if(d->inHeader)
+		processConnect();
+	else
+		discard();
+}
+
+void StubConn::bs_connectionClosed()
+{
+	finished();
+}
+
+void StubConn::bs_delayedCloseFinished()
+{
+	finished();
+}
+
+void StubConn::bs_error(int)
+{
+	finished();
+}
+
+void StubConn::sc_incomingMethods(int)
+{
+	((SocksClient *)d->bs)->chooseMethod(SocksClient::AuthNone);
+}
+
+void StubConn::sc_incomingConnectRequest(const QString &, int)
+{
+	// there is no target, the stub is the far end
+	((SocksClient *)d->bs)->grantConnect();
+}
+
+void StubConn::discard()
+{
+	// look at the data in place, there is no need to copy it out
+	ByteSpanList spans;
+	int n = d->bs->peek(&spans);
+	d->bs->consume(n);
+	if(n > 0)
+		received(n);
+}
+
+void StubConn::processConnect()
+{
+	ByteStream::appendArray(&d->buf, d->bs->read());
+	int n = find_header_end(d->buf);
+	if(n == -1)
+		return;
+
+	int rest = d->buf.size() - (n + 4);
+	d->buf.resize(0);
+	d->inHeader = false;
+	d->bs->write(QCString("HTTP/1.0 200 Connection established\r\n\r\n"));
+	if(rest > 0)
+		received(rest);
+}
+
+void StubConn::processPoll()
+{
+	ByteStream::appendArray(&d->buf, d->bs->read());
+
+	// one request at a time, the next stays in the buffer until this one
+	//   is answered
+	if(d->pending)
+		return;
+	int n = find_header_end(d->buf);
+	if(n == -1)
+		return;
+	QStringList lines = QStringList::split("\r\n", QString::fromLatin1(d->buf.data(), n));
+	if(lines.isEmpty()) {
+		finished();
+		return;
+	}
+	int len = find_header(lines, "content-length").toInt();
+	int total = n + 4 + len;
+	if((int)d->buf.size() < total)
+		return;
+
+	QString conn = find_header(lines, "connection").lower();
+	d->http11 = (lines.first().right(8) == "HTTP/1.1");
+	if(d->http11)
+		d->keepAlive = (conn != "close");
+	else
+		d->keepAlive = (conn == "keep-alive");
+
+	// the body is "ident;key[;newkey],data"
+	int at = n + 4;
+	QString fields;
+	d->size = 0;
+	for(int i = at; i < total; ++i) {
+		if(d->buf[i] == ',') {
+			fields = QString::fromLatin1(d->buf.data() + at, i - at);
+			d->size = total - (i + 1);
+			break;
+		}
+	}
+	ByteStream::takeArray(&d->buf, total);
+
+	QStringList f = QStringList::split(';', fields, true);
+	d->key = f.count() > 1 ? f[1] : QString::null;
+	d->newkey = f.count() > 2 ? f[2] : QString::null;
+	d->pending = true;
+	d->held = true;
+	requestReady();
+}
+
+void StubConn::reply()
+{
+	d->pending = false;
+
+	// an HTTP/1.0 client can't be sent an interim reply
+	if(d->interim && d->http11)
+		d->bs->write(QCString("HTTP/1.1 100 Continue\r\n\r\n"));
+
+	QCString cs = "HTTP/1.1 200 OK\r\nSet-Cookie: ID=bench:1\r\nContent-Length: 0\r\n";
+	if(!d->keepAlive)
+		cs += "Connection: close\r\n";
+	cs += "\r\n";
+	d->bs->write(cs);
+
+	if(!d->keepAlive) {
+		d->bs->close();
+		return;
+	}
+	processPoll();
+}
+
+//----------------------------------------------------------------------------
+// Stub
+//----------------------------------------------------------------------------
+class Stub::Private
+{
+public:
+	Private() {}
+
+	StubConn::Mode mode;
+	int rtt;
+	bool interim;
+	ServSock *serv;
+	SocksServer *socks;
+	QPtrList<StubConn> conns;
+
+	// the key of the last poll request taken
+	QByteArray last;
+};
+
+Stub::Stub(StubConn::Mode mode, int rtt, bool interim)
+:QObject(0)
+{
+	d = new Private;
+	d->mode = mode;
+	d->rtt = rtt;
+	d->interim = interim;
+	d->serv = 0;
+	d->socks = 0;
+}
+
+Stub::~Stub()
+{
+	d->conns.setAutoDelete(true);
+	d->conns.clear();
+	delete d->socks;
+	delete d->serv;
+	delete d;
+}
+
+bool Stub::listen()
+{
+	// any free port will do
+	if(d->mode == StubConn::Socks) {
+		d->socks = new SocksServer;
+		connect(d->socks, SIGNAL(incomingReady()), SLOT(socks_incomingReady()));
+		return d->socks->listen(0);
+	}
+	else {
+		d->serv = new ServSock;
+		connect(d->serv, SIGNAL(connectionReady(int)), SLOT(ss_connectionReady(int)));
+		return d->serv->listen(0);
+	}
+}
+
+int Stub::port() const
+{
+	if(d->socks)
+		return d->socks->port();
+	else
+		return d->serv->port();
+}
+
+void Stub::ss_connectionReady(int s)
+{
+	BSocket *sock = new BSocket;
+	sock->setSocket(s);
+	add(sock);
+}
+
+void Stub::socks_incomingReady()
+{
+	SocksClient *c = d->socks->takeIncoming();
+	if(c)
+		add(c);
+}
+
+void Stub::add(ByteStream *bs)
+{
+	StubConn *c = new StubConn(bs, d->mode, d->interim);
+	connect(c, SIGNAL(received(int)), SIGNAL(received(int)));
+	connect(c, SIGNAL(finished()), SLOT(conn_finished()));
+	connect(c, SIGNAL(requestReady()), SLOT(conn_requestReady()));
+	d->conns.append(c);
+}
+
+void Stub::conn_finished()
+{
+	StubConn *c = (StubConn *)sender();
+	if(d->conns.removeRef(c))
+		c->deleteLater();
+}
+
+void Stub::conn_requestReady()
+{
+	// pipelined requests can come in on different connections in any
+	//   order.  take them the way the client sent them, as a server has to.
+	bool found = true;
+	while(found) {
+		found = false;
+		QPtrListIterator<StubConn> it(d->conns);
+		for(StubConn *c; (c = it.current()); ++it) {
+			if(!c->isHeld() || !follows(d->last, c->key()))
+				continue;
+			d->last = Base64::stringToArray(c->newKey().isEmpty() ? c->key() : c->newKey());
+			c->accept(d->rtt);
+			found = true;
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+// App
+//----------------------------------------------------------------------------
+class App::Private
+{
+public:
+	Private() {}
+
+	QStringList flavors;
+	QValueList<int> sizes;
+	int total;
+	int run;
+	int rtt, depth, packet;
+	bool interim;
+
+	QString flavor;
+	int size;
+	Stub *stub;
+	ByteStream *bs;
+	QByteArray payload;
+	int sent, got;
+	Sample before;
+};
+
+App::App(const QStringList &flavors, const QValueList<int> &sizes, int total, int rtt, int depth, int packet, bool interim)
+:QObject(0)
+{
+	d = new Private;
+	d->flavors = flavors;
+	d->sizes = sizes;
+	d->total = total;
+	d->rtt = rtt;
+	d->depth = depth;
+	d->packet = packet;
+	d->interim = interim;
+	d->run = 0;
+	d->stub = 0;
+	d->bs = 0;
+}
+
+App::~App()
+{
+	delete d->bs;
+	delete d->stub;
+	delete d;
+}
+
+void App::start()
+{
+	printf("%.0f MB per run, syscalls from %s", d->total / MEGABYTE, have_proc_syscalls() ? "/proc/self/io" : "stream counters");
+#ifndef HAVE_MALLOC_COUNT
+	printf(", allocations not counted");
+#endif
+	if(d->flavors.contains("poll")) {
+		printf("\npoll: %d ms round trip, %d in flight, ", d->rtt, d->depth);
+		if(d->packet > 0)
+			printf("%d bytes per request", d->packet);
+		else
+			printf("no request size limit");
+		if(d->interim)
+			printf(", 100 Continue ahead of each reply");
+	}
+	printf("\n\n");
+	printf("%-8s %7s %9s %12s %10s %7s %6s\n", "stream", "size", "MB/s", "syscalls/MB", "allocs/MB", "copies", "pool");
+	next();
+}
+
+void App::next()
+{
+	if(d->run >= (int)(d->flavors.count() * d->sizes.count())) {
+		quit();
+		return;
+	}
+
+	d->flavor = d->flavors[d->run / d->sizes.count()];
+	d->size = d->sizes[d->run % d->sizes.count()];
+	d->payload.resize(d->size);
+	memset(d->payload.data(), 'x', d->size);
+	d->sent = 0;
+	d->got = 0;
+
+	StubConn::Mode mode;
+	if(d->flavor == "socks")
+		mode = StubConn::Socks;
+	else if(d->flavor == "https")
+		mode = StubConn::Connect;
+	else if(d->flavor == "poll")
+		mode = StubConn::Poll;
+	else
+		mode = StubConn::Raw;
+
+	d->stub = new Stub(mode, d->rtt, d->interim);
+	connect(d->stub, SIGNAL(received(int)), SLOT(stub_received(int)));
+	if(!d->stub->listen()) {
+		printf("%-8s unable to listen\n", d->flavor.latin1());
+		done();
+		return;
+	}
+	int port = d->stub->port();
+
+	if(mode == StubConn::Socks) {
+		SocksClient *s = new SocksClient;
+		d->bs = s;
+		connect(s, SIGNAL(connected()), SLOT(st_connected()));
+		s->connectToHost("127.0.0.1", port, "localhost", 9);
+	}
+	else if(mode == StubConn::Connect) {
+		HttpConnect *s = new HttpConnect;
+		d->bs = s;
+		connect(s, SIGNAL(connected()), SLOT(st_connected()));
+		s->connectToHost("127.0.0.1", port, "localhost", 9);
+	}
+	else if(mode == StubConn::Poll) {
+		HttpPoll *s = new HttpPoll;
+		d->bs = s;
+		s->setPipelineDepth(d->depth);
+		s->setMaxPacketSize(d->packet);
+		connect(s, SIGNAL(connected()), SLOT(st_connected()));
+		s->connectToUrl(QString("http://127.0.0.1:%1/").arg(port));
+	}
+	else {
+		BSocket *s = new BSocket;
+		d->bs = s;
+		connect(s, SIGNAL(connected()), SLOT(st_connected()));
+		s->connectToHost("127.0.0.1", port);
+	}
+	connect(d->bs, SIGNAL(bytesWritten(int)), SLOT(st_bytesWritten(int)));
+	connect(d->bs, SIGNAL(error(int)), SLOT(st_error(int)));
+}
+
+void App::st_connected()
+{
+	d->before = sample();
+	fill();
+}
+
+void App::st_bytesWritten(int)
+{
+	fill();
+}
+
+void App::st_error(int x)
+{
+	printf("%-8s %7d stream error %d\n", d->flavor.latin1(), d->size, x);
+	done();
+}
+
+void App::stub_received(int x)
+{
+	d->got += x;
+	if(d->got < d->total)
+		return;
+
+	Sample after = sample();
+	double mb = d->got / MEGABYTE;
+	double secs = (after.usecs - d->before.usecs) / 1000000.0;
+	printf("%-8s %7d %9.1f %12.1f ", d->flavor.latin1(), d->size, secs > 0 ? mb / secs : 0.0, (after.syscalls - d->before.syscalls) / mb);
+#ifdef HAVE_MALLOC_COUNT
+	printf("%10.1f ", (after.allocs - d->before.allocs) / mb);
+#else
+	printf("%10s ", "-");
+#endif
+	printf("%7.2f ", (double)(after.stats.bytesCopied - d->before.stats.bytesCopied) / d->got);
+
+	// share of buffer requests served from the pool
+	Q_ULLONG hits = after.pool.hits - d->before.pool.hits;
+	Q_ULLONG takes = hits + after.pool.misses - d->before.pool.misses;
+	if(takes > 0)
+		printf("%5.1f%%\n", 100.0 * hits / takes);
+	else
+		printf("%6s\n", "-");
+	done();
+}
+
+void App::fill()
+{
+	// keep a window's worth queued, so the stream never runs dry
+	while(d->sent < d->total && d->bs->bytesToWrite() < WINDOW) {
+		int n = QMIN(d->size, d->total - d->sent);
+		if(n == d->size)
+			d->bs->write(d->payload);
+		else
+			d->bs->write(ByteStream::takeArray(&d->payload, n, false));
+		d->sent += n;
+	}
+}
+
+void App::done()
+{
+	if(d->bs) {
+		d->bs->disconnect(this);
+		d->bs->deleteLater();
+		d->bs = 0;
+	}
+	if(d->stub) {
+		d->stub->disconnect(this);
+		d->stub->deleteLater();
+		d->stub = 0;
+	}
+	++d->run;
+	QTimer::singleShot(0, this, SLOT(next()));
+}
+
+
+int main(int argc, char **argv)
+{
+	QApplication app(argc, argv, false);
+
+	int total = 32;
+	int rtt = 0;
+	int depth = 1;
+	int packet = 0;
+	bool interim = false;
+	QStringList flavors;
+	QValueList<int> sizes;
+	for(int n = 1; n < argc; ++n) {
+		QString s = argv[n];
+		if(s.left(8) == "--total=")
+			total = s.mid(8).toInt();
+		else if(s.left(10) == "--streams=")
+			flavors = QStringList::split(',', s.mid(10));
+		else if(s.left(6) == "--rtt=")
+			rtt = s.mid(6).toInt();
+		else if(s.left(11) == "--pipeline=")
+			depth = s.mid(11).toInt();
+		else if(s.left(9) == "--packet=")
+			packet = s.mid(9).toInt();
+		else if(s == "--interim")
+			interim = true;
+		else if(s.toInt() > 0)
+			sizes += s.toInt();
+		else {
+			printf("usage: bench [--total=MB] [--streams=bsocket,socks,https,poll] [--rtt=ms] [--pipeline=N] [--packet=bytes] [--interim] [sizes ...]\n\n");
+			return 0;
+		}
+	}
+	if(total <= 0)
+		total = 32;
+	if(rtt < 0)
+		rtt = 0;
+	if(depth < 1)
+		depth = 1;
+	if(flavors.isEmpty())
+		flavors << "bsocket" << "socks" << "https" << "poll";
+	if(sizes.isEmpty())
+		sizes << 64 << 1024 << 16384 << 65536;
+
+	App *a = new App(flavors, sizes, total * 1024 * 1024, rtt, depth, packet, interim);
+	QObject::connect(a, SIGNAL(quit()), &app, SLOT(quit()));
+	a->start();
+	app.exec();
+	delete a;
+
+	return 0;
+}
@@ -0,0 +1,101 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include<qobject.h>
+#include<qstringlist.h>
+
+class ByteStream;
+
+// server end of one connection, which swallows what it is sent
+class StubConn : public QObject
+{
+	Q_OBJECT
+public:
+	enum Mode { Raw, Socks, Connect, Poll };
+	StubConn(ByteStream *bs, Mode mode, bool interim=false);
+	~StubConn();
+
+	// poll requests wait for the stub to take them in key order
+	bool isHeld() const;
+	QString key() const;
+	QString newKey() const;
+	void accept(int rtt);
+
+signals:
+	void received(int);
+	void finished();
+	void requestReady();
+
+private slots:
+	void bs_readyRead();
+	void bs_connectionClosed();
+	void bs_delayedCloseFinished();
+	void bs_error(int);
+	void sc_incomingMethods(int);
+	void sc_incomingConnectRequest(const QString &host, int port);
+	void reply();
+
+private:
+	class Private;
+	Private *d;
+
+	void discard();
+	void processConnect();
+	void processPoll();
+};
+
+// local endpoint for one stream flavor
+class Stub : public QObject
+{
+	Q_OBJECT
+public:
+	Stub(StubConn::Mode mode, int rtt=0, bool interim=false);
+	~Stub();
+
+	bool listen();
+	int port() const;
+
+signals:
+	void received(int);
+
+private slots:
+	void ss_connectionReady(int);
+	void socks_incomingReady();
+	void conn_finished();
+	void conn_requestReady();
+
+private:
+	class Private;
+	Private *d;
+
+	void add(ByteStream *bs);
+};
+
+class App : public QObject
+{
+	Q_OBJECT
+public:
+	App(const QStringList &flavors, const QValueList<int> &sizes, int total, int rtt=0, int depth=1, int packet=0, bool interim=false);
+	~App();
+
+	void start();
+
+signals:
+	void quit();
+
+private slots:
+	void next();
+	void st_connected();
+	void st_bytesWritten(int);
+	void st_error(int);
+	void stub_received(int);
+
+private:
+	class Private;
+	Private *d;
+
+	void fill();
+	void done();
+};
+
+#endif
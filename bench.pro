@@ -0,0 +1,42 @@
+CONFIG += thread
+TARGET  = bench
+
+INCLUDEPATH += util network
+
+HEADERS = \
+	util/bytestream.h \
+	util/bufferpool.h \
+	util/reactor.h \
+	util/base64.h \
+	util/safedelete.h \
+	util/qrandom.h \
+	network/ndns.h \
+	network/dnsclient.h \
+	network/srvresolver.h \
+	network/bsocket.h \
+	network/servsock.h \
+	network/workerpool.h \
+	network/socks.h \
+	network/httpconnect.h \
+	network/httppoll.h \
+	network/httpparser.h \
+	bench.h
+
+SOURCES = \
+	util/bytestream.cpp \
+	util/bufferpool.cpp \
+	util/reactor.cpp \
+	util/base64.cpp \
+	util/safedelete.cpp \
+	util/qrandom.cpp \
+	network/ndns.cpp \
+	network/dnsclient.cpp \
+	network/srvresolver.cpp \
+	network/bsocket.cpp \
+	network/servsock.cpp \
+	network/workerpool.cpp \
+	network/socks.cpp \
+	network/httpconnect.cpp \
+	network/httppoll.cpp \
+	network/httpparser.cpp \
+	bench.cpp
@@ -0,0 +1,373 @@
+#include"dnstest.h"
+
+#include<qapplication.h>
+#include<qsocketdevice.h>
+#include<qvaluelist.h>
+#include<qfile.h>
+#include<qdatetime.h>
+#include<qtimer.h>
+#include"reactor.h"
+#include"dnsclient.h"
+#include"ndns.h"
+
+#include<stdio.h>
+#include<string.h>
+
+static inline int get16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static void put16(QByteArray *a, int at, int x)
+{
+	(*a)[at] = (char)(x >> 8);
+	(*a)[at + 1] = (char)(x & 0xff);
+}
+
+static void append(QByteArray *a, const char *p, int len)
+{
+	int at = a->size();
+	a->resize(at + len);
+	memcpy(a->data() + at, p, len);
+}
+
+static void append16(QByteArray *a, int x)
+{
+	char b[2];
+	b[0] = (char)(x >> 8);
+	b[1] = (char)(x & 0xff);
+	append(a, b, 2);
+}
+
+// name in wire form, no compression
+static void appendName(QByteArray *a, const QCString &name)
+{
+	QStringList parts = QStringList::split('.', QString::fromLatin1(name));
+	for(QStringList::ConstIterator it = parts.begin(); it != parts.end(); ++it) {
+		QCString label = (*it).latin1();
+		char l = label.length();
+		append(a, &l, 1);
+		append(a, label.data(), label.length());
+	}
+	append(a, "", 1);
+}
+
+static bool hostsHasLocalhost()
+{
+	QFile f("/etc/hosts");
+	if(!f.open(IO_ReadOnly))
+		return false;
+	QString line;
+	while(f.readLine(line, 1024) != -1) {
+		QStringList parts = QStringList::split(' ', line.simplifyWhiteSpace());
+		if(parts.count() >= 2 && parts[0] == "127.0.0.1" && parts.contains("localhost"))
+			return true;
+	}
+	return false;
+}
+
+//----------------------------------------------------------------------------
+// StubServer
+//----------------------------------------------------------------------------
+class StubServer::Private
+{
+public:
+	Private() {}
+
+	QSocketDevice *sock;
+	SocketWatcher *sn;
+	int queries;
+	QValueList<int> ports;
+};
+
+StubServer::StubServer()
+:QObject(0)
+{
+	d = new Private;
+	d->sock = 0;
+	d->sn = 0;
+	d->queries = 0;
+}
+
+StubServer::~StubServer()
+{
+	delete d->sn;
+	delete d->sock;
+	delete d;
+}
+
+bool StubServer::listen()
+{
+	d->sock = new QSocketDevice(QSocketDevice::Datagram);
+	d->sock->setBlocking(false);
+	if(!d->sock->bind(QHostAddress(0x7f000001), 0))
+		return false;
+	d->sn = new SocketWatcher(d->sock->socket(), SocketWatcher::Read);
+	connect(d->sn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
+	return true;
+}
+
+int StubServer::port() const
+{
+	return d->sock->port();
+}
+
+int StubServer::queries() const
+{
+	return d->queries;
+}
+
+int StubServer::sourcePorts() const
+{
+	return d->ports.count();
+}
+
+void StubServer::sn_activated(int)
+{
+	while(1) {
+		QByteArray buf(1500);
+		Q_LONG r = d->sock->readBlock(buf.data(), buf.size());
+		if(r <= 0)
+			break;
+		buf.resize(r);
+		++d->queries;
+		Q_UINT16 port = d->sock->peerPort();
+		if(!d->ports.contains(port))
+			d->ports += port;
+		answer(buf, d->sock->peerAddress(), port);
+	}
+}
+
+void StubServer::answer(const QByteArray &query, const QHostAddress &from, Q_UINT16 port)
+{
+	// find the end of the question
+	const unsigned char *p = (const unsigned char *)query.data();
+	int size = query.size();
+	if(size < 12)
+		return;
+	QCString name;
+	int at = 12;
+	while(at < size && p[at] != 0) {
+		int l = p[at];
+		if(at + 1 + l > size)
+			return;
+		if(!name.isEmpty())
+			name += '.';
+		name += QCString(query.data() + at + 1, l + 1);
+		at += 1 + l;
+	}
+	at += 1;
+	if(at + 4 > size)
+		return;
+	int type = get16(p + at);
+	at += 4;
+
+	if(name == "drop.test")
+		return;
+
+	QByteArray reply(at);
+	memcpy(reply.data(), query.data(), at);
+	reply[2] = (char)0x81; // response, recursion desired
+	reply[3] = (char)0x80; // recursion available, no error
+	put16(&reply, 6, 0);
+	put16(&reply, 8, 0);
+	put16(&reply, 10, 0);
+
+	QByteArray rdata;
+	int id = get16(p);
+	if(type == DnsClient::A && (name == "a.test" || name == "forged.test" || name == "localhost")) {
+		rdata.resize(4);
+		rdata[0] = 10;
+		rdata[1] = 0;
+		rdata[2] = 0;
+		rdata[3] = (name == "localhost") ? 9 : 1;
+
+		if(name == "forged.test") {
+			// something that guessed wrong gets in first
+			QByteArray fake = reply.copy();
+			put16(&fake, 0, id ^ 0x5a5a);
+			put16(&fake, 6, 1);
+			append16(&fake, 0xc00c);
+			append16(&fake, DnsClient::A);
+			append16(&fake, 1);
+			append16(&fake, 0);
+			append16(&fake, 60);
+			append16(&fake, 4);
+			append(&fake, "\x06\x06\x06\x06", 4);
+			d->sock->writeBlock(fake.data(), fake.size(), from, port);
+			rdata[3] = 2;
+		}
+	}
+	else if(type == DnsClient::Srv && name == "_xmpp-client._tcp.test") {
+		append16(&rdata, 5);
+		append16(&rdata, 10);
+		append16(&rdata, 5222);
+		appendName(&rdata, "xmpp.test");
+	}
+	else {
+		reply[3] = (char)0x83; // no such name
+	}
+
+	if(!rdata.isEmpty()) {
+		put16(&reply, 6, 1);
+		append16(&reply, 0xc00c);
+		append16(&reply, type);
+		append16(&reply, 1);
+		append16(&reply, 0);
+		append16(&reply, 60);
+		append16(&reply, rdata.size());
+		append(&reply, rdata.data(), rdata.size());
+	}
+	d->sock->writeBlock(reply.data(), reply.size(), from, port);
+}
+
+//----------------------------------------------------------------------------
+// App
+//----------------------------------------------------------------------------
+enum { CaseA, CaseSrv, CaseNoName, CaseForged, CaseHosts, CaseTimeout, CaseDone };
+
+class App::Private
+{
+public:
+	Private() {}
+
+	StubServer stub;
+	DnsClient dns;
+	NDns ndns;
+	int at;
+	int failures;
+	QTime time;
+};
+
+App::App()
+:QObject(0)
+{
+	d = new Private;
+	d->at = 0;
+	d->failures = 0;
+	connect(&d->dns, SIGNAL(resultsReady()), SLOT(dns_resultsReady()));
+	connect(&d->ndns, SIGNAL(resultsReady()), SLOT(ndns_resultsReady()));
+}
+
+App::~App()
+{
+	delete d;
+}
+
+int App::failures() const
+{
+	return d->failures;
+}
+
+void App::start()
+{
+	if(!d->stub.listen()) {
+		printf("unable to listen\n");
+		++d->failures;
+		QTimer::singleShot(0, this, SIGNAL(quit()));
+		return;
+	}
+	QValueList<QHostAddress> list;
+	list += QHostAddress(0x7f000001);
+	DnsClient::setNameServers(list, d->stub.port());
+	printf("stub nameserver on 127.0.0.1:%d\n", d->stub.port());
+	next();
+}
+
+void App::check(bool ok, const char *what)
+{
+	printf("%-40s %s\n", what, ok ? "ok" : "FAIL");
+	if(!ok)
+		++d->failures;
+}
+
+void App::next()
+{
+	d->time.start();
+	switch(d->at) {
+		case CaseA:
+			d->dns.resolve("a.test", DnsClient::A);
+			break;
+		case CaseSrv:
+			d->dns.resolve("_xmpp-client._tcp.test", DnsClient::Srv);
+			break;
+		case CaseNoName:
+			d->dns.resolve("missing.test", DnsClient::A);
+			break;
+		case CaseForged:
+			d->dns.resolve("forged.test", DnsClient::A);
+			break;
+		case CaseHosts:
+			// the stub knows localhost too, under another address
+			if(!hostsHasLocalhost()) {
+				printf("%-40s skipped, not in /etc/hosts\n", "hosts file before nameserver");
+				++d->at;
+				next();
+				return;
+			}
+			d->ndns.resolve("localhost.");
+			break;
+		case CaseTimeout:
+			printf("waiting for a query that is never answered...\n");
+			d->dns.resolve("drop.test", DnsClient::A);
+			break;
+		default:
+			check(d->stub.sourcePorts() > 1, "queries sent from different ports");
+			printf("%d failed\n", d->failures);
+			quit();
+			return;
+	}
+}
+
+void App::dns_resultsReady()
+{
+	QValueList<QHostAddress> addrs = d->dns.addresses();
+	switch(d->at) {
+		case CaseA:
+			check(d->dns.success() && addrs.count() == 1 && addrs.first().toString() == "10.0.0.1", "A record");
+			break;
+		case CaseSrv: {
+			QValueList<QDns::Server> list = d->dns.servers();
+			bool ok = (d->dns.success() && list.count() == 1);
+			if(ok) {
+				QDns::Server s = list.first();
+				ok = (s.name == "xmpp.test" && s.priority == 5 && s.weight == 10 && s.port == 5222);
+			}
+			check(ok, "SRV record");
+			break;
+		}
+		case CaseNoName:
+			check(d->dns.errorCode() == DnsClient::ErrNoName, "no such name");
+			break;
+		case CaseForged:
+			check(d->dns.success() && addrs.count() == 1 && addrs.first().toString() == "10.0.0.2", "answer with the wrong ID ignored");
+			break;
+		case CaseTimeout:
+			check(d->dns.errorCode() == DnsClient::ErrTimeout, "timeout");
+			break;
+	}
+	++d->at;
+	QTimer::singleShot(0, this, SLOT(next()));
+}
+
+void App::ndns_resultsReady()
+{
+	// answered from the hosts file, without waiting on the nameserver
+	check(d->ndns.resultString() == "127.0.0.1" && d->time.elapsed() < 1000, "hosts file before nameserver");
+	++d->at;
+	QTimer::singleShot(0, this, SLOT(next()));
+}
+
+int main(int argc, char **argv)
+{
+	QApplication app(argc, argv, false);
+
+	App *a = new App;
+	QObject::connect(a, SIGNAL(quit()), &app, SLOT(quit()));
+	a->start();
+	app.exec();
+	int failures = a->failures();
+	delete a;
+
+	return failures > 0 ? 1 : 0;
+}
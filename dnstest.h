@@ -0,0 +1,55 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include<qobject.h>
+#include<qhostaddress.h>
+
+// nameserver on 127.0.0.1 that answers from a fixed table
+class StubServer : public QObject
+{
+	Q_OBJECT
+public:
+	StubServer();
+	~StubServer();
+
+	bool listen();
+	int port() const;
+	int queries() const;
+	int sourcePorts() const;
+
+private slots:
+	void sn_activated(int);
+
+private:
+	class Private;
+	Private *d;
+
+	void answer(const QByteArray &query, const QHostAddress &from, Q_UINT16 port);
+};
+
+class App : public QObject
+{
+	Q_OBJECT
+public:
+	App();
+	~App();
+
+	void start();
+	int failures() const;
+
+signals:
+	void quit();
+
+private slots:
+	void next();
+	void dns_resultsReady();
+	void ndns_resultsReady();
+
+private:
+	class Private;
+	Private *d;
+
+	void check(bool ok, const char *what);
+};
+
+#endif
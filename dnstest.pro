@@ -0,0 +1,20 @@
+CONFIG += thread
+TARGET  = dnstest
+
+INCLUDEPATH += util network
+
+HEADERS = \
+	util/reactor.h \
+	util/safedelete.h \
+	util/qrandom.h \
+	network/ndns.h \
+	network/dnsclient.h \
+	dnstest.h
+
+SOURCES = \
+	util/reactor.cpp \
+	util/safedelete.cpp \
+	util/qrandom.cpp \
+	network/ndns.cpp \
+	network/dnsclient.cpp \
+	dnstest.cpp
@@ -5,6 +5,7 @@ INCLUDEPATH += /usr/local
 
 HEADERS = \
 	util/bytestream.h \
+	util/bufferpool.h \
 	util/base64.h \
 	util/qrandom.h \
 	util/cipher.h \
@@ -14,6 +15,7 @@ HEADERS = \
 
 SOURCES = \
 	util/bytestream.cpp \
+	util/bufferpool.cpp \
 	util/base64.cpp \
 	util/qrandom.cpp \
 	util/cipher.cpp \
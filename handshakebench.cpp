@@ -0,0 +1,208 @@
+#include"handshakebench.h"
+
+#include<qapplication.h>
+#include<qptrlist.h>
+#include<qtimer.h>
+#include"socks.h"
+
+#include<stdio.h>
+#include<sys/time.h>
+
+static long usecs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+class App::Private
+{
+public:
+	Private() {}
+
+	SocksServer serv;
+	SocksPool *pool;
+	QPtrList<SocksClient> clients;
+	int concurrency, total;
+	bool auth, pipelined;
+	int poolSize;
+	int started, done, failed;
+	long start;
+};
+
+App::App(int concurrency, int total, bool auth, bool pipelined, int poolSize)
+:QObject(0)
+{
+	d = new Private;
+	d->concurrency = concurrency;
+	d->total = total;
+	d->auth = auth;
+	d->pipelined = pipelined;
+	d->poolSize = poolSize;
+	d->pool = 0;
+	d->started = 0;
+	d->done = 0;
+	d->failed = 0;
+	connect(&d->serv, SIGNAL(incomingReady()), SLOT(ss_incomingReady()));
+}
+
+App::~App()
+{
+	d->clients.setAutoDelete(true);
+	d->clients.clear();
+	delete d->pool;
+	delete d;
+}
+
+void App::start()
+{
+	if(!d->serv.listen(0)) {
+		printf("unable to listen\n");
+		QTimer::singleShot(0, this, SIGNAL(quit()));
+		return;
+	}
+
+	if(d->poolSize > 0) {
+		d->pool = new SocksPool;
+		if(d->auth)
+			d->pool->setProxy("127.0.0.1", d->serv.port(), "bench", "bench");
+		else
+			d->pool->setProxy("127.0.0.1", d->serv.port());
+		d->pool->setSize(d->poolSize);
+	}
+
+	printf("%d handshakes, %d at a time, %s, %s", d->total, d->concurrency, d->auth ? "username/password" : "no auth", d->pipelined ? "pipelined" : "step by step");
+	if(d->pool)
+		printf(", pool of %d", d->poolSize);
+	printf("\n");
+	d->start = usecs();
+	for(int n = 0; n < d->concurrency; ++n)
+		next();
+}
+
+void App::next()
+{
+	if(d->started >= d->total)
+		return;
+	++d->started;
+
+	SocksClient *c = new SocksClient;
+	connect(c, SIGNAL(connected()), SLOT(client_connected()));
+	connect(c, SIGNAL(error(int)), SLOT(client_error(int)));
+	if(d->auth)
+		c->setAuth("bench", "bench");
+	c->setPipelined(d->pipelined);
+	d->clients.append(c);
+	if(d->pool)
+		c->connectToHost(d->pool, "example.com", 80);
+	else
+		c->connectToHost("127.0.0.1", d->serv.port(), "example.com", 80);
+}
+
+void App::ss_incomingReady()
+{
+	SocksClient *c = d->serv.takeIncoming();
+	if(!c)
+		return;
+	connect(c, SIGNAL(incomingMethods(int)), SLOT(sc_incomingMethods(int)));
+	connect(c, SIGNAL(incomingAuth(const QString &, const QString &)), SLOT(sc_incomingAuth(const QString &, const QString &)));
+	connect(c, SIGNAL(incomingConnectRequest(const QString &, int)), SLOT(sc_incomingConnectRequest(const QString &, int)));
+	connect(c, SIGNAL(connectionClosed()), SLOT(sc_closed()));
+	connect(c, SIGNAL(error(int)), SLOT(sc_closed()));
+}
+
+void App::sc_incomingMethods(int m)
+{
+	SocksClient *c = (SocksClient *)sender();
+	if(d->auth && m & SocksClient::AuthUsername)
+		c->chooseMethod(SocksClient::AuthUsername);
+	else
+		c->chooseMethod(SocksClient::AuthNone);
+}
+
+void App::sc_incomingAuth(const QString &, const QString &)
+{
+	SocksClient *c = (SocksClient *)sender();
+	c->authGrant(true);
+}
+
+void App::sc_incomingConnectRequest(const QString &, int)
+{
+	// pretend the target is there
+	SocksClient *c = (SocksClient *)sender();
+	c->grantConnect();
+}
+
+void App::sc_closed()
+{
+	SocksClient *c = (SocksClient *)sender();
+	c->deleteLater();
+}
+
+void App::client_connected()
+{
+	SocksClient *c = (SocksClient *)sender();
+	++d->done;
+	d->clients.removeRef(c);
+	c->deleteLater();
+	next();
+
+	if(d->done + d->failed < d->total)
+		return;
+
+	double secs = (usecs() - d->start) / 1000000.0;
+	printf("%d done, %d failed, %.2f seconds, %.0f handshakes/sec\n", d->done, d->failed, secs, secs > 0 ? d->done / secs : 0.0);
+	QTimer::singleShot(0, this, SIGNAL(quit()));
+}
+
+void App::client_error(int x)
+{
+	SocksClient *c = (SocksClient *)sender();
+	fprintf(stderr, "handshake error %d\n", x);
+	++d->failed;
+	d->clients.removeRef(c);
+	c->deleteLater();
+	next();
+	if(d->done + d->failed >= d->total)
+		QTimer::singleShot(0, this, SIGNAL(quit()));
+}
+
+int main(int argc, char **argv)
+{
+	QApplication app(argc, argv, false);
+
+	int concurrency = 50;
+	int total = 20000;
+	bool auth = false;
+	bool pipelined = false;
+	int pool = 0;
+	for(int n = 1; n < argc; ++n) {
+		QString s = argv[n];
+		if(s == "--auth")
+			auth = true;
+		else if(s == "--pipelined")
+			pipelined = true;
+		else if(s.left(7) == "--pool=")
+			pool = s.mid(7).toInt();
+		else if(s.left(14) == "--concurrency=")
+			concurrency = s.mid(14).toInt();
+		else if(s.left(8) == "--total=")
+			total = s.mid(8).toInt();
+		else {
+			printf("usage: handshakebench [--auth] [--pipelined] [--pool=N] [--concurrency=N] [--total=N]\n\n");
+			return 0;
+		}
+	}
+	if(concurrency < 1 || total < 1) {
+		printf("concurrency and total must be positive\n");
+		return 1;
+	}
+
+	App *a = new App(concurrency, total, auth, pipelined, pool);
+	QObject::connect(a, SIGNAL(quit()), &app, SLOT(quit()));
+	a->start();
+	app.exec();
+	delete a;
+
+	return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include<qobject.h>
+
+class App : public QObject
+{
+	Q_OBJECT
+public:
+	App(int concurrency, int total, bool auth, bool pipelined, int poolSize);
+	~App();
+
+	void start();
+
+signals:
+	void quit();
+
+private slots:
+	void ss_incomingReady();
+	void sc_incomingMethods(int);
+	void sc_incomingAuth(const QString &user, const QString &pass);
+	void sc_incomingConnectRequest(const QString &host, int port);
+	void sc_closed();
+	void client_connected();
+	void client_error(int);
+
+private:
+	class Private;
+	Private *d;
+
+	void next();
+};
+
+#endif
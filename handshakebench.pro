@@ -0,0 +1,34 @@
+CONFIG += thread
+TARGET  = handshakebench
+
+INCLUDEPATH += util network
+
+HEADERS = \
+	util/bytestream.h \
+	util/bufferpool.h \
+	util/reactor.h \
+	util/safedelete.h \
+	util/qrandom.h \
+	network/ndns.h \
+	network/dnsclient.h \
+	network/srvresolver.h \
+	network/bsocket.h \
+	network/servsock.h \
+	network/workerpool.h \
+	network/socks.h \
+	handshakebench.h
+
+SOURCES = \
+	util/bytestream.cpp \
+	util/bufferpool.cpp \
+	util/reactor.cpp \
+	util/safedelete.cpp \
+	util/qrandom.cpp \
+	network/ndns.cpp \
+	network/dnsclient.cpp \
+	network/srvresolver.cpp \
+	network/bsocket.cpp \
+	network/servsock.cpp \
+	network/workerpool.cpp \
+	network/socks.cpp \
+	handshakebench.cpp
@@ -23,21 +23,42 @@
 #include<qcstring.h>
 #include<qsocket.h>
 #include<qdns.h>
+#include<qtimer.h>
+#include<qptrlist.h>
 #include<qguardedptr.h>
 #include"safedelete.h"
+#include"bufferpool.h"
 #ifndef NO_NDNS
 #include"ndns.h"
 #endif
 #include"srvresolver.h"
 
+#ifdef Q_OS_UNIX
+#include<unistd.h>
+#endif
+
 #ifdef BS_DEBUG
 #include<stdio.h>
 #endif
 
 #define READBUFSIZE 65536
 
+// head start given to each SRV target before the next one is tried as well
+#define CONNECT_STAGGER 300
+
 // CS_NAMESPACE_BEGIN
 
+// one SRV target being raced by connectToServer()
+class BSocket::Attempt
+{
+public:
+	Q_UINT16 port;
+#ifndef NO_NDNS
+	NDns *ndns;
+#endif
+	QSocket *sock;
+};
+
 class BSocket::Private
 {
 public:
@@ -56,6 +77,11 @@ public:
 	QString host;
 	int port;
 	SafeDelete sd;
+
+	QValueList<QDns::Server> candidates;
+	QPtrList<Attempt> attempts;
+	QTimer stagger;
+	bool resolved;
 };
 
 BSocket::BSocket(QObject *parent)
@@ -66,6 +92,7 @@ BSocket::BSocket(QObject *parent)
 	connect(&d->ndns, SIGNAL(resultsReady()), SLOT(ndns_done()));
 #endif
 	connect(&d->srv, SIGNAL(resultsReady()), SLOT(srv_done()));
+	connect(&d->stagger, SIGNAL(timeout()), SLOT(t_stagger()));
 
 	reset();
 }
@@ -83,18 +110,14 @@ void BSocket::reset(bool clear)
 
 		if(!clear && d->qsock->isOpen()) {
 			// move remaining into the local queue
-			QByteArray block(d->qsock->bytesAvailable());
-			d->qsock->readBlock(block.data(), block.size());
-			appendRead(block);
+			pullSocket();
 		}
 
 		d->sd.deleteLater(d->qsock);
 		d->qsock = 0;
 	}
-	else {
-		if(clear)
-			clearReadBuffer();
-	}
+	if(clear)
+		clearReadBuffer();
 
 	if(d->srv.isBusy())
 		d->srv.stop();
@@ -102,6 +125,7 @@ void BSocket::reset(bool clear)
 	if(d->ndns.isBusy())
 		d->ndns.stop();
 #endif
+	clearAttempts();
 	d->state = Idle;
 }
 
@@ -109,17 +133,44 @@ void BSocket::ensureSocket()
 {
 	if(!d->qsock) {
 		d->qsock = new QSocket;
+		setupSocket();
+	}
+}
+
+void BSocket::setupSocket()
+{
 #if QT_VERSION >= 0x030200
-		d->qsock->setReadBufferSize(READBUFSIZE);
+	d->qsock->setReadBufferSize(readLimit() > 0 ? readLimit() : READBUFSIZE);
 #endif
-		connect(d->qsock, SIGNAL(hostFound()), SLOT(qs_hostFound()));
-		connect(d->qsock, SIGNAL(connected()), SLOT(qs_connected()));
-		connect(d->qsock, SIGNAL(connectionClosed()), SLOT(qs_connectionClosed()));
-		connect(d->qsock, SIGNAL(delayedCloseFinished()), SLOT(qs_delayedCloseFinished()));
-		connect(d->qsock, SIGNAL(readyRead()), SLOT(qs_readyRead()));
-		connect(d->qsock, SIGNAL(bytesWritten(int)), SLOT(qs_bytesWritten(int)));
-		connect(d->qsock, SIGNAL(error(int)), SLOT(qs_error(int)));
+	connect(d->qsock, SIGNAL(hostFound()), SLOT(qs_hostFound()));
+	connect(d->qsock, SIGNAL(connected()), SLOT(qs_connected()));
+	connect(d->qsock, SIGNAL(connectionClosed()), SLOT(qs_connectionClosed()));
+	connect(d->qsock, SIGNAL(delayedCloseFinished()), SLOT(qs_delayedCloseFinished()));
+	connect(d->qsock, SIGNAL(readyRead()), SLOT(qs_readyRead()));
+	connect(d->qsock, SIGNAL(bytesWritten(int)), SLOT(qs_bytesWritten(int)));
+	connect(d->qsock, SIGNAL(error(int)), SLOT(qs_error(int)));
+}
+
+void BSocket::pullSocket()
+{
+	if(!d->qsock)
+		return;
+
+	// move whatever QSocket has buffered into the read chain, in place
+	int size = d->qsock->bytesAvailable();
+	if(size <= 0)
+		return;
+	ByteSpanList spans;
+	readChain().prepare(size, &spans);
+	int total = 0;
+	for(ByteSpanList::ConstIterator it = spans.begin(); it != spans.end() && total < size; ++it) {
+		int r = d->qsock->readBlock((*it).data, QMIN((*it).size, size - total));
+		if(r <= 0)
+			break;
+		total += r;
 	}
+	readChain().commit(total);
+	recordRead(total);
 }
 
 void BSocket::connectToHost(const QString &host, Q_UINT16 port)
@@ -140,7 +191,7 @@ void BSocket::connectToServer(const QString &srv, const QString &type)
 {
 	reset(true);
 	d->state = HostLookup;
-	d->srv.resolve(srv, type, "tcp");
+	d->srv.resolveSrvOnly(srv, type, "tcp");
 }
 
 int BSocket::socket() const
@@ -200,17 +251,35 @@ void BSocket::write(const QByteArray &a)
 	fprintf(stderr, "BSocket: writing [%d]: {%s}\n", a.size(), cs.data());
 #endif
 	d->qsock->writeBlock(a.data(), a.size());
+	recordWrite(a.size());
+}
+
+void BSocket::writev(const QValueList<QByteArray> &list)
+{
+	if(d->state != Connected)
+		return;
+	// QSocket queues each block on its own, so there is nothing to join
+	for(QValueList<QByteArray>::ConstIterator it = list.begin(); it != list.end(); ++it) {
+		d->qsock->writeBlock((*it).data(), (*it).size());
+		recordWrite((*it).size());
+	}
 }
 
 QByteArray BSocket::read(int bytes)
 {
 	QByteArray block;
-	if(d->qsock) {
+	if(d->qsock && ByteStream::bytesAvailable() > 0) {
+		// data was already pulled in by peek()
+		pullSocket();
+		block = ByteStream::read(bytes);
+	}
+	else if(d->qsock) {
 		int max = bytesAvailable();
 		if(bytes <= 0 || bytes > max)
 			bytes = max;
-		block.resize(bytes);
+		block = BufferPool::take(bytes);
 		d->qsock->readBlock(block.data(), block.size());
+		recordRead(block.size());
 	}
 	else
 		block = ByteStream::read(bytes);
@@ -225,10 +294,66 @@ QByteArray BSocket::read(int bytes)
 	return block;
 }
 
+int BSocket::peek(ByteSpanList *spans, int bytes)
+{
+	pullSocket();
+	return ByteStream::peek(spans, bytes);
+}
+
+bool BSocket::isDetachable() const
+{
+#ifdef Q_OS_UNIX
+	if(d->state != Connected || !d->qsock)
+		return false;
+	if(ByteStream::bytesAvailable() > 0 || d->qsock->bytesAvailable() > 0 || d->qsock->bytesToWrite() > 0)
+		return false;
+	return true;
+#else
+	return false;
+#endif
+}
+
+int BSocket::detachSocket()
+{
+	if(!isDetachable())
+		return -1;
+
+#ifdef Q_OS_UNIX
+	int s = d->qsock->socket();
+	int fd = ::dup(s);
+	if(fd == -1)
+		return -1;
+
+	// QSocket watches its descriptor until it is actually deleted.  Swap a
+	//   dead pipe in underneath it, so that it can't read anything meanwhile.
+	int p[2];
+	if(::pipe(p) == 0) {
+		::dup2(p[0], s);
+		::close(p[0]);
+		::close(p[1]);
+	}
+
+	reset(true);
+	return fd;
+#else
+	return -1;
+#endif
+}
+
+void BSocket::setReadEnabled(bool)
+{
+	// QSocket can't be told to stop reading, but it does so by itself once
+	//   its buffer is full, and starts again as it is read from
+#if QT_VERSION >= 0x030200
+	if(d->qsock)
+		d->qsock->setReadBufferSize(readLimit() > 0 ? readLimit() : READBUFSIZE);
+#endif
+}
+
 int BSocket::bytesAvailable() const
 {
 	if(d->qsock)
-		return d->qsock->bytesAvailable();
+		return ByteStream::bytesAvailable() + d->qsock->bytesAvailable();
 	else
 		return ByteStream::bytesAvailable();
 }
@@ -282,11 +407,174 @@ void BSocket::srv_done()
 		return;
 	}
 
-	d->host = d->srv.resultAddress().toString();
-	d->port = d->srv.resultPort();
-	do_connect();
-	//QTimer::singleShot(0, this, SLOT(do_connect()));
-	//hostFound();
+	// race the targets, best first
+	d->candidates = d->srv.servers();
+	d->resolved = false;
+	d->state = Connecting;
+	startAttempt();
+}
+
+void BSocket::startAttempt()
+{
+	QDns::Server s = d->candidates.first();
+	d->candidates.remove(d->candidates.begin());
+
+	Attempt *a = new Attempt;
+	a->port = s.port;
+	a->sock = 0;
+	d->attempts.append(a);
+
+	// the rest wait a little, unless this one fails first
+	if(!d->candidates.isEmpty())
+		d->stagger.start(CONNECT_STAGGER, true);
+
+#ifndef NO_NDNS
+	a->ndns = new NDns;
+	connect(a->ndns, SIGNAL(resultsReady()), SLOT(att_ndns_done()));
+	a->ndns->resolve(s.name);
+#else
+	// QSocket looks the name up itself
+	d->resolved = true;
+	attemptConnect(a, s.name);
+#endif
+}
+
+void BSocket::attemptConnect(Attempt *a, const QString &host)
+{
+#ifdef BS_DEBUG
+	fprintf(stderr, "BSocket: Trying %s:%d\n", host.latin1(), a->port);
+#endif
+	a->sock = new QSocket;
+	connect(a->sock, SIGNAL(connected()), SLOT(att_connected()));
+	connect(a->sock, SIGNAL(error(int)), SLOT(att_error(int)));
+	a->sock->connectToHost(host, a->port);
+}
+
+void BSocket::attemptFailed(Attempt *a)
+{
+	d->attempts.removeRef(a);
+	if(a->sock) {
+		a->sock->disconnect(this);
+		d->sd.deleteLater(a->sock);
+	}
+#ifndef NO_NDNS
+	a->ndns->disconnect(this);
+	d->sd.deleteLater(a->ndns);
+#endif
+	delete a;
+
+	// don't wait for the stagger, go straight to the next
+	if(!d->candidates.isEmpty()) {
+		d->stagger.stop();
+		startAttempt();
+		return;
+	}
+
+	if(d->attempts.isEmpty()) {
+#ifdef BS_DEBUG
+		fprintf(stderr, "BSocket: No SRV target could be reached.\n");
+#endif
+		bool resolved = d->resolved;
+		reset();
+		if(resolved)
+			error(ErrConnectionRefused);
+		else
+			error(ErrHostNotFound);
+	}
+}
+
+void BSocket::clearAttempts()
+{
+	d->stagger.stop();
+	d->candidates.clear();
+	while(!d->attempts.isEmpty()) {
+		Attempt *a = d->attempts.getFirst();
+		d->attempts.removeFirst();
+		if(a->sock) {
+			a->sock->disconnect(this);
+			d->sd.deleteLater(a->sock);
+		}
+#ifndef NO_NDNS
+		a->ndns->disconnect(this);
+		a->ndns->stop();
+		d->sd.deleteLater(a->ndns);
+#endif
+		delete a;
+	}
+}
+
+void BSocket::att_ndns_done()
+{
+#ifndef NO_NDNS
+	SafeDeleteLock s(&d->sd);
+
+	Attempt *a = 0;
+	QPtrListIterator<Attempt> it(d->attempts);
+	for(Attempt *i; (i = it.current()); ++it) {
+		if(i->ndns == sender()) {
+			a = i;
+			break;
+		}
+	}
+	if(!a)
+		return;
+
+	if(a->ndns->result()) {
+		d->resolved = true;
+		attemptConnect(a, a->ndns->resultString());
+	}
+	else
+		attemptFailed(a);
+#endif
+}
+
+void BSocket::att_connected()
+{
+	SafeDeleteLock s(&d->sd);
+
+	Attempt *a = 0;
+	QPtrListIterator<Attempt> it(d->attempts);
+	for(Attempt *i; (i = it.current()); ++it) {
+		if(i->sock == sender()) {
+			a = i;
+			break;
+		}
+	}
+	if(!a)
+		return;
+
+	// keep the winner, drop everyone else
+	QSocket *sock = a->sock;
+	sock->disconnect(this);
+	a->sock = 0;
+	clearAttempts();
+
+	d->qsock = sock;
+	setupSocket();
+	d->host = sock->peerAddress().toString();
+	d->port = sock->peerPort();
+	qs_connected();
+}
+
+void BSocket::att_error(int)
+{
+	SafeDeleteLock s(&d->sd);
+
+	QPtrListIterator<Attempt> it(d->attempts);
+	for(Attempt *i; (i = it.current()); ++it) {
+		if(i->sock == sender()) {
+			attemptFailed(i);
+			return;
+		}
+	}
+}
+
+void BSocket::t_stagger()
+{
+	SafeDeleteLock s(&d->sd);
+
+	if(!d->candidates.isEmpty())
+		startAttempt();
 }
 
 void BSocket::ndns_done()
@@ -355,6 +643,7 @@ void BSocket::qs_delayedCloseFinished()
 void BSocket::qs_readyRead()
 {
 	SafeDeleteLock s(&d->sd);
+	checkReadLimit();
 	readyRead();
 }
 
@@ -364,6 +653,7 @@ void BSocket::qs_bytesWritten(int x)
 	fprintf(stderr, "BSocket: BytesWritten [%d].\n", x);
 #endif
 	SafeDeleteLock s(&d->sd);
+	checkWriteLimit();
 	bytesWritten(x);
 }
 
@@ -374,12 +664,6 @@ void BSocket::qs_error(int x)
 #endif
 	SafeDeleteLock s(&d->sd);
 
-	// connection error during SRV host connect?  try next
-	if(d->state == HostLookup && (x == QSocket::ErrConnectionRefused || x == QSocket::ErrHostNotFound)) {
-		d->srv.next();
-		return;
-	}
-
 	reset();
 	if(x == QSocket::ErrConnectionRefused)
 		error(ErrConnectionRefused);
@@ -49,6 +49,10 @@ public:
 	QByteArray read(int bytes=0);
 	int bytesAvailable() const;
 	int bytesToWrite() const;
+	void writev(const QValueList<QByteArray> &);
+	int peek(ByteSpanList *spans, int bytes=0);
+	bool isDetachable() const;
+	int detachSocket();
 
 	// local
 	QHostAddress address() const;
@@ -62,6 +66,9 @@ signals:
 	void hostFound();
 	void connected();
 
+protected:
+	void setReadEnabled(bool);
+
 private slots:
 	void qs_hostFound();
 	void qs_connected();
@@ -73,13 +80,24 @@ private slots:
 	void srv_done();
 	void ndns_done();
 	void do_connect();
+	void att_ndns_done();
+	void att_connected();
+	void att_error(int);
+	void t_stagger();
 
 private:
 	class Private;
 	Private *d;
+	class Attempt;
 
 	void reset(bool clear=false);
 	void ensureSocket();
+	void setupSocket();
+	void pullSocket();
+	void startAttempt();
+	void attemptConnect(Attempt *, const QString &host);
+	void attemptFailed(Attempt *);
+	void clearAttempts();
 };
 
 // CS_NAMESPACE_END
@@ -0,0 +1,629 @@
+/*
+ * dnsclient.cpp - asynchronous DNS queries over UDP
+ * Copyright (C) 2003  Justin Karneges
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+//! \class DnsClient dnsclient.h
+//! \brief Asynchronous DNS lookups without threads
+//!
+//! DnsClient sends its own queries to the nameservers listed in
+//! /etc/resolv.conf and waits for the answers in the event loop, so any
+//! number of lookups can be in flight at once.  Each query goes out from its
+//! own socket, on a port chosen by the system, with a query ID read from
+//! /dev/urandom, which makes forged answers hard to match.  Lost queries are
+//! retransmitted, rotating through the nameservers, before giving up.
+//!
+//! Only A, AAAA and SRV records are understood.  The hosts file and the
+//! resolver search list are not consulted, so callers that need them (such
+//! as NDns) should fall back to the system resolver when a lookup fails.
+//!
+//! \code
+//! #include "dnsclient.h"
+//!
+//! ...
+//!
+//! DnsClient dns;
+//! dns.resolve("_xmpp-client._tcp.jabber.org", DnsClient::Srv);
+//!
+//! // The class will emit the resultsReady() signal when the lookup
+//! // is finished. You may then retrieve the results:
+//!
+//! if(dns.success())
+//!         QValueList<QDns::Server> list = dns.servers();
+//! \endcode
+
+#include"dnsclient.h"
+
+#include<qapplication.h>
+#include<qsocketdevice.h>
+#include<qtimer.h>
+#include<qdatetime.h>
+#include<qintdict.h>
+#include<qptrdict.h>
+#include<qfile.h>
+#include<qstringlist.h>
+#include"qrandom.h"
+#include"reactor.h"
+#include"safedelete.h"
+
+#ifdef Q_OS_UNIX
+#include<stdio.h>
+#endif
+
+#define DNS_TICK        250   // msecs between retransmit checks
+#define DNS_RETRY_TIME  1000  // first retransmit, doubling after that
+#define DNS_RETRY_MAX   4000
+#define DNS_TRIES       4
+#define DNS_MAX_PACKET  1500
+
+// CS_NAMESPACE_BEGIN
+
+static DnsClientManager *man = 0;
+static QValueList<QHostAddress> *nameServers = 0;
+static Q_UINT16 nameServerPort = 53;
+
+static void loadNameServers()
+{
+	if(nameServers)
+		return;
+	nameServers = new QValueList<QHostAddress>;
+
+#ifdef Q_OS_UNIX
+	QFile f("/etc/resolv.conf");
+	if(!f.open(IO_ReadOnly))
+		return;
+	QString line;
+	while(f.readLine(line, 1024) != -1) {
+		QStringList parts = QStringList::split(' ', line.simplifyWhiteSpace());
+		if(parts.count() >= 2 && parts[0] == "nameserver") {
+			// the socket is IPv4 only
+			QHostAddress a;
+			if(a.setAddress(parts[1]) && a.isIp4Addr())
+				nameServers->append(a);
+		}
+	}
+#endif
+}
+
+static QByteArray makeQuery(Q_UINT16 id, const QString &name, int type)
+{
+	QCString cs = name.utf8();
+	int len = cs.length();
+	if(len > 0 && cs[len - 1] == '.')
+		--len;
+	if(len == 0 || len > 253)
+		return QByteArray();
+
+	QByteArray buf(12 + len + 2 + 4);
+	unsigned char *p = (unsigned char *)buf.data();
+	p[0] = id >> 8;
+	p[1] = id & 0xff;
+	p[2] = 0x01; // recursion desired
+	p[3] = 0x00;
+	p[4] = 0x00; // one question
+	p[5] = 0x01;
+	memset(p + 6, 0, 6);
+
+	int at = 12;
+	int start = 0;
+	for(int n = 0; n <= len; ++n) {
+		if(n == len || cs[n] == '.') {
+			int l = n - start;
+			if(l == 0 || l > 63)
+				return QByteArray();
+			p[at++] = l;
+			memcpy(p + at, cs.data() + start, l);
+			at += l;
+			start = n + 1;
+		}
+	}
+	p[at++] = 0;
+	p[at++] = type >> 8;
+	p[at++] = type & 0xff;
+	p[at++] = 0x00; // class IN
+	p[at++] = 0x01;
+	return buf;
+}
+
+static bool readName(const QByteArray &buf, int *at, QString *name)
+{
+	const unsigned char *p = (const unsigned char *)buf.data();
+	int size = buf.size();
+	int pos = *at;
+	int end = -1; // where the record continues, if we followed a pointer
+	int jumps = 0;
+	QString out;
+
+	while(1) {
+		if(pos >= size)
+			return false;
+		int l = p[pos];
+		if(l == 0) {
+			++pos;
+			break;
+		}
+		if((l & 0xc0) == 0xc0) {
+			// compressed
+			if(pos + 1 >= size || ++jumps > 16)
+				return false;
+			if(end == -1)
+				end = pos + 2;
+			pos = ((l & 0x3f) << 8) | p[pos + 1];
+			continue;
+		}
+		if(l & 0xc0 || pos + 1 + l > size)
+			return false;
+		if(!out.isEmpty())
+			out += '.';
+		for(int n = 0; n < l; ++n)
+			out += QChar((char)p[pos + 1 + n]);
+		pos += 1 + l;
+	}
+
+	*at = (end == -1) ? pos : end;
+	if(name)
+		*name = out;
+	return true;
+}
+
+static inline int get16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+// a query id nobody off the path can guess
+static Q_UINT16 randomId()
+{
+#ifdef Q_OS_UNIX
+	static FILE *f = 0;
+	if(!f)
+		f = fopen("/dev/urandom", "r");
+	unsigned char b[2];
+	if(f && fread(b, 1, 2, f) == 2)
+		return (b[0] << 8) | b[1];
+#endif
+	return QRandom::randomInt() & 0xffff;
+}
+
+// the socket a query is sent from, which goes away with the query
+class DnsSocket : public QObject
+{
+public:
+	QSocketDevice *dev;
+	SocketWatcher *sn;
+
+	DnsSocket()
+	{
+		sn = 0;
+		dev = new QSocketDevice(QSocketDevice::Datagram);
+		dev->setBlocking(false);
+	}
+
+	~DnsSocket()
+	{
+		delete sn;
+		delete dev;
+	}
+};
+
+//----------------------------------------------------------------------------
+// DnsClientManager
+//----------------------------------------------------------------------------
+class DnsClientManager::Item
+{
+public:
+	DnsClient *client;
+	QString name;
+	int type;
+	Q_UINT16 id;
+	DnsSocket *sock;
+	QByteArray packet;
+	int tries;
+	int deadline;
+	int error; // fail on the next tick, -1 if none
+};
+
+class DnsClientManager::Private
+{
+public:
+	Private() : items(257), clients(257), socks(257) {}
+
+	QTimer t;
+	QTime clock;
+	QIntDict<Item> items;   // query id -> item
+	QPtrDict<Item> clients; // DnsClient -> item
+	QIntDict<Item> socks;   // socket -> item
+};
+
+DnsClientManager::DnsClientManager()
+{
+	loadNameServers();
+
+	d = new Private;
+	d->items.setAutoDelete(true);
+	connect(&d->t, SIGNAL(timeout()), SLOT(t_timeout()));
+
+	connect(qApp, SIGNAL(aboutToQuit()), SLOT(app_aboutToQuit()));
+}
+
+DnsClientManager::~DnsClientManager()
+{
+	QIntDictIterator<Item> it(d->items);
+	for(Item *i; (i = it.current()); ++it)
+		delete i->sock;
+	delete d;
+}
+
+void DnsClientManager::resolve(DnsClient *self, const QString &name, int type)
+{
+	if(!d->t.isActive()) {
+		d->clock.start();
+		d->t.start(DNS_TICK);
+	}
+
+	Item *i = new Item;
+	i->client = self;
+	i->name = name;
+	i->type = type;
+	do {
+		i->id = randomId();
+	} while(d->items.find(i->id));
+	i->sock = 0;
+	i->tries = 0;
+	i->error = -1;
+	d->items.insert(i->id, i);
+	d->clients.insert(self, i);
+
+	i->packet = makeQuery(i->id, name, type);
+	if(i->packet.isEmpty() || nameServers->isEmpty()) {
+		// report it from the event loop, like any other result
+		i->error = i->packet.isEmpty() ? DnsClient::ErrNoName : DnsClient::ErrServer;
+		i->deadline = 0;
+		return;
+	}
+
+	// a fresh socket per query, so the source port changes every time
+	DnsSocket *sock = new DnsSocket;
+	if(!sock->dev->isValid() || !sock->dev->bind(QHostAddress(), 0)) {
+		delete sock;
+		i->error = DnsClient::ErrServer;
+		i->deadline = 0;
+		return;
+	}
+	sock->sn = new SocketWatcher(sock->dev->socket(), SocketWatcher::Read);
+	connect(sock->sn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
+	i->sock = sock;
+	d->socks.insert(sock->dev->socket(), i);
+
+	send(i);
+}
+
+void DnsClientManager::stop(DnsClient *self)
+{
+	Item *i = d->clients.take(self);
+	if(!i)
+		return;
+	releaseSocket(i);
+	d->items.remove(i->id);
+}
+
+void DnsClientManager::releaseSocket(Item *i)
+{
+	if(!i->sock)
+		return;
+	// we may be inside its watcher's signal
+	d->socks.remove(i->sock->dev->socket());
+	i->sock->sn->setEnabled(false);
+	SafeDelete::deleteSingle(i->sock);
+	i->sock = 0;
+}
+
+bool DnsClientManager::isBusy(const DnsClient *self) const
+{
+	return (d->clients.find((void *)self) ? true: false);
+}
+
+void DnsClientManager::send(Item *i)
+{
+	QHostAddress server = (*nameServers)[i->tries % nameServers->count()];
+	i->sock->dev->writeBlock(i->packet.data(), i->packet.size(), server, nameServerPort);
+
+	int wait = DNS_RETRY_TIME << i->tries;
+	if(wait > DNS_RETRY_MAX)
+		wait = DNS_RETRY_MAX;
+	++i->tries;
+	i->deadline = d->clock.elapsed() + wait;
+}
+
+void DnsClientManager::processPacket(Item *i, const QByteArray &buf, const QHostAddress &from, Q_UINT16 port)
+{
+	const unsigned char *p = (const unsigned char *)buf.data();
+	int size = buf.size();
+	if(size < 12)
+		return;
+
+	// someone we asked, answering something we asked?
+	if(port != nameServerPort || !nameServers->contains(from))
+		return;
+	if(get16(p) != i->id || i->error != -1 || !(p[2] & 0x80))
+		return;
+	if(get16(p + 4) != 1)
+		return;
+	int at = 12;
+	QString qname;
+	if(!readName(buf, &at, &qname) || at + 4 > size)
+		return;
+	if(get16(p + at) != i->type || qname.lower() != i->name.lower())
+		return;
+	at += 4;
+
+	int rcode = p[3] & 0x0f;
+	if(rcode == 3) {
+		finish(i, DnsClient::ErrNoName);
+		return;
+	}
+	// server trouble or a truncated answer: ask the next server, if any
+	if(rcode != 0 || (p[2] & 0x02)) {
+		if(i->tries < DNS_TRIES && nameServers->count() > 1)
+			send(i);
+		else
+			finish(i, DnsClient::ErrServer);
+		return;
+	}
+
+	QValueList<QHostAddress> addrs;
+	QValueList<QDns::Server> servers;
+	int count = get16(p + 6);
+	for(int n = 0; n < count; ++n) {
+		if(!readName(buf, &at, 0) || at + 10 > size)
+			break;
+		int type = get16(p + at);
+		int rdlen = get16(p + at + 8);
+		at += 10;
+		if(at + rdlen > size)
+			break;
+
+		// CNAMEs are skipped, the server follows them for us
+		if(type != i->type) {
+			at += rdlen;
+			continue;
+		}
+		if(type == DnsClient::A && rdlen == 4) {
+			Q_UINT32 ip = ((Q_UINT32)p[at] << 24) | ((Q_UINT32)p[at + 1] << 16) | ((Q_UINT32)p[at + 2] << 8) | p[at + 3];
+			addrs += QHostAddress(ip);
+		}
+		else if(type == DnsClient::Aaaa && rdlen == 16) {
+			Q_UINT8 ip6[16];
+			memcpy(ip6, p + at, 16);
+			addrs += QHostAddress(ip6);
+		}
+		else if(type == DnsClient::Srv && rdlen > 6) {
+			QDns::Server s;
+			s.priority = get16(p + at);
+			s.weight = get16(p + at + 2);
+			s.port = get16(p + at + 4);
+			int nat = at + 6;
+			if(readName(buf, &nat, &s.name))
+				servers += s;
+		}
+		at += rdlen;
+	}
+
+	if(addrs.isEmpty() && servers.isEmpty())
+		finish(i, DnsClient::ErrNoName);
+	else
+		finish(i, DnsClient::ErrNone, addrs, servers);
+}
+
+void DnsClientManager::finish(Item *i, int err, const QValueList<QHostAddress> &addrs, const QValueList<QDns::Server> &servers)
+{
+	DnsClient *c = i->client;
+	d->clients.remove(c);
+	releaseSocket(i);
+	d->items.remove(i->id);
+	c->finished(err, addrs, servers);
+}
+
+void DnsClientManager::sn_activated(int s)
+{
+	// stop once the query is done with, its socket goes with it
+	Item *i;
+	while((i = d->socks.find(s))) {
+		QSocketDevice *dev = i->sock->dev;
+		QByteArray buf(DNS_MAX_PACKET);
+		Q_LONG r = dev->readBlock(buf.data(), buf.size());
+		if(r <= 0)
+			break;
+		buf.resize(r);
+		processPacket(i, buf, dev->peerAddress(), dev->peerPort());
+	}
+}
+
+void DnsClientManager::t_timeout()
+{
+	// collect first, since the callbacks may add and remove items
+	int now = d->clock.elapsed();
+	QValueList<int> due;
+	QIntDictIterator<Item> it(d->items);
+	for(Item *i; (i = it.current()); ++it) {
+		if(i->deadline <= now)
+			due += i->id;
+	}
+
+	for(QValueList<int>::ConstIterator dit = due.begin(); dit != due.end(); ++dit) {
+		Item *i = d->items.find(*dit);
+		if(!i)
+			continue;
+		if(i->error != -1)
+			finish(i, i->error);
+		else if(i->tries < DNS_TRIES)
+			send(i);
+		else
+			finish(i, DnsClient::ErrTimeout);
+	}
+
+	if(d->items.isEmpty())
+		d->t.stop();
+}
+
+void DnsClientManager::app_aboutToQuit()
+{
+	// fail whatever is left, so nobody waits on us forever
+	QValueList<int> ids;
+	QIntDictIterator<Item> it(d->items);
+	for(Item *i; (i = it.current()); ++it)
+		ids += i->id;
+	for(QValueList<int>::ConstIterator iit = ids.begin(); iit != ids.end(); ++iit) {
+		Item *i = d->items.find(*iit);
+		if(i)
+			finish(i, DnsClient::ErrServer);
+	}
+
+	man = 0;
+	delete this;
+}
+
+
+//----------------------------------------------------------------------------
+// DnsClient
+//----------------------------------------------------------------------------
+class DnsClient::Private
+{
+public:
+	Private() {}
+
+	int type;
+	int err;
+	QValueList<QHostAddress> addrs;
+	QValueList<QDns::Server> servers;
+};
+
+//! \fn void DnsClient::resultsReady()
+//! This signal is emitted when the lookup succeeds or fails.
+
+//!
+//! Constructs a DnsClient object with parent \a parent.
+DnsClient::DnsClient(QObject *parent)
+:QObject(parent)
+{
+	d = new Private;
+	d->type = A;
+	d->err = ErrNone;
+}
+
+//!
+//! Destroys the object and frees allocated resources.
+DnsClient::~DnsClient()
+{
+	stop();
+	delete d;
+}
+
+//!
+//! Looks up records of type \a type (A, Aaaa or Srv) for \a name.
+void DnsClient::resolve(const QString &name, int type)
+{
+	stop();
+	d->type = type;
+	d->err = ErrNone;
+	d->addrs.clear();
+	d->servers.clear();
+	if(!man)
+		man = new DnsClientManager;
+	man->resolve(this, name, type);
+}
+
+//!
+//! Cancels the lookup.  Any answer that arrives later is ignored.
+void DnsClient::stop()
+{
+	if(man)
+		man->stop(this);
+}
+
+//!
+//! Returns TRUE if a lookup is in progress.
+bool DnsClient::isBusy() const
+{
+	if(!man)
+		return false;
+	return man->isBusy(this);
+}
+
+//!
+//! Returns the record type of the last lookup.
+int DnsClient::type() const
+{
+	return d->type;
+}
+
+//!
+//! Returns TRUE if the last lookup found at least one record.
+bool DnsClient::success() const
+{
+	return (d->err == ErrNone);
+}
+
+//!
+//! Returns the reason the last lookup failed.
+int DnsClient::errorCode() const
+{
+	return d->err;
+}
+
+//!
+//! Returns the addresses found by an A or AAAA lookup.
+QValueList<QHostAddress> DnsClient::addresses() const
+{
+	return d->addrs;
+}
+
+//!
+//! Returns the servers found by an SRV lookup, unsorted.
+QValueList<QDns::Server> DnsClient::servers() const
+{
+	return d->servers;
+}
+
+//!
+//! Returns TRUE if there are nameservers to send queries to.
+bool DnsClient::isAvailable()
+{
+	loadNameServers();
+	return !nameServers->isEmpty();
+}
+
+//!
+//! Sends all queries to the nameservers in \a list at \a port, instead of the ones in /etc/resolv.conf.
+void DnsClient::setNameServers(const QValueList<QHostAddress> &list, Q_UINT16 port)
+{
+	if(!nameServers)
+		nameServers = new QValueList<QHostAddress>;
+	*nameServers = list;
+	nameServerPort = port;
+}
+
+void DnsClient::finished(int err, const QValueList<QHostAddress> &addrs, const QValueList<QDns::Server> &servers)
+{
+	d->err = err;
+	d->addrs = addrs;
+	d->servers = servers;
+	resultsReady();
+}
+
+// CS_NAMESPACE_END
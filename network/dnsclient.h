@@ -0,0 +1,96 @@
+/*
+ * dnsclient.h - asynchronous DNS queries over UDP
+ * Copyright (C) 2003  Justin Karneges
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CS_DNSCLIENT_H
+#define CS_DNSCLIENT_H
+
+#include<qobject.h>
+#include<qcstring.h>
+#include<qvaluelist.h>
+#include<qhostaddress.h>
+#include<qdns.h>
+
+// CS_NAMESPACE_BEGIN
+
+class DnsClientManager;
+
+class DnsClient : public QObject
+{
+	Q_OBJECT
+public:
+	enum Type { A = 1, Aaaa = 28, Srv = 33 };
+	enum Error { ErrNone, ErrNoName, ErrServer, ErrTimeout };
+	DnsClient(QObject *parent=0);
+	~DnsClient();
+
+	void resolve(const QString &name, int type=A);
+	void stop();
+	bool isBusy() const;
+
+	int type() const;
+	bool success() const;
+	int errorCode() const;
+	QValueList<QHostAddress> addresses() const;
+	QValueList<QDns::Server> servers() const;
+
+	static bool isAvailable();
+	static void setNameServers(const QValueList<QHostAddress> &list, Q_UINT16 port=53);
+
+signals:
+	void resultsReady();
+
+private:
+	class Private;
+	Private *d;
+
+	friend class DnsClientManager;
+	void finished(int err, const QValueList<QHostAddress> &addrs, const QValueList<QDns::Server> &servers);
+};
+
+class DnsClientManager : public QObject
+{
+	Q_OBJECT
+public:
+	~DnsClientManager();
+	class Item;
+
+private slots:
+	void sn_activated(int);
+	void t_timeout();
+	void app_aboutToQuit();
+
+private:
+	class Private;
+	Private *d;
+
+	friend class DnsClient;
+	DnsClientManager();
+	void resolve(DnsClient *self, const QString &name, int type);
+	void stop(DnsClient *self);
+	bool isBusy(const DnsClient *self) const;
+	void send(Item *);
+	void releaseSocket(Item *);
+	void processPacket(Item *, const QByteArray &buf, const QHostAddress &from, Q_UINT16 port);
+	void finish(Item *, int err, const QValueList<QHostAddress> &addrs=QValueList<QHostAddress>(), const QValueList<QDns::Server> &servers=QValueList<QDns::Server>());
+};
+
+// CS_NAMESPACE_END
+
+#endif
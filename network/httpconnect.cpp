@@ -21,8 +21,10 @@
 #include"httpconnect.h"
 
 #include<qstringlist.h>
+#include<qtimer.h>
 #include"bsocket.h"
 #include"base64.h"
+#include"httpparser.h"
 
 #ifdef PROX_DEBUG
 #include<stdio.h>
@@ -30,51 +32,6 @@
 
 // CS_NAMESPACE_BEGIN
 
-static QString extractLine(QByteArray *buf, bool *found)
-{
-	// scan for newline
-	int n;
-	for(n = 0; n < (int)buf->size()-1; ++n) {
-		if(buf->at(n) == '\r' && buf->at(n+1) == '\n') {
-			QCString cstr;
-			cstr.resize(n+1);
-			memcpy(cstr.data(), buf->data(), n);
-			n += 2; // hack off CR/LF
-
-			memmove(buf->data(), buf->data() + n, buf->size() - n);
-			buf->resize(buf->size() - n);
-			QString s = QString::fromUtf8(cstr);
-
-			if(found)
-				*found = true;
-			return s;
-		}
-	}
-
-	if(found)
-		*found = false;
-	return "";
-}
-
-static bool extractMainHeader(const QString &line, QString *proto, int *code, QString *msg)
-{
-	int n = line.find(' ');
-	if(n == -1)
-		return false;
-	if(proto)
-		*proto = line.mid(0, n);
-	++n;
-	int n2 = line.find(' ', n);
-	if(n2 == -1)
-		return false;
-	if(code)
-		*code = line.mid(n, n2-n).toInt();
-	n = n2+1;
-	if(msg)
-		*msg = line.mid(n);
-	return true;
-}
-
 class HttpConnect::Private
 {
 public:
@@ -88,9 +45,7 @@ public:
 	int real_port;
 
 	QByteArray recvBuf;
-
-	bool inHeader;
-	QStringList headerLines;
+	HttpResponseParser parser;
 
 	int toWrite;
 	bool active;
@@ -166,8 +121,19 @@ void HttpConnect::close()
 
 void HttpConnect::write(const QByteArray &buf)
 {
-	if(d->active)
+	if(d->active) {
 		d->sock.write(buf);
+		recordWrite(buf.size());
+	}
+}
+
+void HttpConnect::writev(const QValueList<QByteArray> &list)
+{
+	if(d->active) {
+		d->sock.writev(list);
+		for(QValueList<QByteArray>::ConstIterator it = list.begin(); it != list.end(); ++it)
+			recordWrite((*it).size());
+	}
 }
 
 QByteArray HttpConnect::read(int bytes)
@@ -180,6 +146,23 @@ int HttpConnect::bytesAvailable() const
 	return ByteStream::bytesAvailable();
 }
 
+bool HttpConnect::isDetachable() const
+{
+	if(!d->active || ByteStream::bytesAvailable() > 0)
+		return false;
+	return d->sock.isDetachable();
+}
+
+int HttpConnect::detachSocket()
+{
+	if(!isDetachable())
+		return -1;
+	int fd = d->sock.detachSocket();
+	if(fd != -1)
+		reset(true);
+	return fd;
+}
+
 int HttpConnect::bytesToWrite() const
 {
 	if(d->active)
@@ -193,8 +176,7 @@ void HttpConnect::sock_connected()
 #ifdef PROX_DEBUG
 	fprintf(stderr, "HttpConnect: Connected\n");
 #endif
-	d->inHeader = true;
-	d->headerLines.clear();
+	d->parser.reset();
 
 	// connected, now send the request
 	QString s;
@@ -232,103 +214,96 @@ void HttpConnect::sock_delayedCloseFinished()
 	}
 }
 
+void HttpConnect::setReadEnabled(bool b)
+{
+	// while we stop taking from the socket, it fills up to the same limit
+	//   and then stops reading too
+	d->sock.setReadLimit(readLimit());
+	if(b && d->active && d->sock.bytesAvailable() > 0)
+		QTimer::singleShot(0, this, SLOT(sock_readyRead()));
+}
+
 void HttpConnect::sock_readyRead()
 {
+	if(d->active && isReadPaused())
+		return;
+
 	QByteArray block = d->sock.read();
 
 	if(!d->active) {
 		ByteStream::appendArray(&d->recvBuf, block);
 
-		if(d->inHeader) {
-			// grab available lines
-			while(1) {
-				bool found;
-				QString line = extractLine(&d->recvBuf, &found);
-				if(!found)
-					break;
-				if(line.isEmpty()) {
-					d->inHeader = false;
-					break;
-				}
-				d->headerLines += line;
-			}
-
-			// done with grabbing the header?
-			if(!d->inHeader) {
-				QString str = d->headerLines.first();
-				d->headerLines.remove(d->headerLines.begin());
-
-				QString proto;
-				int code;
-				QString msg;
-				if(!extractMainHeader(str, &proto, &code, &msg)) {
+		// done with grabbing the header?
+		int r = d->parser.parse(d->recvBuf.data(), d->recvBuf.size());
+		if(r == 0)
+			return;
+		if(r == -1) {
 #ifdef PROX_DEBUG
-					fprintf(stderr, "HttpConnect: invalid header!\n");
+			fprintf(stderr, "HttpConnect: invalid header!\n");
 #endif
-					reset(true);
-					error(ErrProxyNeg);
-					return;
-				}
-				else {
+			reset(true);
+			error(ErrProxyNeg);
+			return;
+		}
+		ByteStream::takeArray(&d->recvBuf, r, true);
+
+		int code = d->parser.code();
 #ifdef PROX_DEBUG
-					fprintf(stderr, "HttpConnect: header proto=[%s] code=[%d] msg=[%s]\n", proto.latin1(), code, msg.latin1());
-					for(QStringList::ConstIterator it = d->headerLines.begin(); it != d->headerLines.end(); ++it)
-						fprintf(stderr, "HttpConnect: * [%s]\n", (*it).latin1());
+		fprintf(stderr, "HttpConnect: header proto=[HTTP/%d.%d] code=[%d] msg=[%s]\n", d->parser.majorVersion(), d->parser.minorVersion(), code, d->parser.message().latin1());
+		QStringList lines = d->parser.headerLines();
+		for(QStringList::ConstIterator it = lines.begin(); it != lines.end(); ++it)
+			fprintf(stderr, "HttpConnect: * [%s]\n", (*it).latin1());
 #endif
-				}
 
-				if(code == 200) { // OK
+		if(code == 200) { // OK
 #ifdef PROX_DEBUG
-					fprintf(stderr, "HttpConnect: << Success >>\n");
+			fprintf(stderr, "HttpConnect: << Success >>\n");
 #endif
-					d->active = true;
-					connected();
-
-					if(!d->recvBuf.isEmpty()) {
-						appendRead(d->recvBuf);
-						d->recvBuf.resize(0);
-						readyRead();
-						return;
-					}
-				}
-				else {
-					int err;
-					QString errStr;
-					if(code == 407) { // Authentication failed
-						err = ErrProxyAuth;
-						errStr = tr("Authentication failed");
-					}
-					else if(code == 404) { // Host not found
-						err = ErrHostNotFound;
-						errStr = tr("Host not found");
-					}
-					else if(code == 403) { // Access denied
-						err = ErrProxyNeg;
-						errStr = tr("Access denied");
-					}
-					else if(code == 503) { // Connection refused
-						err = ErrConnectionRefused;
-						errStr = tr("Connection refused");
-					}
-					else { // invalid reply
-						err = ErrProxyNeg;
-						errStr = tr("Invalid reply");
-					}
+			d->active = true;
+			connected();
+
+			if(!d->recvBuf.isEmpty()) {
+				appendRead(d->recvBuf);
+				d->recvBuf.resize(0);
+				readyRead();
+				return;
+			}
+		}
+		else {
+			int err;
+			QString errStr;
+			if(code == 407) { // Authentication failed
+				err = ErrProxyAuth;
+				errStr = tr("Authentication failed");
+			}
+			else if(code == 404) { // Host not found
+				err = ErrHostNotFound;
+				errStr = tr("Host not found");
+			}
+			else if(code == 403) { // Access denied
+				err = ErrProxyNeg;
+				errStr = tr("Access denied");
+			}
+			else if(code == 503) { // Connection refused
+				err = ErrConnectionRefused;
+				errStr = tr("Connection refused");
+			}
+			else { // invalid reply
+				err = ErrProxyNeg;
+				errStr = tr("Invalid reply");
+			}
 
 #ifdef PROX_DEBUG
-					fprintf(stderr, "HttpConnect: << Error >> [%s]\n", errStr.latin1());
+			fprintf(stderr, "HttpConnect: << Error >> [%s]\n", errStr.latin1());
 #endif
-					reset(true);
-					error(err);
-					return;
-				}
-			}
+			reset(true);
+			error(err);
+			return;
 		}
 	}
-	else {
+	else if(!block.isEmpty()) {
 		appendRead(block);
 		readyRead();
-		return;
 	}
 }
 
@@ -342,8 +317,10 @@ void HttpConnect::sock_bytesWritten(int x)
 		x -= size;
 	}
 
-	if(d->active && x > 0)
+	if(d->active && x > 0) {
+		checkWriteLimit();
 		bytesWritten(x);
+	}
 }
 
 void HttpConnect::sock_error(int x)
@@ -43,10 +43,16 @@ public:
 	QByteArray read(int bytes=0);
 	int bytesAvailable() const;
 	int bytesToWrite() const;
+	void writev(const QValueList<QByteArray> &);
+	bool isDetachable() const;
+	int detachSocket();
 
 signals:
 	void connected();
 
+protected:
+	void setReadEnabled(bool);
+
 private slots:
 	void sock_connected();
 	void sock_connectionClosed();
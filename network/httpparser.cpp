@@ -0,0 +1,356 @@
+/*
+ * httpparser.cpp - incremental HTTP response header parser
+ * Copyright (C) 2003  Justin Karneges
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include"httpparser.h"
+
+#include<string.h>
+
+// a header bigger than this is taken as garbage
+#define MAX_HEADER 65536
+
+// CS_NAMESPACE_BEGIN
+
+static void trim(const char **p, int *len)
+{
+	while(*len > 0 && (**p == ' ' || **p == '\t')) {
+		++(*p);
+		--(*len);
+	}
+	while(*len > 0 && ((*p)[*len - 1] == ' ' || (*p)[*len - 1] == '\t'))
+		--(*len);
+}
+
+static bool is(const char *p, int len, const char *s)
+{
+	int n = strlen(s);
+	return (len == n && qstrnicmp(p, s, n) == 0);
+}
+
+// the first of close or keep-alive in a comma separated list
+static int connectionToken(const char *p, int len)
+{
+	while(len > 0) {
+		const char *comma = (const char *)memchr(p, ',', len);
+		int n = comma ? comma - p : len;
+		const char *t = p;
+		int tlen = n;
+		trim(&t, &tlen);
+		if(is(t, tlen, "close"))
+			return HttpResponseParser::ConnClose;
+		if(is(t, tlen, "keep-alive"))
+			return HttpResponseParser::ConnKeepAlive;
+		if(!comma)
+			break;
+		p += n + 1;
+		len -= n + 1;
+	}
+	return HttpResponseParser::ConnDefault;
+}
+
+//! \class HttpResponseParser httpparser.h
+//! \brief Parses the header of an HTTP response as it arrives
+//!
+//! HttpResponseParser reads the status line and header fields of a response
+//! straight out of the bytes received so far.  Call parse() with the whole
+//! buffer each time more has arrived; scanning picks up where the previous
+//! call stopped, so nothing is looked at twice.  Lines aren't copied or
+//! turned into strings along the way.  The fields that decide how the body
+//! is framed, and whether the connection can be kept, are picked out as
+//! they go by, and everything else can be looked up with header() once the
+//! header is complete.
+//!
+//! \code
+//! ByteStream::appendArray(&buf, block);
+//! int r = parser.parse(buf.data(), buf.size());
+//! if(r == 0)
+//! 	return; // need more
+//! if(r == -1)
+//! 	... // not HTTP
+//! ByteStream::takeArray(&buf, r); // the body starts after the header
+//! \endcode
+
+//!
+//! Constructs a parser, ready for a response.
+HttpResponseParser::HttpResponseParser()
+{
+	reset();
+}
+
+//!
+//! Forgets the previous response, to parse another.
+void HttpResponseParser::reset()
+{
+	state = StatusLine;
+	at = 0;
+	lineStart = 0;
+	major = 0;
+	minor = 0;
+	_code = 0;
+	msgStart = 0;
+	msgEnd = 0;
+	length = -1;
+	chunked = false;
+	conn = ConnDefault;
+	proxyConn = ConnDefault;
+	raw.resize(0);
+}
+
+//!
+//! Parses the \a size bytes of \a data, the response received so far.  The
+//! bytes given by an earlier call must not have changed.  Returns the length
+//! of the header once it is complete, 0 if more is needed, or -1 if this
+//! isn't an HTTP response.
+int HttpResponseParser::parse(const char *data, int size)
+{
+	if(state == Done)
+		return raw.size();
+
+	while(at < size) {
+		const char *nl = (const char *)memchr(data + at, '\n', size - at);
+		if(!nl) {
+			at = size;
+			break;
+		}
+
+		int end = nl - data;
+		int len = end - lineStart;
+		if(len > 0 && data[end - 1] == '\r')
+			--len;
+		const char *p = data + lineStart;
+		at = end + 1;
+
+		if(state == StatusLine) {
+			if(!parseStatus(p, len))
+				return -1;
+			state = Headers;
+		}
+		else if(len == 0) {
+			// keep the header for header(), in one piece
+			raw.resize(at);
+			memcpy(raw.data(), data, at);
+			state = Done;
+			return at;
+		}
+		else if(!parseHeader(p, len))
+			return -1;
+		lineStart = at;
+	}
+
+	if(at > MAX_HEADER)
+		return -1;
+	return 0;
+}
+
+//!
+//! Returns TRUE if the whole header has been parsed.
+bool HttpResponseParser::isDone() const
+{
+	return (state == Done);
+}
+
+bool HttpResponseParser::parseStatus(const char *p, int len)
+{
+	// HTTP/x.y code message
+	if(len < 12 || qstrnicmp(p, "HTTP/", 5) != 0)
+		return false;
+	if(p[5] < '0' || p[5] > '9' || p[6] != '.' || p[7] < '0' || p[7] > '9' || p[8] != ' ')
+		return false;
+	major = p[5] - '0';
+	minor = p[7] - '0';
+
+	int n = 9;
+	_code = 0;
+	for(int i = 0; i < 3; ++i, ++n) {
+		if(p[n] < '0' || p[n] > '9')
+			return false;
+		_code = _code * 10 + (p[n] - '0');
+	}
+	if(n < len && p[n] != ' ')
+		return false;
+
+	msgStart = (n < len) ? lineStart + n + 1 : lineStart + n;
+	msgEnd = lineStart + len;
+	return true;
+}
+
+bool HttpResponseParser::parseHeader(const char *p, int len)
+{
+	const char *colon = (const char *)memchr(p, ':', len);
+	if(!colon)
+		return true; // folded or broken, neither of which matters here
+
+	const char *name = p;
+	int nlen = colon - p;
+	trim(&name, &nlen);
+	const char *value = colon + 1;
+	int vlen = len - (value - p);
+	trim(&value, &vlen);
+
+	if(is(name, nlen, "Content-Length")) {
+		if(vlen == 0)
+			return false;
+		int x = 0;
+		for(int n = 0; n < vlen; ++n) {
+			if(value[n] < '0' || value[n] > '9' || x > (0x7fffffff - 9) / 10)
+				return false;
+			x = x * 10 + (value[n] - '0');
+		}
+		length = x;
+	}
+	else if(is(name, nlen, "Transfer-Encoding"))
+		chunked = !is(value, vlen, "identity");
+	else if(is(name, nlen, "Connection"))
+		conn = connectionToken(value, vlen);
+	else if(is(name, nlen, "Proxy-Connection"))
+		proxyConn = connectionToken(value, vlen);
+	return true;
+}
+
+//!
+//! Returns the major HTTP version of the response.
+int HttpResponseParser::majorVersion() const
+{
+	return major;
+}
+
+//!
+//! Returns the minor HTTP version of the response.
+int HttpResponseParser::minorVersion() const
+{
+	return minor;
+}
+
+//!
+//! Returns the status code of the response.
+int HttpResponseParser::code() const
+{
+	return _code;
+}
+
+//!
+//! Returns the reason phrase of the response.
+QString HttpResponseParser::message() const
+{
+	if(state != Done)
+		return QString::null;
+	return QString::fromLatin1(raw.data() + msgStart, msgEnd - msgStart);
+}
+
+//!
+//! Returns the value of the Content-Length field, or -1 if there is none.
+int HttpResponseParser::contentLength() const
+{
+	return length;
+}
+
+//!
+//! Returns TRUE if the body has a transfer coding (anything but identity),
+//! which for HTTP/1.1 means it is chunked.
+bool HttpResponseParser::isChunked() const
+{
+	return chunked;
+}
+
+//!
+//! Returns what the Connection field asks for: ConnClose, ConnKeepAlive, or
+//! ConnDefault if it asks for neither.
+int HttpResponseParser::connection() const
+{
+	return conn;
+}
+
+//!
+//! Returns what the Proxy-Connection field asks for, like connection().
+int HttpResponseParser::proxyConnection() const
+{
+	return proxyConn;
+}
+
+//!
+//! Returns the value of the first header field called \a name (in any
+//! case), or a null string if there is none.
+QString HttpResponseParser::header(const QString &name) const
+{
+	QCString n = name.latin1();
+	const char *p = raw.data();
+	int size = raw.size();
+	int pos = 0;
+	while(pos < size) {
+		int len = lineLength(p + pos, size - pos);
+		if(len == 0)
+			break;
+		const char *line = p + pos;
+		int llen = len;
+		while(llen > 0 && (line[llen - 1] == '\n' || line[llen - 1] == '\r'))
+			--llen;
+		pos += len;
+
+		const char *colon = (const char *)memchr(line, ':', llen);
+		if(!colon)
+			continue;
+		const char *key = line;
+		int klen = colon - line;
+		trim(&key, &klen);
+		if(!is(key, klen, n.data()))
+			continue;
+		const char *value = colon + 1;
+		int vlen = llen - (value - line);
+		trim(&value, &vlen);
+		return QString::fromLatin1(value, vlen);
+	}
+	return QString::null;
+}
+
+//!
+//! Returns the header fields as lines, mostly useful for debugging.
+QStringList HttpResponseParser::headerLines() const
+{
+	QStringList list;
+	const char *p = raw.data();
+	int size = raw.size();
+	int pos = 0;
+	bool first = true;
+	while(pos < size) {
+		int len = lineLength(p + pos, size - pos);
+		if(len == 0)
+			break;
+		int llen = len;
+		while(llen > 0 && (p[pos + llen - 1] == '\n' || p[pos + llen - 1] == '\r'))
+			--llen;
+		if(!first && llen > 0)
+			list += QString::fromLatin1(p + pos, llen);
+		first = false;
+		pos += len;
+	}
+	return list;
+}
+
+//!
+//! Returns the length of the line at the front of the \a size bytes of
+//! \a data, including its line break, or 0 if the line isn't complete.
+int HttpResponseParser::lineLength(const char *data, int size)
+{
+	const char *nl = (const char *)memchr(data, '\n', size);
+	if(!nl)
+		return 0;
+	return nl - data + 1;
+}
+
+// CS_NAMESPACE_END
@@ -0,0 +1,74 @@
+/*
+ * httpparser.h - incremental HTTP response header parser
+ * Copyright (C) 2003  Justin Karneges
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CS_HTTPPARSER_H
+#define CS_HTTPPARSER_H
+
+#include<qstringlist.h>
+#include<qcstring.h>
+
+// CS_NAMESPACE_BEGIN
+
+class HttpResponseParser
+{
+public:
+	enum Connection { ConnDefault, ConnClose, ConnKeepAlive };
+	HttpResponseParser();
+
+	void reset();
+	int parse(const char *data, int size);
+	bool isDone() const;
+
+	// status line
+	int majorVersion() const;
+	int minorVersion() const;
+	int code() const;
+	QString message() const;
+
+	// framing
+	int contentLength() const;
+	bool isChunked() const;
+	int connection() const;
+	int proxyConnection() const;
+
+	// everything else
+	QString header(const QString &name) const;
+	QStringList headerLines() const;
+
+	static int lineLength(const char *data, int size);
+
+private:
+	enum State { StatusLine, Headers, Done };
+	int state;
+	int at, lineStart;
+	int major, minor, _code;
+	int msgStart, msgEnd;
+	int length;
+	bool chunked;
+	int conn, proxyConn;
+	QByteArray raw;
+
+	bool parseStatus(const char *p, int len);
+	bool parseHeader(const char *p, int len);
+};
+
+// CS_NAMESPACE_END
+
+#endif
@@ -24,16 +24,22 @@
 #include<qurl.h>
 #include<qtimer.h>
 #include<qguardedptr.h>
+#include<qapplication.h>
+#include<qptrlist.h>
 #include<qca.h>
 #include<stdlib.h>
+#include<time.h>
 #include"bsocket.h"
 #include"base64.h"
+#include"safedelete.h"
+#include"httpparser.h"
 
 #ifdef PROX_DEBUG
 #include<stdio.h>
 #endif
 
 #define POLL_KEYS 64
+#define KEY_SIZE  20 // SHA1 digest
 
 // CS_NAMESPACE_BEGIN
 
@@ -46,40 +52,218 @@ static QByteArray randomArray(int size)
 }
 
 //----------------------------------------------------------------------------
-// HttpPoll
+// HttpPollPolicy
 //----------------------------------------------------------------------------
-static QString hpk(int n, const QString &s)
+//! \class HttpPollPolicy httppoll.h
+//! \brief Decides how long HttpPoll waits between polls
+//!
+//! A fixed policy always waits the same amount of time.  An adaptive policy
+//! polls again after the minimum interval whenever the last request carried
+//! data in either direction, and otherwise multiplies the interval by the
+//! backoff factor, up to the maximum.  Times are in milliseconds.
+
+//!
+//! Constructs a fixed policy that polls every \a seconds seconds.
+HttpPollPolicy::HttpPollPolicy(int seconds)
 {
-	if(n == 0)
-		return s;
-	else
-		return Base64::arrayToString( QCA::SHA1::hash( QCString(hpk(n - 1, s).latin1()) ) );
+	_adaptive = false;
+	_min = _max = seconds * 1000;
+	_factor = 1;
+}
+
+//!
+//! Returns an adaptive policy that polls between \a minMsecs and \a maxMsecs
+//! apart, multiplying the interval by \a factor for every idle poll.
+HttpPollPolicy HttpPollPolicy::adaptive(int minMsecs, int maxMsecs, int factor)
+{
+	HttpPollPolicy p;
+	p._adaptive = true;
+	p._min = QMAX(minMsecs, 1);
+	p._max = QMAX(maxMsecs, p._min);
+	p._factor = QMAX(factor, 2);
+	return p;
+}
+
+//!
+//! Returns TRUE if the interval adapts to traffic.
+bool HttpPollPolicy::isAdaptive() const
+{
+	return _adaptive;
+}
+
+//!
+//! Returns the shortest interval, in milliseconds.
+int HttpPollPolicy::minimum() const
+{
+	return _min;
 }
 
+//!
+//! Returns the longest interval, in milliseconds.
+int HttpPollPolicy::maximum() const
+{
+	return _max;
+}
+
+//!
+//! Returns the interval to wait after a poll, given the \a current interval
+//! and whether the poll was \a active (carried data).
+int HttpPollPolicy::next(int current, bool active) const
+{
+	if(!_adaptive)
+		return _max;
+	if(active || current <= 0)
+		return _min;
+	if(current >= _max / _factor)
+		return _max;
+	return current * _factor;
+}
+
+//----------------------------------------------------------------------------
+// HttpPollWheel
+//----------------------------------------------------------------------------
+#define WHEEL_TICK  250 // msecs
+#define WHEEL_SLOTS 512
+
+// One timer for all HttpPoll instances.  Each bucket of the wheel is one tick
+//   wide, and holds the polls due in that tick (or whole turns later, as
+//   counted by 'rounds').  Stopping only clears the entry, which is freed
+//   when its bucket comes around.
+class HttpPollWheel : public QObject
+{
+	Q_OBJECT
+public:
+	class Item
+	{
+	public:
+		HttpPoll *poll;
+		int rounds;
+	};
+
+	static HttpPollWheel *instance()
+	{
+		if(!self)
+			self = new HttpPollWheel;
+		return self;
+	}
+
+	Item *start(HttpPoll *poll, int msecs)
+	{
+		int ticks = (msecs + WHEEL_TICK - 1) / WHEEL_TICK;
+		if(ticks < 1)
+			ticks = 1;
+		Item *i = new Item;
+		i->poll = poll;
+		i->rounds = (ticks - 1) / WHEEL_SLOTS;
+		buckets[(cur + ticks) % WHEEL_SLOTS].append(i);
+		++count;
+		if(!t.isActive())
+			t.start(WHEEL_TICK);
+		return i;
+	}
+
+	void stop(Item *i)
+	{
+		i->poll = 0;
+	}
+
+private slots:
+	void t_timeout()
+	{
+		cur = (cur + 1) % WHEEL_SLOTS;
+
+		// detach the bucket first, firing may start new timers
+		QPtrList<Item> due = buckets[cur];
+		buckets[cur].clear();
+		QPtrListIterator<Item> it(due);
+		for(Item *i; (i = it.current()); ++it) {
+			if(i->poll && i->rounds > 0) {
+				--(i->rounds);
+				buckets[cur].append(i);
+				continue;
+			}
+			--count;
+			HttpPoll *poll = i->poll;
+			delete i;
+			if(poll)
+				poll->pollTimeout();
+		}
+
+		if(count == 0)
+			t.stop();
+	}
+
+private:
+	QTimer t;
+	QPtrList<Item> buckets[WHEEL_SLOTS];
+	int cur, count;
+	static HttpPollWheel *self;
+
+	HttpPollWheel()
+	:QObject(qApp)
+	{
+		cur = 0;
+		count = 0;
+		connect(&t, SIGNAL(timeout()), SLOT(t_timeout()));
+	}
+
+	~HttpPollWheel()
+	{
+		for(int n = 0; n < WHEEL_SLOTS; ++n) {
+			buckets[n].setAutoDelete(true);
+			buckets[n].clear();
+		}
+		self = 0;
+	}
+};
+
+HttpPollWheel *HttpPollWheel::self = 0;
+
+//----------------------------------------------------------------------------
+// HttpPoll
+//----------------------------------------------------------------------------
+
 class HttpPoll::Private
 {
 public:
 	Private() {}
 
-	HttpProxyPost http;
+	// one post in flight.  'size' is how much of the front of the write
+	//   buffer it carries, which stays there until the reply is in.
+	class Request
+	{
+	public:
+		HttpProxyPost *http;
+		int size;
+		bool done;
+	};
+
 	QString host;
 	int port;
 	QString user, pass;
 	QString url;
 	bool use_proxy;
 
-	QByteArray out;
+	// oldest first.  replies are taken in this order, whatever order they
+	//   arrive in.
+	QPtrList<Request> requests;
+	int sending; // write buffer bytes carried by the requests
+	int depth, maxPacket;
 
 	int state;
 	bool closing;
 	QString ident;
 
-	QTimer *t;
+	HttpPollWheel::Item *timer;
 
-	QString key[POLL_KEYS];
+	char key[POLL_KEYS][KEY_SIZE];
 	int key_n;
 
-	int polltime;
+	HttpPollPolicy policy;
+	int interval;
+
+	// whether any of the reply so far went out before it was complete
+	bool streamed;
 };
 
 HttpPoll::HttpPoll(QObject *parent)
@@ -87,12 +271,11 @@ HttpPoll::HttpPoll(QObject *parent)
 {
 	d = new Private;
 
-	d->polltime = 30;
-	d->t = new QTimer;
-	connect(d->t, SIGNAL(timeout()), SLOT(do_sync()));
-
-	connect(&d->http, SIGNAL(result()), SLOT(http_result()));
-	connect(&d->http, SIGNAL(error(int)), SLOT(http_error(int)));
+	d->timer = 0;
+	d->interval = 0;
+	d->sending = 0;
+	d->depth = 1;
+	d->maxPacket = 0;
 
 	reset(true);
 }
@@ -100,21 +283,50 @@ HttpPoll::HttpPoll(QObject *parent)
 HttpPoll::~HttpPoll()
 {
 	reset(true);
-	delete d->t;
 	delete d;
 }
 
 void HttpPoll::reset(bool clear)
 {
-	if(d->http.isActive())
-		d->http.stop();
+	clearRequests();
 	if(clear)
 		clearReadBuffer();
 	clearWriteBuffer();
-	d->out.resize(0);
 	d->state = 0;
 	d->closing = false;
-	d->t->stop();
+	d->interval = 0;
+	d->streamed = false;
+	stopPollTimer();
+}
+
+void HttpPoll::post(const QByteArray &packet, int size)
+{
+	Private::Request *r = new Private::Request;
+	r->http = new HttpProxyPost;
+	r->size = size;
+	r->done = false;
+	d->requests.append(r);
+	d->sending += size;
+
+	connect(r->http, SIGNAL(bodyReady()), SLOT(http_bodyReady()));
+	connect(r->http, SIGNAL(result()), SLOT(http_result()));
+	connect(r->http, SIGNAL(error(int)), SLOT(http_error(int)));
+	r->http->setAuth(d->user, d->pass);
+	r->http->post(d->host, d->port, d->url, packet, d->use_proxy);
+}
+
+void HttpPoll::clearRequests()
+{
+	// the posts may be in the middle of emitting, so they go later
+	QPtrListIterator<Private::Request> it(d->requests);
+	for(Private::Request *r; (r = it.current()); ++it) {
+		r->http->disconnect(this);
+		r->http->stop();
+		r->http->deleteLater();
+		delete r;
+	}
+	d->requests.clear();
+	d->sending = 0;
 }
 
 void HttpPoll::setAuth(const QString &user, const QString &pass)
@@ -167,8 +379,7 @@ void HttpPoll::connectToHost(const QString &proxyHost, int proxyPort, const QStr
 		return;
 
 	d->state = 1;
-	d->http.setAuth(d->user, d->pass);
-	d->http.post(d->host, d->port, d->url, makePacket("0", key, "", QByteArray()), d->use_proxy);
+	post(makePacket("0", key, "", QByteArray()), 0);
 }
 
 QByteArray HttpPoll::makePacket(const QString &ident, const QString &key, const QString &newkey, const QByteArray &block)
@@ -194,12 +405,63 @@ QByteArray HttpPoll::makePacket(const QString &ident, const QString &key, const
 
 int HttpPoll::pollInterval() const
 {
-	return d->polltime;
+	return d->policy.maximum() / 1000;
 }
 
 void HttpPoll::setPollInterval(int seconds)
 {
-	d->polltime = seconds;
+	d->policy = HttpPollPolicy(seconds);
+}
+
+HttpPollPolicy HttpPoll::pollPolicy() const
+{
+	return d->policy;
+}
+
+void HttpPoll::setPollPolicy(const HttpPollPolicy &p)
+{
+	d->policy = p;
+	d->interval = 0;
+}
+
+int HttpPoll::pipelineDepth() const
+{
+	return d->depth;
+}
+
+void HttpPoll::setPipelineDepth(int n)
+{
+	d->depth = QMAX(n, 1);
+}
+
+int HttpPoll::maxPacketSize() const
+{
+	return d->maxPacket;
+}
+
+void HttpPoll::setMaxPacketSize(int bytes)
+{
+	d->maxPacket = QMAX(bytes, 0);
+}
+
+void HttpPoll::startPollTimer(int msecs)
+{
+	stopPollTimer();
+	d->timer = HttpPollWheel::instance()->start(this, msecs);
+}
+
+void HttpPoll::stopPollTimer()
+{
+	if(d->timer) {
+		HttpPollWheel::instance()->stop(d->timer);
+		d->timer = 0;
+	}
+}
+
+void HttpPoll::pollTimeout()
+{
+	d->timer = 0;
+	do_sync();
 }
 
 bool HttpPoll::isOpen() const
@@ -218,42 +480,122 @@ void HttpPoll::close()
 		d->closing = true;
 }
 
+static QString cookieId(const QString &cookie)
+{
+	int n = cookie.find("ID=");
+	if(n == -1)
+		return QString::null;
+	n += 3;
+	int n2 = cookie.find(';', n);
+	if(n2 != -1)
+		return cookie.mid(n, n2-n);
+	else
+		return cookie.mid(n);
+}
+
+void HttpPoll::http_bodyReady()
+{
+	// only the oldest reply can be passed on as it arrives, the others
+	//   wait their turn
+	if(d->requests.isEmpty() || d->requests.getFirst()->http != sender())
+		return;
+	deliverBody();
+}
+
+void HttpPoll::deliverBody()
+{
+	// pass data on as it arrives, once the session is up and the reply
+	//   isn't a session error.  anything else waits for the whole reply.
+	if(d->state != 2)
+		return;
+	HttpProxyPost *http = d->requests.getFirst()->http;
+	QString id = cookieId(http->getHeader("Set-Cookie"));
+	if(id.isNull() || id.right(2) == ":0")
+		return;
+
+	QByteArray block = http->takeBody();
+	if(block.isEmpty())
+		return;
+	d->streamed = true;
+	appendRead(block);
+	readyRead();
+}
+
 void HttpPoll::http_result()
 {
+	QPtrListIterator<Private::Request> it(d->requests);
+	for(Private::Request *r; (r = it.current()); ++it) {
+		if(r->http == sender()) {
+			r->done = true;
+			break;
+		}
+	}
+
+	// take the replies that are complete and have nothing before them
+	QGuardedPtr<QObject> self = this;
+	while(!d->requests.isEmpty() && d->requests.getFirst()->done) {
+		if(!takeReply())
+			return;
+	}
+
+	// the next reply may have some of its body in already
+	if(!d->requests.isEmpty()) {
+		deliverBody();
+		if(!self)
+			return;
+	}
+
+	if(bytesToWrite() > d->sending) {
+		do_sync();
+	}
+	else {
+		if(d->closing && bytesToWrite() == 0) {
+			reset();
+			delayedCloseFinished();
+			return;
+		}
+	}
+}
+
+bool HttpPoll::takeReply()
+{
+	Private::Request *r = d->requests.getFirst();
+	d->requests.removeFirst();
+	d->sending -= r->size;
+	HttpProxyPost *http = r->http;
+	int size = r->size;
+	delete r;
+	http->disconnect(this);
+	http->deleteLater();
+
 	// check for death :)
 	QGuardedPtr<QObject> self = this;
 	syncFinished();
 	if(!self)
-		return;
+		return false;
 
 	// get id and packet
-	QString id;
-	QString cookie = d->http.getHeader("Set-Cookie");
-	int n = cookie.find("ID=");
-	if(n == -1) {
+	QString id = cookieId(http->getHeader("Set-Cookie"));
+	if(id.isNull()) {
 		reset();
 		error(ErrRead);
-		return;
+		return false;
 	}
-	n += 3;
-	int n2 = cookie.find(';', n);
-	if(n2 != -1)
-		id = cookie.mid(n, n2-n);
-	else
-		id = cookie.mid(n);
-	QByteArray block = d->http.body();
+	QByteArray block = http->takeBody();
+	bool streamed = d->streamed;
+	d->streamed = false;
 
 	// session error?
 	if(id.right(2) == ":0") {
 		if(id == "0:0" && d->state == 2) {
 			reset();
 			connectionClosed();
-			return;
+			return false;
 		}
 		else {
 			reset();
 			error(ErrRead);
-			return;
+			return false;
 		}
 	}
 
@@ -264,25 +606,25 @@ void HttpPoll::http_result()
 		justNowConnected = true;
 	}
 
-	// sync up again soon
+	// sync up again soon, sooner if there was traffic
+	d->interval = d->policy.next(d->interval, !block.isEmpty() || streamed || size > 0);
 	if(bytesToWrite() > 0 || !d->closing)
-		d->t->start(d->polltime * 1000, true);
+		startPollTimer(d->interval);
 
 	// connecting
 	if(justNowConnected) {
 		connected();
 	}
 	else {
-		if(!d->out.isEmpty()) {
-			int x = d->out.size();
-			d->out.resize(0);
-			takeWrite(x);
-			bytesWritten(x);
+		if(size > 0) {
+			takeWrite(size);
+			recordWrite(size);
+			bytesWritten(size);
 		}
 	}
 
 	if(!self)
-		return;
+		return false;
 
 	if(!block.isEmpty()) {
 		appendRead(block);
@@ -290,18 +632,8 @@ void HttpPoll::http_result()
 	}
 
 	if(!self)
-		return;
-
-	if(bytesToWrite() > 0) {
-		do_sync();
-	}
-	else {
-		if(d->closing) {
-			reset();
-			delayedCloseFinished();
-			return;
-		}
-	}
+		return false;
+	return true;
 }
 
 void HttpPoll::http_error(int x)
@@ -323,33 +655,68 @@ void HttpPoll::http_error(int x)
 
 int HttpPoll::tryWrite()
 {
-	if(!d->http.isActive())
-		do_sync();
+	do_sync();
 	return 0;
 }
 
-void HttpPoll::do_sync()
+// copy 'size' bytes from 'offset' into the chain
+static QByteArray copyChain(const ByteChain &chain, int offset, int size)
 {
-	if(d->http.isActive())
-		return;
-
-	d->t->stop();
-	d->out = takeWrite(0, false);
-
-	bool last;
-	QString key = getKey(&last);
-	QString newkey;
-	if(last) {
-		resetKey();
-		newkey = getKey(&last);
+	QByteArray a(size);
+	ByteSpanList spans;
+	chain.spans(&spans, offset + size);
+	int at = 0;
+	for(ByteSpanList::ConstIterator it = spans.begin(); it != spans.end() && at < size; ++it) {
+		const char *p = (*it).data;
+		int len = (*it).size;
+		if(offset >= len) {
+			offset -= len;
+			continue;
+		}
+		p += offset;
+		len -= offset;
+		offset = 0;
+		if(len > size - at)
+			len = size - at;
+		memcpy(a.data() + at, p, len);
+		at += len;
 	}
+	return a;
+}
 
+void HttpPoll::do_sync()
+{
+	// once the session is up, more posts can go out before the first one is
+	//   answered: each carries the next piece of the write buffer that none
+	//   of the others has, up to the pipeline depth.  the keys give the
+	//   server their order, so it can apply them the way they were sent.
 	QGuardedPtr<QObject> self = this;
-	syncStarted();
-	if(!self)
-		return;
+	while(1) {
+		if(!d->requests.isEmpty()) {
+			if(d->state != 2 || (int)d->requests.count() >= d->depth || bytesToWrite() <= d->sending)
+				return;
+		}
+
+		stopPollTimer();
+		int size = bytesToWrite() - d->sending;
+		if(d->maxPacket > 0 && size > d->maxPacket)
+			size = d->maxPacket;
+		QByteArray block = copyChain(writeChain(), d->sending, size);
+
+		bool last;
+		QString key = getKey(&last);
+		QString newkey;
+		if(last) {
+			resetKey();
+			newkey = getKey(&last);
+		}
 
-	d->http.post(d->host, d->port, d->url, makePacket(d->ident, key, newkey, d->out), d->use_proxy);
+		syncStarted();
+		if(!self)
+			return;
+
+		post(makePacket(d->ident, key, newkey, block), size);
+	}
 }
 
 void HttpPoll::resetKey()
@@ -357,95 +724,215 @@ void HttpPoll::resetKey()
 #ifdef PROX_DEBUG
 	fprintf(stderr, "HttpPoll: reset key!\n");
 #endif
-	QByteArray a = randomArray(64);
-	QString str = QString::fromLatin1(a.data(), a.size());
-
+	// each key is the SHA1 of the base64 form of the key before it.  keys
+	//   are sent in reverse order, so the server can verify each one against
+	//   the last.  only the raw digests are kept, the text is made in getKey()
+	QByteArray digest = QCA::SHA1::hash(randomArray(64));
+	for(int n = 0; n < POLL_KEYS; ++n) {
+		memcpy(d->key[n], digest.data(), KEY_SIZE);
+		if(n + 1 < POLL_KEYS)
+			digest = QCA::SHA1::hash(Base64::encode(digest));
+	}
 	d->key_n = POLL_KEYS;
-	for(int n = 0; n < POLL_KEYS; ++n)
-		d->key[n] = hpk(n+1, str);
 }
 
-const QString & HttpPoll::getKey(bool *last)
+QString HttpPoll::getKey(bool *last)
 {
 	*last = false;
 	--(d->key_n);
 	if(d->key_n == 0)
 		*last = true;
-	return d->key[d->key_n];
+	QByteArray a(KEY_SIZE);
+	memcpy(a.data(), d->key[d->key_n], KEY_SIZE);
+	return Base64::arrayToString(a);
 }
 
 
 //----------------------------------------------------------------------------
-// HttpProxyPost
+// HttpConnectionPool
 //----------------------------------------------------------------------------
-static QString extractLine(QByteArray *buf, bool *found)
-{
-	// scan for newline
-	int n;
-	for(n = 0; n < (int)buf->size()-1; ++n) {
-		if(buf->at(n) == '\r' && buf->at(n+1) == '\n') {
-			QCString cstr;
-			cstr.resize(n+1);
-			memcpy(cstr.data(), buf->data(), n);
-			n += 2; // hack off CR/LF
-
-			memmove(buf->data(), buf->data() + n, buf->size() - n);
-			buf->resize(buf->size() - n);
-			QString s = QString::fromUtf8(cstr);
-
-			if(found)
-				*found = true;
-			return s;
+#define POOL_MAX_IDLE  4  // idle connections kept per endpoint
+#define POOL_IDLE_TIME 30 // seconds an idle connection is kept
+#define POOL_CHECK_TIME 5 // seconds between checks while anything is kept
+
+class HttpConnectionPool : public QObject
+{
+	Q_OBJECT
+public:
+	static HttpConnectionPool *instance()
+	{
+		if(!self)
+			self = new HttpConnectionPool;
+		return self;
+	}
+
+	BSocket *take(const QString &key)
+	{
+		expire();
+		QPtrListIterator<Item> it(list);
+		for(Item *i; (i = it.current());) {
+			++it;
+			if(i->key != key)
+				continue;
+			BSocket *sock = i->sock;
+			list.removeRef(i);
+
+			// closed by the server, or sent us something unexpected?
+			if(sock->state() != BSocket::Connected || sock->bytesAvailable() > 0) {
+				SafeDelete::deleteSingle(sock);
+				continue;
+			}
+			return sock;
 		}
+		return 0;
 	}
 
-	if(found)
-		*found = false;
-	return "";
-}
+	void put(const QString &key, BSocket *sock)
+	{
+		expire();
+		int count = 0;
+		QPtrListIterator<Item> it(list);
+		for(Item *i; (i = it.current()); ++it) {
+			if(i->key == key)
+				++count;
+		}
+		if(sock->state() != BSocket::Connected || count >= POOL_MAX_IDLE) {
+			SafeDelete::deleteSingle(sock);
+			return;
+		}
+
+		Item *i = new Item;
+		i->key = key;
+		i->sock = sock;
+		i->since = time(0);
+		list.append(i);
+
+		// close the idle ones in time even if nothing else comes along
+		if(!t.isActive())
+			t.start(POOL_CHECK_TIME * 1000);
+	}
+
+private slots:
+	void t_timeout()
+	{
+		expire();
+	}
+
+private:
+	class Item
+	{
+	public:
+		QString key;
+		BSocket *sock;
+		time_t since;
+	};
+	QPtrList<Item> list;
+	QTimer t;
+	static HttpConnectionPool *self;
+
+	HttpConnectionPool()
+	:QObject(qApp)
+	{
+		list.setAutoDelete(true);
+		connect(&t, SIGNAL(timeout()), SLOT(t_timeout()));
+	}
+
+	~HttpConnectionPool()
+	{
+		QPtrListIterator<Item> it(list);
+		for(Item *i; (i = it.current()); ++it)
+			delete i->sock;
+		self = 0;
+	}
 
-static bool extractMainHeader(const QString &line, QString *proto, int *code, QString *msg)
+	void expire()
+	{
+		time_t now = time(0);
+		QPtrListIterator<Item> it(list);
+		for(Item *i; (i = it.current());) {
+			++it;
+			if(now - i->since >= POOL_IDLE_TIME || i->sock->state() != BSocket::Connected) {
+				SafeDelete::deleteSingle(i->sock);
+				list.removeRef(i);
+			}
+		}
+		if(list.isEmpty())
+			t.stop();
+	}
+};
+
+HttpConnectionPool *HttpConnectionPool::self = 0;
+
+//----------------------------------------------------------------------------
+// HttpProxyPost
+//----------------------------------------------------------------------------
+// reads the size from a chunk-size line, returning -1 if it is no good
+static int chunkSize(const char *p, int len)
 {
-	int n = line.find(' ');
-	if(n == -1)
-		return false;
-	if(proto)
-		*proto = line.mid(0, n);
-	++n;
-	int n2 = line.find(' ', n);
-	if(n2 == -1)
-		return false;
-	if(code)
-		*code = line.mid(n, n2-n).toInt();
-	n = n2+1;
-	if(msg)
-		*msg = line.mid(n);
-	return true;
+	while(len > 0 && (p[len - 1] == '\n' || p[len - 1] == '\r'))
+		--len;
+	int n = 0;
+	while(n < len && (p[n] == ' ' || p[n] == '\t'))
+		++n;
+	int size = 0;
+	int digits = 0;
+	for(; n < len; ++n, ++digits) {
+		char c = p[n];
+		int x;
+		if(c >= '0' && c <= '9')
+			x = c - '0';
+		else if(c >= 'a' && c <= 'f')
+			x = c - 'a' + 10;
+		else if(c >= 'A' && c <= 'F')
+			x = c - 'A' + 10;
+		else
+			break;
+		if(size > 0x7ffffff)
+			return -1;
+		size = size * 16 + x;
+	}
+	if(digits == 0)
+		return -1;
+
+	// anything after the size must be whitespace or extensions
+	while(n < len && (p[n] == ' ' || p[n] == '\t'))
+		++n;
+	if(n < len && p[n] != ';')
+		return -1;
+	return size;
 }
 
+enum { BodyUntilClose, BodyLength, BodyChunked };
+enum { ChunkSize, ChunkData, ChunkDataEnd, ChunkTrailer };
+
 class HttpProxyPost::Private
 {
 public:
 	Private() {}
 
-	BSocket sock;
+	BSocket *sock;
 	QByteArray postdata, recvBuf, body;
 	QString url;
 	QString user, pass;
 	bool inHeader;
-	QStringList headerLines;
+	HttpResponseParser parser;
 	bool asProxy;
 	QString host;
+	int port;
+
+	bool useKeepAlive;
+	QString poolKey;
+	bool reused, gotData, persistent;
+	int bodyMode, bodyLeft, chunkState;
+	SafeDelete sd;
 };
 
 HttpProxyPost::HttpProxyPost(QObject *parent)
 :QObject(parent)
 {
 	d = new Private;
-	connect(&d->sock, SIGNAL(connected()), SLOT(sock_connected()));
-	connect(&d->sock, SIGNAL(connectionClosed()), SLOT(sock_connectionClosed()));
-	connect(&d->sock, SIGNAL(readyRead()), SLOT(sock_readyRead()));
-	connect(&d->sock, SIGNAL(error(int)), SLOT(sock_error(int)));
+	d->sock = 0;
+	d->useKeepAlive = true;
 	reset(true);
 }
 
@@ -457,8 +944,11 @@ HttpProxyPost::~HttpProxyPost()
 
 void HttpProxyPost::reset(bool clear)
 {
-	if(d->sock.state() != BSocket::Idle)
-		d->sock.close();
+	if(d->sock) {
+		d->sock->disconnect(this);
+		d->sd.deleteLater(d->sock);
+		d->sock = 0;
+	}
 	d->recvBuf.resize(0);
 	if(clear)
 		d->body.resize(0);
@@ -470,9 +960,14 @@ void HttpProxyPost::setAuth(const QString &user, const QString &pass)
 	d->pass = pass;
 }
 
+void HttpProxyPost::setKeepAlive(bool b)
+{
+	d->useKeepAlive = b;
+}
+
 bool HttpProxyPost::isActive() const
 {
-	return (d->sock.state() == BSocket::Idle ? false: true);
+	return (d->sock ? true: false);
 }
 
 void HttpProxyPost::post(const QString &proxyHost, int proxyPort, const QString &url, const QByteArray &data, bool asProxy)
@@ -480,10 +975,29 @@ void HttpProxyPost::post(const QString &proxyHost, int proxyPort, const QString
 	reset(true);
 
 	d->host = proxyHost;
+	d->port = proxyPort;
 	d->url = url;
 	d->postdata = data;
 	d->asProxy = asProxy;
+	d->poolKey = proxyHost + ':' + QString::number(proxyPort) + (asProxy ? "/proxy" : "");
+
+	// reuse an idle connection to the same endpoint if there is one
+	BSocket *sock = 0;
+	if(d->useKeepAlive)
+		sock = HttpConnectionPool::instance()->take(d->poolKey);
+	if(sock) {
+#ifdef PROX_DEBUG
+		fprintf(stderr, "HttpProxyPost: Reusing connection to %s:%d\n", proxyHost.latin1(), proxyPort);
+#endif
+		d->reused = true;
+		attach(sock);
+		sendRequest();
+		return;
+	}
 
+	d->reused = false;
+	sock = new BSocket;
+	attach(sock);
 #ifdef PROX_DEBUG
 	fprintf(stderr, "HttpProxyPost: Connecting to %s:%d", proxyHost.latin1(), proxyPort);
 	if(d->user.isEmpty())
@@ -491,7 +1005,7 @@ void HttpProxyPost::post(const QString &proxyHost, int proxyPort, const QString
 	else
 		fprintf(stderr, ", auth {%s,%s}\n", d->user.latin1(), d->pass.latin1());
 #endif
-	d->sock.connectToHost(proxyHost, proxyPort);
+	sock->connectToHost(proxyHost, proxyPort);
 }
 
 void HttpProxyPost::stop()
@@ -504,33 +1018,40 @@ QByteArray HttpProxyPost::body() const
 	return d->body;
 }
 
+QByteArray HttpProxyPost::takeBody()
+{
+	QByteArray a = d->body;
+	d->body = QByteArray();
+	return a;
+}
+
 QString HttpProxyPost::getHeader(const QString &var) const
 {
-	for(QStringList::ConstIterator it = d->headerLines.begin(); it != d->headerLines.end(); ++it) {
-		const QString &s = *it;
-		int n = s.find(": ");
-		if(n == -1)
-			continue;
-		QString v = s.mid(0, n);
-		if(v == var)
-			return s.mid(n+2);
-	}
-	return "";
+	QString s = d->parser.header(var);
+	if(s.isNull())
+		return "";
+	return s;
 }
 
-void HttpProxyPost::sock_connected()
+void HttpProxyPost::attach(BSocket *sock)
 {
-#ifdef PROX_DEBUG
-	fprintf(stderr, "HttpProxyPost: Connected\n");
-#endif
+	d->sock = sock;
+	d->gotData = false;
 	d->inHeader = true;
-	d->headerLines.clear();
+	d->parser.reset();
+	connect(sock, SIGNAL(connected()), SLOT(sock_connected()));
+	connect(sock, SIGNAL(connectionClosed()), SLOT(sock_connectionClosed()));
+	connect(sock, SIGNAL(readyRead()), SLOT(sock_readyRead()));
+	connect(sock, SIGNAL(error(int)), SLOT(sock_error(int)));
+}
 
+void HttpProxyPost::sendRequest()
+{
 	QUrl u = d->url;
 
 	// connected, now send the request
 	QString s;
-	s += QString("POST ") + d->url + " HTTP/1.0\r\n";
+	s += QString("POST ") + d->url + (d->useKeepAlive ? " HTTP/1.1\r\n" : " HTTP/1.0\r\n");
 	if(d->asProxy) {
 		if(!d->user.isEmpty()) {
 			QString str = d->user + ':' + d->pass;
@@ -538,59 +1059,99 @@ void HttpProxyPost::sock_connected()
 		}
 		s += "Pragma: no-cache\r\n";
 		s += QString("Host: ") + u.host() + "\r\n";
+		if(d->useKeepAlive)
+			s += "Proxy-Connection: Keep-Alive\r\n";
 	}
 	else {
 		s += QString("Host: ") + d->host + "\r\n";
 	}
+	if(d->useKeepAlive)
+		s += "Connection: Keep-Alive\r\n";
 	s += "Content-Type: application/x-www-form-urlencoded\r\n";
 	s += QString("Content-Length: ") + QString::number(d->postdata.size()) + "\r\n";
 	s += "\r\n";
 
-	// write request
+	// write request and postdata
 	QCString cs = s.utf8();
 	QByteArray block(cs.length());
 	memcpy(block.data(), cs.data(), block.size());
-	d->sock.write(block);
+	QValueList<QByteArray> list;
+	list += block;
+	list += d->postdata;
+	d->sock->writev(list);
+}
+
+void HttpProxyPost::retry()
+{
+#ifdef PROX_DEBUG
+	fprintf(stderr, "HttpProxyPost: Reused connection went away, reconnecting\n");
+#endif
+	reset();
+	d->reused = false;
+	BSocket *sock = new BSocket;
+	attach(sock);
+	sock->connectToHost(d->host, d->port);
+}
+
+void HttpProxyPost::finish()
+{
+	// response complete.  keep the connection for the next post?
+	if(d->persistent && d->useKeepAlive && d->recvBuf.isEmpty()) {
+		BSocket *sock = d->sock;
+		sock->disconnect(this);
+		d->sock = 0;
+		HttpConnectionPool::instance()->put(d->poolKey, sock);
+	}
+	reset();
+	result();
+}
 
-	// write postdata
-	d->sock.write(d->postdata);
+void HttpProxyPost::sock_connected()
+{
+#ifdef PROX_DEBUG
+	fprintf(stderr, "HttpProxyPost: Connected\n");
+#endif
+	sendRequest();
 }
 
 void HttpProxyPost::sock_connectionClosed()
 {
-	d->body = d->recvBuf.copy();
+	SafeDeleteLock s(&d->sd);
+
+	// a pooled connection may have been closed by the server while idle
+	if(d->reused && !d->gotData) {
+		retry();
+		return;
+	}
+
+	if(!d->inHeader && d->bodyMode != BodyUntilClose) {
+		// closed before the framed body was complete
+		reset(true);
+		error(ErrSocket);
+		return;
+	}
+
+	moveBody(d->recvBuf.size());
 	reset();
 	result();
 }
 
 void HttpProxyPost::sock_readyRead()
 {
-	QByteArray block = d->sock.read();
+	SafeDeleteLock s(&d->sd);
+
+	QByteArray block = d->sock->read();
 	ByteStream::appendArray(&d->recvBuf, block);
+	d->gotData = true;
 
 	if(d->inHeader) {
-		// grab available lines
+		int code;
 		while(1) {
-			bool found;
-			QString line = extractLine(&d->recvBuf, &found);
-			if(!found)
-				break;
-			if(line.isEmpty()) {
-				d->inHeader = false;
-				break;
-			}
-			d->headerLines += line;
-		}
-
-		// done with grabbing the header?
-		if(!d->inHeader) {
-			QString str = d->headerLines.first();
-			d->headerLines.remove(d->headerLines.begin());
-
-			QString proto;
-			int code;
-			QString msg;
-			if(!extractMainHeader(str, &proto, &code, &msg)) {
+			// done with grabbing the header?
+			int r = d->parser.parse(d->recvBuf.data(), d->recvBuf.size());
+			if(r == 0)
+				return;
+			if(r == -1) {
 #ifdef PROX_DEBUG
 				fprintf(stderr, "HttpProxyPost: invalid header!\n");
 #endif
@@ -598,52 +1159,174 @@ void HttpProxyPost::sock_readyRead()
 				error(ErrProxyNeg);
 				return;
 			}
-			else {
+			ByteStream::takeArray(&d->recvBuf, r, true);
+
+			code = d->parser.code();
 #ifdef PROX_DEBUG
-				fprintf(stderr, "HttpProxyPost: header proto=[%s] code=[%d] msg=[%s]\n", proto.latin1(), code, msg.latin1());
-				for(QStringList::ConstIterator it = d->headerLines.begin(); it != d->headerLines.end(); ++it)
-					fprintf(stderr, "HttpProxyPost: * [%s]\n", (*it).latin1());
+			fprintf(stderr, "HttpProxyPost: header proto=[HTTP/%d.%d] code=[%d] msg=[%s]\n", d->parser.majorVersion(), d->parser.minorVersion(), code, d->parser.message().latin1());
+			QStringList lines = d->parser.headerLines();
+			for(QStringList::ConstIterator it = lines.begin(); it != lines.end(); ++it)
+				fprintf(stderr, "HttpProxyPost: * [%s]\n", (*it).latin1());
 #endif
-			}
 
-			if(code == 200) { // OK
+			// an HTTP/1.1 server may send interim replies, such as
+			//   "100 Continue", ahead of the real one
+			if(code < 100 || code >= 200)
+				break;
+			d->parser.reset();
+		}
+		d->inHeader = false;
+
+		if(code == 200) { // OK
 #ifdef PROX_DEBUG
-				fprintf(stderr, "HttpProxyPost: << Success >>\n");
+			fprintf(stderr, "HttpProxyPost: << Success >>\n");
 #endif
+		}
+		else {
+			int err;
+			QString errStr;
+			if(code == 407) { // Authentication failed
+				err = ErrProxyAuth;
+				errStr = tr("Authentication failed");
+			}
+			else if(code == 404) { // Host not found
+				err = ErrHostNotFound;
+				errStr = tr("Host not found");
+			}
+			else if(code == 403) { // Access denied
+				err = ErrProxyNeg;
+				errStr = tr("Access denied");
+			}
+			else if(code == 503) { // Connection refused
+				err = ErrConnectionRefused;
+				errStr = tr("Connection refused");
+			}
+			else { // invalid reply
+				err = ErrProxyNeg;
+				errStr = tr("Invalid reply");
 			}
-			else {
-				int err;
-				QString errStr;
-				if(code == 407) { // Authentication failed
-					err = ErrProxyAuth;
-					errStr = tr("Authentication failed");
-				}
-				else if(code == 404) { // Host not found
-					err = ErrHostNotFound;
-					errStr = tr("Host not found");
-				}
-				else if(code == 403) { // Access denied
-					err = ErrProxyNeg;
-					errStr = tr("Access denied");
-				}
-				else if(code == 503) { // Connection refused
-					err = ErrConnectionRefused;
-					errStr = tr("Connection refused");
-				}
-				else { // invalid reply
-					err = ErrProxyNeg;
-					errStr = tr("Invalid reply");
-				}
 
 #ifdef PROX_DEBUG
-				fprintf(stderr, "HttpProxyPost: << Error >> [%s]\n", errStr.latin1());
+			fprintf(stderr, "HttpProxyPost: << Error >> [%s]\n", errStr.latin1());
 #endif
-				reset(true);
-				error(err);
-				return;
+			reset(true);
+			error(err);
+			return;
+		}
+
+		// how is the body framed, and may the connection be reused?
+		int conn = d->parser.connection();
+		if(d->asProxy && conn == HttpResponseParser::ConnDefault)
+			conn = d->parser.proxyConnection();
+		if(d->parser.majorVersion() == 1 && d->parser.minorVersion() >= 1)
+			d->persistent = (conn != HttpResponseParser::ConnClose);
+		else
+			d->persistent = (conn == HttpResponseParser::ConnKeepAlive);
+
+		if(d->parser.isChunked()) {
+			d->bodyMode = BodyChunked;
+			d->chunkState = ChunkSize;
+		}
+		else if(d->parser.contentLength() != -1) {
+			d->bodyMode = BodyLength;
+			d->bodyLeft = d->parser.contentLength();
+		}
+		else {
+			d->bodyMode = BodyUntilClose;
+			d->persistent = false;
+		}
+	}
+
+	if(!d->inHeader) {
+		// hand over what there is of the body so far
+		int before = d->body.size();
+		if(!processBody())
+			return;
+		if((int)d->body.size() > before)
+			bodyReady();
+	}
+}
+
+void HttpProxyPost::moveBody(int n)
+{
+	if(n <= 0)
+		return;
+	if(n == (int)d->recvBuf.size() && d->body.isEmpty()) {
+		d->body = d->recvBuf;
+		d->recvBuf = QByteArray();
+	}
+	else
+		ByteStream::appendArray(&d->body, ByteStream::takeArray(&d->recvBuf, n));
+}
+
+bool HttpProxyPost::processBody()
+{
+	if(d->bodyMode == BodyLength) {
+		int n = QMIN(d->bodyLeft, (int)d->recvBuf.size());
+		moveBody(n);
+		d->bodyLeft -= n;
+		if(d->bodyLeft > 0)
+			return true;
+		finish();
+		return false;
+	}
+	else if(d->bodyMode == BodyChunked) {
+		while(1) {
+			if(d->chunkState == ChunkSize) {
+				int len = HttpResponseParser::lineLength(d->recvBuf.data(), d->recvBuf.size());
+				if(len == 0)
+					return true;
+				int size = chunkSize(d->recvBuf.data(), len);
+				ByteStream::takeArray(&d->recvBuf, len, true);
+				if(size < 0) {
+#ifdef PROX_DEBUG
+					fprintf(stderr, "HttpProxyPost: invalid chunk!\n");
+#endif
+					reset(true);
+					error(ErrProxyNeg);
+					return false;
+				}
+				if(size == 0)
+					d->chunkState = ChunkTrailer;
+				else {
+					d->bodyLeft = size;
+					d->chunkState = ChunkData;
+				}
+			}
+			else if(d->chunkState == ChunkData) {
+				int n = QMIN(d->bodyLeft, (int)d->recvBuf.size());
+				if(n == 0)
+					return true;
+				moveBody(n);
+				d->bodyLeft -= n;
+				if(d->bodyLeft == 0)
+					d->chunkState = ChunkDataEnd;
+			}
+			else if(d->chunkState == ChunkDataEnd) {
+				int len = HttpResponseParser::lineLength(d->recvBuf.data(), d->recvBuf.size());
+				if(len == 0)
+					return true;
+				ByteStream::takeArray(&d->recvBuf, len, true);
+				d->chunkState = ChunkSize;
+			}
+			else { // ChunkTrailer
+				int len = HttpResponseParser::lineLength(d->recvBuf.data(), d->recvBuf.size());
+				if(len == 0)
+					return true;
+				bool empty = (len == 1 || (len == 2 && d->recvBuf[0] == '\r'));
+				ByteStream::takeArray(&d->recvBuf, len, true);
+				if(empty) {
+					finish();
+					return false;
+				}
 			}
 		}
 	}
+	else {
+		// until the server closes
+		moveBody(d->recvBuf.size());
+	}
+	return true;
 }
 
 void HttpProxyPost::sock_error(int x)
@@ -651,6 +1334,13 @@ void HttpProxyPost::sock_error(int x)
 #ifdef PROX_DEBUG
 	fprintf(stderr, "HttpProxyPost: socket error: %d\n", x);
 #endif
+	SafeDeleteLock s(&d->sd);
+
+	if(d->reused && !d->gotData) {
+		retry();
+		return;
+	}
+
 	reset(true);
 	if(x == BSocket::ErrHostNotFound)
 		error(ErrProxyConnect);
@@ -661,3 +1351,5 @@ void HttpProxyPost::sock_error(int x)
 }
 
 // CS_NAMESPACE_END
+
+#include "httppoll.moc"
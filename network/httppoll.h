@@ -25,6 +25,24 @@
 
 // CS_NAMESPACE_BEGIN
 
+class HttpPollWheel;
+
+class HttpPollPolicy
+{
+public:
+	HttpPollPolicy(int seconds=30);
+	static HttpPollPolicy adaptive(int minMsecs, int maxMsecs, int factor=2);
+
+	bool isAdaptive() const;
+	int minimum() const;
+	int maximum() const;
+	int next(int current, bool active) const;
+
+private:
+	bool _adaptive;
+	int _min, _max, _factor;
+};
+
 class HttpPoll : public ByteStream
 {
 	Q_OBJECT
@@ -39,6 +57,12 @@ public:
 
 	int pollInterval() const;
 	void setPollInterval(int seconds);
+	HttpPollPolicy pollPolicy() const;
+	void setPollPolicy(const HttpPollPolicy &);
+	int pipelineDepth() const;
+	void setPipelineDepth(int);
+	int maxPacketSize() const;
+	void setMaxPacketSize(int);
 
 	// from ByteStream
 	bool isOpen() const;
@@ -53,6 +77,7 @@ protected:
 	int tryWrite();
 
 private slots:
+	void http_bodyReady();
 	void http_result();
 	void http_error(int);
 	void do_sync();
@@ -62,11 +87,22 @@ private:
 	Private *d;
 
 	void reset(bool clear=false);
+	void post(const QByteArray &packet, int size);
+	void clearRequests();
+	bool takeReply();
+	void deliverBody();
 	QByteArray makePacket(const QString &ident, const QString &key, const QString &newkey, const QByteArray &block);
 	void resetKey();
-	const QString & getKey(bool *);
+	QString getKey(bool *);
+	void startPollTimer(int msecs);
+	void stopPollTimer();
+
+	friend class HttpPollWheel;
+	void pollTimeout();
 };
 
+class BSocket;
+
 class HttpProxyPost : public QObject
 {
 	Q_OBJECT
@@ -76,13 +112,16 @@ public:
 	~HttpProxyPost();
 
 	void setAuth(const QString &user, const QString &pass="");
+	void setKeepAlive(bool);
 	bool isActive() const;
 	void post(const QString &proxyHost, int proxyPort, const QString &url, const QByteArray &data, bool asProxy=true);
 	void stop();
 	QByteArray body() const;
+	QByteArray takeBody();
 	QString getHeader(const QString &) const;
 
 signals:
+	void bodyReady();
 	void result();
 	void error(int);
 
@@ -97,6 +136,12 @@ private:
 	Private *d;
 
 	void reset(bool clear=false);
+	void attach(BSocket *);
+	void sendRequest();
+	void retry();
+	bool processBody();
+	void moveBody(int n);
+	void finish();
 };
 
 // CS_NAMESPACE_END
@@ -28,7 +28,14 @@
 //!
 //! NDns uses a thread to make the system call happen in the background.  This
 //! gives your program native DNS behavior, at the cost of requiring threads
-//! to build.
+//! to build.  The threads are pooled and shared by all NDns objects, lookups
+//! of the same name are merged, and results are cached for a few minutes.
+//!
+//! Names in the hosts file are answered from it straight away.  Otherwise,
+//! where nameservers are configured, names are looked up with DnsClient,
+//! which needs no thread at all.  The system call is only made when that
+//! fails or is slow to answer, or for a name without a dot, so that search
+//! domains still work.
 //!
 //! \code
 //! #include "ndns.h"
@@ -53,7 +60,20 @@
 #include<qapplication.h>
 #include<qsocketdevice.h>
 #include<qptrlist.h>
+#include<qptrdict.h>
+#include<qdict.h>
+#include<qstringlist.h>
+#include<qguardedptr.h>
+#include<qwaitcondition.h>
 #include<qeventloop.h>
+#include<qtimer.h>
+#include<qdatetime.h>
+#include<qfile.h>
+#include<qfileinfo.h>
+#include<time.h>
+#ifndef NO_DNSCLIENT
+#include"dnsclient.h"
+#endif
 
 #ifdef Q_OS_UNIX
 #include<netdb.h>
@@ -66,6 +86,26 @@
 #include<windows.h>
 #endif
 
+// resolver threads kept for reuse.  without gethostbyname_r the calls
+//   would serialize anyway, so a single thread does all the work.
+#ifdef HAVE_GETHOSTBYNAME_R
+# define NDNS_MAX_WORKERS 4
+#else
+# define NDNS_MAX_WORKERS 1
+#endif
+
+// seconds that a successful / failed lookup is remembered
+#define NDNS_CACHE_TTL     300
+#define NDNS_NEGATIVE_TTL  30
+#define NDNS_CACHE_MAX     256
+
+// msecs DnsClient gets before the system resolver takes over
+#define NDNS_CLIENT_WAIT   2000
+#define NDNS_CLIENT_TICK   250
+
+// seconds between checks of the hosts file for changes
+#define NDNS_HOSTS_CHECK   5
+
 // CS_NAMESPACE_BEGIN
 
 //! \if _hide_doc_
@@ -73,79 +113,162 @@ class NDnsWorkerEvent : public QCustomEvent
 {
 public:
 	enum Type { WorkerEvent = QEvent::User + 100 };
-	NDnsWorkerEvent(NDnsWorker *);
+	NDnsWorkerEvent(NDnsManager::Item *);
 
-	NDnsWorker *worker;
+	NDnsManager::Item *item;
 };
 
-class NDnsWorker : public QThread
+// queue shared between the manager and its workers
+class NDnsQueue
 {
 public:
-	NDnsWorker(QObject *, const QCString &);
+	NDnsQueue() : idle(0), quit(false) {}
 
-	bool success;
-	bool cancelled;
-	QHostAddress addr;
+	QMutex mutex;
+	QWaitCondition cond;
+	QPtrList<NDnsManager::Item> list;
+	int idle;
+	bool quit;
+};
+
+class NDnsWorker : public QThread
+{
+public:
+	NDnsWorker(QObject *, NDnsQueue *);
 
 protected:
 	void run();
 
 private:
-	QCString host;
 	QObject *par;
+	NDnsQueue *queue;
+
+	static bool lookup(const QCString &host, QHostAddress *addr);
 };
 //! \endif
 
 //----------------------------------------------------------------------------
 // NDnsManager
 //----------------------------------------------------------------------------
-#ifndef HAVE_GETHOSTBYNAME_R
-static QMutex *workerMutex = 0;
-static QMutex *workerCancelled = 0;
-#endif
 static NDnsManager *man = 0;
 bool winsock_init = false;
 
+// one lookup of a name, shared by every NDns that asked for it
 class NDnsManager::Item
 {
 public:
-	NDns *ndns;
-	NDnsWorker *worker;
+	QString name;
+	QCString host;         // deep copy for the worker
+	QPtrList<NDns> waiters;
+	DnsClient *dns;
+	int deadline;          // give up on dns at this time
+
+	// written by the worker before the event is posted
+	bool ran, success;
+	QHostAddress addr;
+
+	// guarded by the queue mutex
+	bool cancelled;
 };
 
 class NDnsManager::Private
 {
 public:
-	Item *find(const NDns *n)
+	class CacheEntry
+	{
+	public:
+		QHostAddress addr;
+		bool success;
+		time_t expire;
+	};
+
+	Private() : requests(101), queries(101), lookups(101, false), cache(257, false), outstanding(0), hosts(101, false), hostsChecked(0) {}
+
+	QPtrDict<Item> requests; // NDns -> lookup
+	QPtrDict<Item> queries;  // DnsClient -> lookup
+	QDict<Item> lookups;     // name -> lookup still in progress
+	QDict<CacheEntry> cache;
+	NDnsQueue queue;
+	QPtrList<NDnsWorker> workers;
+	int outstanding;
+	QTimer t;
+	QTime clock;
+
+	// the hosts file, by lowercase name
+	QDict<QHostAddress> hosts;
+	QDateTime hostsModified;
+	time_t hostsChecked;
+
+	void loadHosts()
 	{
-		QPtrListIterator<Item> it(list);
-		for(Item *i; (i = it.current()); ++it) {
-			if(i->ndns == n)
-				return i;
+#ifdef Q_OS_UNIX
+		time_t now = time(0);
+		if(hostsChecked != 0 && now - hostsChecked < NDNS_HOSTS_CHECK)
+			return;
+		hostsChecked = now;
+
+		QFileInfo fi("/etc/hosts");
+		QDateTime mod = fi.exists() ? fi.lastModified() : QDateTime();
+		if(mod == hostsModified)
+			return;
+		hostsModified = mod;
+		hosts.clear();
+
+		QFile f("/etc/hosts");
+		if(!f.open(IO_ReadOnly))
+			return;
+		QString line;
+		while(f.readLine(line, 1024) != -1) {
+			int n = line.find('#');
+			if(n != -1)
+				line.truncate(n);
+			QStringList parts = QStringList::split(' ', line.simplifyWhiteSpace());
+			QHostAddress a;
+			if(parts.count() < 2 || !a.setAddress(parts[0]) || !a.isIp4Addr())
+				continue;
+			// the first entry for a name wins, as with the system resolver
+			for(QStringList::ConstIterator it = parts.at(1); it != parts.end(); ++it) {
+				QString name = (*it).lower();
+				if(!hosts.find(name))
+					hosts.insert(name, new QHostAddress(a));
+			}
 		}
-		return 0;
+#endif
 	}
 
-	Item *find(const NDnsWorker *w)
+	bool findHost(const QString &name, QHostAddress *addr)
 	{
-		QPtrListIterator<Item> it(list);
-		for(Item *i; (i = it.current()); ++it) {
-			if(i->worker == w)
-				return i;
-		}
-		return 0;
+		loadHosts();
+		QString key = name.lower();
+		if(key.right(1) == ".")
+			key.truncate(key.length() - 1);
+		QHostAddress *a = hosts.find(key);
+		if(!a)
+			return false;
+		*addr = *a;
+		return true;
 	}
 
-	QPtrList<Item> list;
+	void purgeCache()
+	{
+		time_t now = time(0);
+		QStringList expired;
+		QDictIterator<CacheEntry> it(cache);
+		for(CacheEntry *e; (e = it.current()); ++it) {
+			if(e->expire <= now)
+				expired += it.currentKey();
+		}
+		for(QStringList::ConstIterator sit = expired.begin(); sit != expired.end(); ++sit)
+			cache.remove(*sit);
+
+		// everything is fresh?  start over
+		if(cache.count() >= NDNS_CACHE_MAX)
+			cache.clear();
+	}
 };
 
 NDnsManager::NDnsManager()
 {
-#ifndef HAVE_GETHOSTBYNAME_R
-	workerMutex = new QMutex;
-	workerCancelled = new QMutex;
-#endif
-
 #ifdef Q_OS_WIN32
 	if(!winsock_init) {
 		winsock_init = true;
@@ -155,96 +278,254 @@ NDnsManager::NDnsManager()
 #endif
 
 	d = new Private;
-	d->list.setAutoDelete(true);
+	d->cache.setAutoDelete(true);
+	d->workers.setAutoDelete(true);
+	d->hosts.setAutoDelete(true);
+	connect(&d->t, SIGNAL(timeout()), SLOT(t_timeout()));
 
 	connect(qApp, SIGNAL(aboutToQuit()), SLOT(app_aboutToQuit()));
 }
 
 NDnsManager::~NDnsManager()
 {
+	// let the workers run out
+	d->queue.mutex.lock();
+	d->queue.quit = true;
+	d->queue.cond.wakeAll();
+	d->queue.mutex.unlock();
+
+	QPtrListIterator<NDnsWorker> it(d->workers);
+	for(NDnsWorker *w; (w = it.current()); ++it)
+		w->wait();
+
+	// anything left over was never picked up
+	d->queue.list.setAutoDelete(true);
+	d->queue.list.clear();
+
 	delete d;
+}
 
-#ifndef HAVE_GETHOSTBYNAME_R
-	delete workerMutex;
-	workerMutex = 0;
-	delete workerCancelled;
-	workerCancelled = 0;
-#endif
+NDnsManager::Item *NDnsManager::newItem(const QString &name)
+{
+	Item *i = new Item;
+	i->name = name;
+	i->dns = 0;
+	i->deadline = 0;
+	i->ran = i->success = false;
+	i->cancelled = false;
+	++d->outstanding;
+	return i;
 }
 
 void NDnsManager::resolve(NDns *self, const QString &name)
 {
-	Item *i = new Item;
-	i->ndns = self;
-	i->worker = new NDnsWorker(this, name.utf8());
-	d->list.append(i);
+	Item *i;
+	QHostAddress numeric;
+	Private::CacheEntry *c = d->cache.find(name);
+	if((numeric.setAddress(name) && numeric.isIp4Addr()) || d->findHost(name, &numeric)) {
+		// nothing to look up
+		i = newItem(name);
+		i->success = true;
+		i->addr = numeric;
+		QApplication::postEvent(this, new NDnsWorkerEvent(i));
+	}
+	else if(c && c->expire > time(0)) {
+		// deliver from the cache, but not before resolve() returns
+		i = newItem(name);
+		i->success = c->success;
+		i->addr = c->addr;
+		QApplication::postEvent(this, new NDnsWorkerEvent(i));
+	}
+	else {
+		if(c)
+			d->cache.remove(name);
+
+		// join a lookup of the same name that is already underway
+		i = d->lookups.find(name);
+		if(!i) {
+			i = newItem(name);
+			d->lookups.insert(name, i);
+#ifndef NO_DNSCLIENT
+			// a name without a dot is for the search list, which only the
+			//   system resolver knows about
+			if(name.find('.') != -1 && DnsClient::isAvailable()) {
+				if(!d->t.isActive()) {
+					d->clock.start();
+					d->t.start(NDNS_CLIENT_TICK);
+				}
+				i->dns = new DnsClient;
+				i->deadline = d->clock.elapsed() + NDNS_CLIENT_WAIT;
+				connect(i->dns, SIGNAL(resultsReady()), SLOT(dns_resultsReady()));
+				d->queries.insert(i->dns, i);
+				i->dns->resolve(name, DnsClient::A);
+			}
+			else
+#endif
+				queueWorker(i);
+		}
+	}
+
+	i->waiters.append(self);
+	d->requests.insert(self, i);
+}
 
-	i->worker->start();
+void NDnsManager::queueWorker(Item *i)
+{
+	i->host = i->name.utf8().copy();
+
+	d->queue.mutex.lock();
+	d->queue.list.append(i);
+	if((int)d->queue.list.count() > d->queue.idle && d->workers.count() < NDNS_MAX_WORKERS) {
+		NDnsWorker *w = new NDnsWorker(this, &d->queue);
+		d->workers.append(w);
+		w->start();
+	}
+	d->queue.cond.wakeOne();
+	d->queue.mutex.unlock();
 }
 
 void NDnsManager::stop(NDns *self)
 {
-	Item *i = d->find(self);
+	Item *i = d->requests.take(self);
 	if(!i)
 		return;
 	// disassociate
-	i->ndns = 0;
+	i->waiters.removeRef(self);
+
+	// nobody else wants it?  skip it if it hasn't started yet
+	if(i->waiters.isEmpty()) {
+		if(d->lookups.find(i->name) == i)
+			d->lookups.remove(i->name);
+
+		if(i->dns) {
+			// no thread involved, so it can go right away
+			d->queries.remove(i->dns);
+			delete i->dns;
+			delete i;
+			--d->outstanding;
+			return;
+		}
 
-#ifndef HAVE_GETHOSTBYNAME_R
-	// cancel
-	workerCancelled->lock();
-	i->worker->cancelled = true;
-	workerCancelled->unlock();
-#endif
+		d->queue.mutex.lock();
+		i->cancelled = true;
+		d->queue.mutex.unlock();
+	}
 }
 
 bool NDnsManager::isBusy(const NDns *self) const
 {
-	Item *i = d->find(self);
+	Item *i = d->requests.find((void *)self);
 	return (i ? true: false);
 }
 
+void NDnsManager::addToCache(const QString &name, const QHostAddress &addr, bool success)
+{
+	if(d->cache.count() >= NDNS_CACHE_MAX)
+		d->purgeCache();
+
+	Private::CacheEntry *c = new Private::CacheEntry;
+	c->addr = addr;
+	c->success = success;
+	c->expire = time(0) + (success ? NDNS_CACHE_TTL : NDNS_NEGATIVE_TTL);
+	d->cache.replace(name, c);
+}
+
 bool NDnsManager::event(QEvent *e)
 {
 	if((int)e->type() == (int)NDnsWorkerEvent::WorkerEvent) {
 		NDnsWorkerEvent *we = static_cast<NDnsWorkerEvent*>(e);
-		we->worker->wait(); // ensure that the thread is terminated
+		deliver(we->item);
+		return true;
+	}
+	return false;
+}
 
-		Item *i = d->find(we->worker);
-		if(!i) {
-			// should NOT happen
-			return true;
-		}
-		QHostAddress addr = i->worker->addr;
-		NDns *ndns = i->ndns;
-		delete i->worker;
-		d->list.removeRef(i);
+void NDnsManager::deliver(Item *i)
+{
+	--d->outstanding;
+
+	if(d->lookups.find(i->name) == i)
+		d->lookups.remove(i->name);
+	if(i->ran)
+		addToCache(i->name, i->addr, i->success);
+
+	// detach everyone first, since the callbacks may start new lookups
+	QValueList< QGuardedPtr<NDns> > list;
+	QPtrListIterator<NDns> it(i->waiters);
+	for(NDns *n; (n = it.current()); ++it) {
+		d->requests.remove(n);
+		list += QGuardedPtr<NDns>(n);
+	}
+	QHostAddress addr = i->success ? i->addr : QHostAddress();
+	delete i;
 
-		// nuke manager if no longer needed (code that follows MUST BE SAFE!)
-		tryDestroy();
+	// requestors still around?
+	for(QValueList< QGuardedPtr<NDns> >::Iterator lit = list.begin(); lit != list.end(); ++lit) {
+		if(*lit)
+			(*lit)->finished(addr);
+	}
+}
 
-		// requestor still around?
-		if(ndns)
-			ndns->finished(addr);
-		return true;
+void NDnsManager::dns_resultsReady()
+{
+#ifndef NO_DNSCLIENT
+	DnsClient *dns = (DnsClient *)sender();
+	Item *i = d->queries.take(dns);
+	if(!i)
+		return;
+	i->dns = 0;
+	QValueList<QHostAddress> list;
+	if(dns->success())
+		list = dns->addresses();
+	dns->deleteLater();
+
+	if(!list.isEmpty()) {
+		i->ran = true;
+		i->success = true;
+		i->addr = list.first();
+		deliver(i);
 	}
-	return false;
+	else {
+		// let the system resolver have a go
+		queueWorker(i);
+	}
+#endif
 }
 
-void NDnsManager::tryDestroy()
+void NDnsManager::t_timeout()
 {
-	if(d->list.isEmpty()) {
-		man = 0;
-		delete this;
+#ifndef NO_DNSCLIENT
+	// nameservers that are slow or gone shouldn't hold every lookup up for
+	//   all of DnsClient's retries.  hand those over to the system resolver.
+	int now = d->clock.elapsed();
+	QPtrList<Item> late;
+	QPtrDictIterator<Item> it(d->queries);
+	for(Item *i; (i = it.current()); ++it) {
+		if(i->deadline <= now)
+			late.append(i);
 	}
+
+	QPtrListIterator<Item> lit(late);
+	for(Item *i; (i = lit.current()); ++lit) {
+		d->queries.remove(i->dns);
+		delete i->dns;
+		i->dns = 0;
+		queueWorker(i);
+	}
+
+	if(d->queries.isEmpty())
+		d->t.stop();
+#endif
 }
 
 void NDnsManager::app_aboutToQuit()
 {
-	while(man) {
+	while(d->outstanding > 0) {
 		QEventLoop *e = qApp->eventLoop();
 		e->processEvents(QEventLoop::WaitForMore);
 	}
+	man = 0;
+	delete this;
 }
 
 
@@ -281,7 +562,7 @@ void NDns::resolve(const QString &host)
 
 //!
 //! Cancels the lookup action.
-//! \note This will not stop the underlying system call, which must finish before the next lookup will proceed.
+//! \note This will not stop the underlying system call if it is already running, which keeps one of the resolver threads busy until it returns.
 void NDns::stop()
 {
 	if(man)
@@ -322,23 +603,48 @@ void NDns::finished(const QHostAddress &a)
 //----------------------------------------------------------------------------
 // NDnsWorkerEvent
 //----------------------------------------------------------------------------
-NDnsWorkerEvent::NDnsWorkerEvent(NDnsWorker *p)
+NDnsWorkerEvent::NDnsWorkerEvent(NDnsManager::Item *i)
 :QCustomEvent(WorkerEvent)
 {
-	worker = p;
+	item = i;
 }
 
 //----------------------------------------------------------------------------
 // NDnsWorker
 //----------------------------------------------------------------------------
-NDnsWorker::NDnsWorker(QObject *_par, const QCString &_host)
+NDnsWorker::NDnsWorker(QObject *_par, NDnsQueue *_queue)
 {
-	success = cancelled = false;
 	par = _par;
-	host = _host.copy(); // do we need this to avoid sharing across threads?
+	queue = _queue;
 }
 
 void NDnsWorker::run()
+{
+	while(1) {
+		queue->mutex.lock();
+		while(queue->list.isEmpty() && !queue->quit) {
+			++queue->idle;
+			queue->cond.wait(&queue->mutex);
+			--queue->idle;
+		}
+		if(queue->quit) {
+			queue->mutex.unlock();
+			break;
+		}
+		NDnsManager::Item *i = queue->list.getFirst();
+		queue->list.removeFirst();
+		bool cancel = i->cancelled;
+		queue->mutex.unlock();
+
+		if(!cancel) {
+			i->success = lookup(i->host, &i->addr);
+			i->ran = true;
+		}
+		QApplication::postEvent(par, new NDnsWorkerEvent(i));
+	}
+}
+
+bool NDnsWorker::lookup(const QCString &host, QHostAddress *addr)
 {
 	hostent *h = 0;
 
@@ -348,29 +654,16 @@ void NDnsWorker::run()
 	int err;
 	gethostbyname_r(host.data(), &buf, char_buf, sizeof(char_buf), &h, &err);
 #else
-	// lock for gethostbyname
-	QMutexLocker locker(workerMutex);
-
-	// check for cancel
-	workerCancelled->lock();
-	bool cancel = cancelled;
-	workerCancelled->unlock();
-
-	if(!cancel)
-		h = gethostbyname(host.data());
+	// only one worker exists in this case, so nobody else is in here
+	h = gethostbyname(host.data());
 #endif
 
-	if(!h) {
-		success = false;
-		QApplication::postEvent(par, new NDnsWorkerEvent(this));
-		return;
-	}
+	if(!h)
+		return false;
 
 	in_addr a = *((struct in_addr *)h->h_addr_list[0]);
-	addr.setAddress(ntohl(a.s_addr));
-	success = true;
-
-	QApplication::postEvent(par, new NDnsWorkerEvent(this));
+	addr->setAddress(ntohl(a.s_addr));
+	return true;
 }
 
 // CS_NAMESPACE_END
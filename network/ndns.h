@@ -69,6 +69,8 @@ protected:
 //! \endif
 
 private slots:
+	void dns_resultsReady();
+	void t_timeout();
 	void app_aboutToQuit();
 
 private:
@@ -80,7 +82,10 @@ private:
 	void resolve(NDns *self, const QString &name);
 	void stop(NDns *self);
 	bool isBusy(const NDns *self) const;
-	void tryDestroy();
+	void addToCache(const QString &name, const QHostAddress &addr, bool success);
+	Item *newItem(const QString &name);
+	void queueWorker(Item *);
+	void deliver(Item *);
 };
 
 // CS_NAMESPACE_END
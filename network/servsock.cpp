@@ -17,11 +17,93 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  *
  */
-
 #include"servsock.h"
 
+#include<qguardedptr.h>
+#include<qtimer.h>
+#include"reactor.h"
+#include"workerpool.h"
+
+#if defined(Q_OS_UNIX) && !defined(NO_BATCH_ACCEPT)
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+# endif
+# include<sys/types.h>
+# include<sys/socket.h>
+# include<netinet/in.h>
+# include<netinet/tcp.h>
+# include<unistd.h>
+# include<fcntl.h>
+# include<errno.h>
+# include<string.h>
+# define HAVE_BATCH_ACCEPT
+#endif
+
+// connections accepted per wakeup, before giving the rest of the event loop
+//   a turn
+#define ACCEPT_BATCH 64
+
+// how long the kernel may hold a connection that hasn't sent anything yet,
+//   with DeferAccept
+#define DEFER_ACCEPT_SECS 10
+
+// msecs to leave the accept queue alone when out of descriptors
+#define ACCEPT_BACKOFF_MSECS 100
+
 // CS_NAMESPACE_BEGIN
 
+#ifdef HAVE_BATCH_ACCEPT
+static int open_listener(Q_UINT16 port, int options)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd == -1)
+		return -1;
+
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if(options & ServSock::ReusePort) {
+#ifdef SO_REUSEPORT
+		if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+			::close(fd);
+			return -1;
+		}
+#else
+		::close(fd);
+		return -1;
+#endif
+	}
+#ifdef TCP_DEFER_ACCEPT
+	if(options & ServSock::DeferAccept) {
+		int secs = DEFER_ACCEPT_SECS;
+		setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &secs, sizeof(secs));
+	}
+#endif
+
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+	sa.sin_port = htons(port);
+	if(bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1 || ::listen(fd, SOMAXCONN) == -1) {
+		::close(fd);
+		return -1;
+	}
+
+	int flags = fcntl(fd, F_GETFL);
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	return fd;
+}
+
+static int accept_one(int fd)
+{
+#ifdef SOCK_CLOEXEC
+	return accept4(fd, 0, 0, SOCK_CLOEXEC);
+#else
+	return accept(fd, 0, 0);
+#endif
+}
+#endif
+
 //----------------------------------------------------------------------------
 // ServSock
 //----------------------------------------------------------------------------
@@ -31,6 +113,16 @@ public:
 	Private() {}
 
 	ServSockSignal *serv;
+	int fd;
+	SocketWatcher *sn;
+	QTimer backoff;
+	WorkerPool *pool;
+	int options;
+
+	// kept, since a worker may have no listening socket of its own
+	bool active;
+	int port;
+	QHostAddress addr;
 };
 
 ServSock::ServSock(QObject *parent)
@@ -38,6 +130,13 @@ ServSock::ServSock(QObject *parent)
 {
 	d = new Private;
 	d->serv = 0;
+	d->fd = -1;
+	d->sn = 0;
+	d->pool = 0;
+	d->options = 0;
+	connect(&d->backoff, SIGNAL(timeout()), SLOT(backoff_timeout()));
+	d->active = false;
+	d->port = -1;
 }
 
 ServSock::~ServSock()
@@ -46,49 +145,206 @@ ServSock::~ServSock()
 	delete d;
 }
 
+//!
+//! Sets \a options (a combination of ReusePort and DeferAccept), which take
+//! effect on the next listen().
+//!
+//! ReusePort sets SO_REUSEPORT on the socket, so that with a WorkerPool each
+//! worker can listen on the port itself, and the kernel spreads connections
+//! over them.  Otherwise the acceptor hands every connection over.  listen()
+//! fails if the system doesn't support it.
+//!
+//! DeferAccept (Linux only, ignored elsewhere) holds connections back in the
+//! kernel until the client has sent something, which suits protocols where
+//! the client speaks first, such as SOCKS and RTSP.
+void ServSock::setOptions(int options)
+{
+	d->options = options;
+}
+
+//!
+//! Returns the options set with setOptions().
+int ServSock::options() const
+{
+	return d->options;
+}
+
 bool ServSock::isActive() const
 {
-	return (d->serv ? true: false);
+	return d->active;
 }
 
 bool ServSock::listen(Q_UINT16 port)
 {
 	stop();
 
+	if(!openListener(port))
+		return false;
+	d->active = true;
+	return true;
+}
+
+void ServSock::stop()
+{
+	closeListener();
+	d->active = false;
+	d->port = -1;
+	d->addr = QHostAddress();
+}
+
+int ServSock::port() const
+{
+	return d->port;
+}
+
+QHostAddress ServSock::address() const
+{
+	return d->addr;
+}
+
+//!
+//! Shares incoming connections out over the workers of \a pool, which must
+//! have been started already.  In the acceptor, each connection is passed on
+//! to a worker, and only served here (through connectionReady()) when none
+//! can take it.  In a worker, the inherited listening socket is closed, and
+//! connectionReady() is emitted for the connections the acceptor hands over.
+//!
+//! With the ReusePort option, each worker opens a listening socket of its
+//! own instead, and the acceptor closes its one.
+void ServSock::setWorkerPool(WorkerPool *pool)
+{
+	if(d->pool)
+		disconnect(d->pool, SIGNAL(connectionReady(int)), this, SLOT(pool_connectionReady(int)));
+	d->pool = pool;
+	if(!d->pool || !d->active)
+		return;
+
+	bool own = (d->options & ReusePort) && d->fd != -1;
+	if(d->pool->isWorker()) {
+		int port = d->port;
+		QHostAddress addr = d->addr;
+		closeListener();
+		if(!own || !openListener(port)) {
+			d->port = port;
+			d->addr = addr;
+		}
+		connect(d->pool, SIGNAL(connectionReady(int)), SLOT(pool_connectionReady(int)));
+	}
+	else if(own && d->pool->count() > 0)
+		closeListener();
+}
+
+//!
+//! Returns the worker pool set with setWorkerPool(), if any.
+WorkerPool *ServSock::workerPool() const
+{
+	return d->pool;
+}
+
+bool ServSock::openListener(Q_UINT16 port)
+{
+#ifdef HAVE_BATCH_ACCEPT
+	d->fd = open_listener(port, d->options);
+	if(d->fd == -1)
+		return false;
+
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+	if(getsockname(d->fd, (struct sockaddr *)&sa, &len) == 0) {
+		d->port = ntohs(sa.sin_port);
+		d->addr = QHostAddress(ntohl(sa.sin_addr.s_addr));
+	}
+	d->sn = new SocketWatcher(d->fd, SocketWatcher::Read);
+	connect(d->sn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
+	return true;
+#else
+	// QServerSocket has no use for either option
+	if(d->options & ReusePort)
+		return false;
 	d->serv = new ServSockSignal(port);
 	if(!d->serv->ok()) {
 		delete d->serv;
 		d->serv = 0;
 		return false;
 	}
+	d->port = d->serv->port();
+	d->addr = d->serv->address();
 	connect(d->serv, SIGNAL(connectionReady(int)), SLOT(sss_connectionReady(int)));
-
 	return true;
+#endif
 }
 
-void ServSock::stop()
+void ServSock::closeListener()
 {
 	delete d->serv;
 	d->serv = 0;
+	d->backoff.stop();
+#ifdef HAVE_BATCH_ACCEPT
+	delete d->sn;
+	d->sn = 0;
+	if(d->fd != -1)
+		::close(d->fd);
+#endif
+	d->fd = -1;
 }
 
-int ServSock::port() const
+void ServSock::sn_activated(int)
 {
-	if(d->serv)
-		return d->serv->port();
-	else
-		return -1;
+#ifdef HAVE_BATCH_ACCEPT
+	// take whatever is waiting in the accept queue, rather than one
+	//   connection per trip through the event loop
+	QGuardedPtr<QObject> self = this;
+	for(int n = 0; n < ACCEPT_BATCH; ++n) {
+		if(d->fd == -1)
+			return;
+		int s = accept_one(d->fd);
+		if(s == -1) {
+			// a connection reset while in the queue is no reason to stop
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			// out of descriptors.  the queue stays as it is, so stop
+			//   watching it for a moment rather than spin (or, edge
+			//   triggered, never hear about it again)
+			if(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+				d->sn->setEnabled(false);
+				d->backoff.start(ACCEPT_BACKOFF_MSECS, true);
+			}
+			return;
+		}
+		sss_connectionReady(s);
+		if(!self)
+			return;
+	}
+
+	// more may be left, come back once everything else has had a turn
+	if(d->sn)
+		d->sn->retry();
+#endif
 }
 
-QHostAddress ServSock::address() const
+void ServSock::backoff_timeout()
 {
-	if(d->serv)
-		return d->serv->address();
-	else
-		return QHostAddress();
+	// whatever is queued came in while we weren't looking
+	if(d->sn) {
+		d->sn->setEnabled(true);
+		d->sn->retry();
+	}
 }
 
 void ServSock::sss_connectionReady(int s)
+{
+	if(d->pool) {
+		// a worker with a socket of its own only tells the acceptor
+		if(d->pool->isWorker())
+			d->pool->connectionAccepted();
+		else if(d->pool->dispatch(s))
+			return;
+	}
+	connectionReady(s);
+}
+
+void ServSock::pool_connectionReady(int s)
 {
 	connectionReady(s);
 }
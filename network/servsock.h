@@ -25,28 +25,43 @@
 
 // CS_NAMESPACE_BEGIN
 
+class WorkerPool;
+
 class ServSock : public QObject
 {
 	Q_OBJECT
 public:
+	enum Option { ReusePort = 0x01, DeferAccept = 0x02 };
 	ServSock(QObject *parent=0);
 	~ServSock();
 
+	void setOptions(int);
+	int options() const;
+
 	bool isActive() const;
 	bool listen(Q_UINT16 port);
 	void stop();
 	int port() const;
 	QHostAddress address() const;
 
+	void setWorkerPool(WorkerPool *);
+	WorkerPool *workerPool() const;
+
 signals:
 	void connectionReady(int);
 
 private slots:
 	void sss_connectionReady(int);
+	void pool_connectionReady(int);
+	void sn_activated(int);
+	void backoff_timeout();
 
 private:
 	class Private;
 	Private *d;
+
+	bool openListener(Q_UINT16 port);
+	void closeListener();
 };
 
 class ServSockSignal : public QServerSocket
@@ -24,13 +24,16 @@
 #include<qstringlist.h>
 #include<qptrlist.h>
 #include<qtimer.h>
+#include<qdatetime.h>
 #include<qguardedptr.h>
 #include<qsocketdevice.h>
-#include<qsocketnotifier.h>
 
 #ifdef Q_OS_UNIX
 #include<sys/types.h>
+#include<sys/socket.h>
+#include<sys/uio.h>
 #include<netinet/in.h>
+#include<string.h>
 #endif
 
 #ifdef Q_OS_WIN32
@@ -39,6 +42,9 @@
 
 #include"servsock.h"
 #include"bsocket.h"
+#include"reactor.h"
+#include"bufferpool.h"
+#include"workerpool.h"
 
 #ifdef PROX_DEBUG
 #include<stdio.h>
@@ -46,6 +52,247 @@
 
 // CS_NAMESPACE_BEGIN
 
+//----------------------------------------------------------------------------
+// SocksParser
+//----------------------------------------------------------------------------
+// read-only view of the bytes at the front of a stream, which may be spread
+//   over several segments
+class SpanView
+{
+public:
+	SpanView(const ByteSpanList &list) : spans(list)
+	{
+		total = 0;
+		for(ByteSpanList::ConstIterator it = spans.begin(); it != spans.end(); ++it)
+			total += (*it).size;
+		first = spans.isEmpty() ? 0 : spans.first().data;
+		firstSize = spans.isEmpty() ? 0 : spans.first().size;
+	}
+
+	SpanView(const char *data, int size)
+	{
+		ByteSpan span;
+		span.data = (char *)data;
+		span.size = size;
+		spans.append(span);
+		total = size;
+		first = span.data;
+		firstSize = size;
+	}
+
+	int size() const
+	{
+		return total;
+	}
+
+	unsigned char at(int i) const
+	{
+		if(i < firstSize)
+			return first[i];
+		for(ByteSpanList::ConstIterator it = spans.begin(); it != spans.end(); ++it) {
+			if(i < (*it).size)
+				return (*it).data[i];
+			i -= (*it).size;
+		}
+		return 0;
+	}
+
+	// returns a pointer to n bytes at i, which point into the stream when
+	//   they are contiguous, or into buf (at least n bytes) otherwise
+	const char *get(int i, int n, char *buf) const
+	{
+		if(i + n <= firstSize)
+			return first + i;
+		int at = 0;
+		for(ByteSpanList::ConstIterator it = spans.begin(); it != spans.end() && at < n; ++it) {
+			if(i >= (*it).size) {
+				i -= (*it).size;
+				continue;
+			}
+			int k = QMIN((*it).size - i, n - at);
+			memcpy(buf + at, (*it).data + i, k);
+			at += k;
+			i = 0;
+		}
+		return buf;
+	}
+
+private:
+	ByteSpanList spans;
+	int total;
+	const char *first;
+	int firstSize;
+};
+
+// Incremental parser for the messages of the SOCKS5 handshake.  The fields
+//   are read in place from the stream's buffer, and only the values end up
+//   copied.  The parser remembers how much of the message it needs to learn
+//   anything new (the fixed header first, then the variable part once its
+//   length is known), so a message arriving in pieces isn't rescanned until
+//   enough of it is there.
+class SocksParser
+{
+public:
+	enum Message { ClientVersion, ServerVersion, ClientAuth, ServerAuth, Request };
+
+	SocksParser()
+	{
+		reset(ClientVersion);
+	}
+
+	void reset(Message m)
+	{
+		msg = m;
+		need = 1;
+	}
+
+	// returns the length of the complete message at the front of v, which
+	//   the caller should then consume, 0 if more data is needed, or -1 if
+	//   the data is bad
+	int parse(const SpanView &v)
+	{
+		if(v.size() < need)
+			return 0;
+		bool done = false;
+		int n = measure(v, &done);
+		if(n == -1)
+			return -1;
+		need = n;
+		if(!done || v.size() < n)
+			return 0;
+		extract(v);
+		need = 1;
+		return n;
+	}
+
+	// ClientVersion: version, methods (as SocksClient::Method flags)
+	// ServerVersion: version, code (the method chosen)
+	// ClientAuth: version, user, pass
+	// ServerAuth: version, code (0 is success)
+	// Request: version, code (command or reply), address_type, host or
+	//   addr, port
+	unsigned char version, code;
+	int methods;
+	QString user, pass;
+	int address_type;
+	QString host;
+	QHostAddress addr;
+	Q_UINT16 port;
+
+private:
+	Message msg;
+	int need;
+
+	// length of the message, as far as it can be told from v
+	int measure(const SpanView &v, bool *done) const
+	{
+		int size = v.size();
+		switch(msg) {
+			case ClientVersion: {
+				if(v.at(0) != 0x05) // only SOCKS5 supported
+					return -1;
+				if(size < 2)
+					return 2;
+				int num = v.at(1);
+				if(num > 16) // who the heck has over 16 auth methods??
+					return -1;
+				*done = true;
+				return 2 + num;
+			}
+			case ServerVersion:
+			case ServerAuth:
+				*done = true;
+				return 2;
+			case ClientAuth: {
+				if(v.at(0) != 0x01)
+					return -1;
+				if(size < 2)
+					return 2;
+				int ulen = v.at(1);
+				if(size < ulen + 3)
+					return ulen + 3;
+				*done = true;
+				return ulen + v.at(ulen + 2) + 3;
+			}
+			case Request: {
+				if(size < 4)
+					return 4;
+				unsigned char atype = v.at(3);
+				*done = true;
+				if(atype == 0x01)
+					return 4 + 4 + 2;
+				if(atype == 0x04)
+					return 4 + 16 + 2;
+				if(atype != 0x03)
+					return -1; // can't tell where it ends
+				if(size < 5) {
+					*done = false;
+					return 5;
+				}
+				return 5 + v.at(4) + 2;
+			}
+		}
+		return -1;
+	}
+
+	void extract(const SpanView &v)
+	{
+		char buf[256];
+		version = v.at(0);
+		switch(msg) {
+			case ClientVersion: {
+				methods = 0;
+				int num = v.at(1);
+				for(int n = 0; n < num; ++n) {
+					unsigned char c = v.at(2 + n);
+					if(c == 0x00)
+						methods |= SocksClient::AuthNone;
+					else if(c == 0x02)
+						methods |= SocksClient::AuthUsername;
+				}
+				break;
+			}
+			case ServerVersion:
+			case ServerAuth:
+				code = v.at(1);
+				break;
+			case ClientAuth: {
+				int ulen = v.at(1);
+				int plen = v.at(ulen + 2);
+				user = QString::fromUtf8(v.get(2, ulen, buf), ulen);
+				pass = QString::fromUtf8(v.get(ulen + 3, plen, buf), plen);
+				break;
+			}
+			case Request: {
+				code = v.at(1);
+				address_type = v.at(3);
+				host = QString::null;
+				addr = QHostAddress();
+				int at = 4;
+				if(address_type == 0x01) {
+					Q_UINT32 ip4;
+					memcpy(&ip4, v.get(at, 4, buf), 4);
+					addr.setAddress(ntohl(ip4));
+					at += 4;
+				}
+				else if(address_type == 0x03) {
+					int host_len = v.at(at++);
+					host = QString::fromLatin1(v.get(at, host_len, buf), host_len);
+					at += host_len;
+				}
+				else {
+					Q_UINT8 a6[16];
+					memcpy(a6, v.get(at, 16, buf), 16);
+					addr.setAddress(a6);
+					at += 16;
+				}
+				port = (v.at(at) << 8) | v.at(at + 1);
+				break;
+			}
+		}
+	}
+};
+
 //----------------------------------------------------------------------------
 // SocksUDP
 //----------------------------------------------------------------------------
@@ -93,58 +340,24 @@ struct SPS_UDP
 	QByteArray data;
 };
 
-static int sp_read_udp(QByteArray *from, SPS_UDP *s)
+// the UDP header has the same layout as a request, with the fragment number
+//   in place of the command
+static int sp_read_udp(const char *data, int size, SPS_UDP *s)
 {
-	int full_len = 4;
-	if((int)from->size() < full_len)
-		return 0;
-
-	QString host;
-	QHostAddress addr;
-	unsigned char atype = from->at(3);
-
-	if(atype == 0x01) {
-		full_len += 4;
-		if((int)from->size() < full_len)
-			return 0;
-		Q_UINT32 ip4;
-		memcpy(&ip4, from->data() + 4, 4);
-		addr.setAddress(ntohl(ip4));
-		host = addr.toString();
-	}
-	else if(atype == 0x03) {
-		++full_len;
-		if((int)from->size() < full_len)
-			return 0;
-		unsigned char host_len = from->at(4);
-		full_len += host_len;
-		if((int)from->size() < full_len)
-			return 0;
-		QCString cs(host_len+1);
-		memcpy(cs.data(), from->data() + 5, host_len);
-		host = QString::fromLatin1(cs);
-	}
-	else if(atype == 0x04) {
-		full_len += 16;
-		if((int)from->size() < full_len)
-			return 0;
-		Q_UINT8 a6[16];
-		memcpy(a6, from->data() + 4, 16);
-		addr.setAddress(a6);
-		host = addr.toString();
-	}
-
-	full_len += 2;
-	if((int)from->size() < full_len)
+	SpanView v(data, size);
+	SocksParser p;
+	p.reset(SocksParser::Request);
+	int full_len = p.parse(v);
+	if(full_len <= 0)
 		return 0;
 
-	Q_UINT16 p;
-	memcpy(&p, from->data() + full_len - 2, 2);
-
-	s->host = host;
-	s->port = ntohs(p);
-	s->data.resize(from->size() - full_len);
-	memcpy(s->data.data(), from->data() + full_len, s->data.size());
+	if(p.address_type == 0x03)
+		s->host = p.host;
+	else
+		s->host = p.addr.toString();
+	s->port = p.port;
+	s->data = BufferPool::take(size - full_len);
+	memcpy(s->data.data(), data + full_len, s->data.size());
 
 	return 1;
 }
@@ -153,12 +366,15 @@ class SocksUDP::Private
 {
 public:
 	QSocketDevice *sd;
-	QSocketNotifier *sn;
+	SocketWatcher *sn;
 	SocksClient *sc;
 	QHostAddress routeAddr;
 	int routePort;
 	QString host;
 	int port;
+
+	// the header for every datagram, which only changes with change()
+	QByteArray header;
 };
 
 SocksUDP::SocksUDP(SocksClient *sc, const QString &host, int port, const QHostAddress &routeAddr, int routePort)
@@ -168,12 +384,13 @@ SocksUDP::SocksUDP(SocksClient *sc, const QString &host, int port, const QHostAd
 	d->sc = sc;
 	d->sd = new QSocketDevice(QSocketDevice::Datagram);
 	d->sd->setBlocking(false);
-	d->sn = new QSocketNotifier(d->sd->socket(), QSocketNotifier::Read);
+	d->sn = new SocketWatcher(d->sd->socket(), SocketWatcher::Read);
 	connect(d->sn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
 	d->host = host;
 	d->port = port;
 	d->routeAddr = routeAddr;
 	d->routePort = routePort;
+	d->header = sp_create_udp(host, port, QByteArray());
 }
 
 SocksUDP::~SocksUDP()
@@ -187,11 +404,39 @@ void SocksUDP::change(const QString &host, int port)
 {
 	d->host = host;
 	d->port = port;
+	d->header = sp_create_udp(host, port, QByteArray());
 }
 
 void SocksUDP::write(const QByteArray &data)
 {
-	QByteArray buf = sp_create_udp(d->host, d->port, data);
+#ifdef Q_OS_UNIX
+	// send the header and the data as one datagram, without joining them
+	if(d->routeAddr.isIp4Addr()) {
+		struct sockaddr_in sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sin_family = AF_INET;
+		sa.sin_addr.s_addr = htonl(d->routeAddr.ip4Addr());
+		sa.sin_port = htons(d->routePort);
+
+		struct iovec iov[2];
+		iov[0].iov_base = d->header.data();
+		iov[0].iov_len = d->header.size();
+		iov[1].iov_base = (char *)data.data();
+		iov[1].iov_len = data.size();
+
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &sa;
+		msg.msg_namelen = sizeof(sa);
+		msg.msg_iov = iov;
+		msg.msg_iovlen = 2;
+		::sendmsg(d->sd->socket(), &msg, 0);
+		return;
+	}
+#endif
+	QByteArray buf(d->header.size() + data.size());
+	memcpy(buf.data(), d->header.data(), d->header.size());
+	memcpy(buf.data() + d->header.size(), data.data(), data.size());
 	d->sd->setBlocking(true);
 	d->sd->writeBlock(buf.data(), buf.size(), d->routeAddr, d->routePort);
 	d->sd->setBlocking(false);
@@ -199,10 +444,23 @@ void SocksUDP::write(const QByteArray &data)
 
 void SocksUDP::sn_activated(int)
 {
-	QByteArray buf(8192);
-	int actual = d->sd->readBlock(buf.data(), buf.size());
-	buf.resize(actual);
-	packetReady(buf);
+	// drain the socket, the watcher may be edge-triggered
+	//   (datagrams are read into one scratch buffer and copied out at their
+	//   real size, rather than allocating 8k for each)
+	QGuardedPtr<QObject> self = this;
+	QByteArray scratch = BufferPool::take(8192);
+	while(1) {
+		int actual = d->sd->readBlock(scratch.data(), scratch.size());
+		if(actual < 0)
+			break;
+		QByteArray buf = BufferPool::take(actual);
+		memcpy(buf.data(), scratch.data(), actual);
+		packetReady(buf);
+		BufferPool::give(buf);
+		if(!self)
+			break;
+	}
+	BufferPool::give(scratch);
 }
 
 //----------------------------------------------------------------------------
@@ -222,13 +480,21 @@ void SocksUDP::sn_activated(int)
 // SPSS = socks packet server struct
 
 // Version
-static QByteArray spc_set_version()
+static QByteArray spc_set_version(int methods)
 {
-	QByteArray ver(4);
-	ver[0] = 0x05; // socks version 5
-	ver[1] = 0x02; // number of methods
-	ver[2] = 0x00; // no-auth
-	ver[3] = 0x02; // username
+	QByteArray ver(2);
+	int at = 0;
+	ver[at++] = 0x05; // socks version 5
+	ver[at++] = 0x00; // number of methods
+	if(methods & SocksClient::AuthNone) {
+		ver.resize(at+1);
+		ver[at++] = 0x00; // no-auth
+	}
+	if(methods & SocksClient::AuthUsername) {
+		ver.resize(at+1);
+		ver[at++] = 0x02; // username
+	}
+	ver[1] = at - 2;
 	return ver;
 }
 
@@ -240,48 +506,6 @@ static QByteArray sps_set_version(int method)
 	return ver;
 }
 
-struct SPCS_VERSION
-{
-	unsigned char version;
-	QByteArray methodList;
-};
-
-static int spc_get_version(QByteArray *from, SPCS_VERSION *s)
-{
-	if(from->size() < 1)
-		return 0;
-	if(from->at(0) != 0x05) // only SOCKS5 supported
-		return -1;
-	if(from->size() < 2)
-		return 0;
-	uint num = from->at(1);
-	if(num > 16) // who the heck has over 16 auth methods??
-		return -1;
-	if(from->size() < 2 + num)
-		return 0;
-	QByteArray a = ByteStream::takeArray(from, 2+num);
-	s->version = a[0];
-	s->methodList.resize(num);
-	memcpy(s->methodList.data(), a.data() + 2, num);
-	return 1;
-}
-
-struct SPSS_VERSION
-{
-	unsigned char version;
-	unsigned char method;
-};
-
-static int sps_get_version(QByteArray *from, SPSS_VERSION *s)
-{
-	if(from->size() < 2)
-		return 0;
-	QByteArray a = ByteStream::takeArray(from, 2);
-	s->version = a[0];
-	s->method = a[1];
-	return 1;
-}
-
 // authUsername
 static QByteArray spc_set_authUsername(const QCString &user, const QCString &pass)
 {
@@ -308,54 +532,6 @@ static QByteArray sps_set_authUsername(bool success)
 	return a;
 }
 
-struct SPCS_AUTHUSERNAME
-{
-	QString user, pass;
-};
-
-static int spc_get_authUsername(QByteArray *from, SPCS_AUTHUSERNAME *s)
-{
-	if(from->size() < 1)
-		return 0;
-	unsigned char ver = from->at(0);
-	if(ver != 0x01)
-		return -1;
-	if(from->size() < 2)
-		return 0;
-	unsigned char ulen = from->at(1);
-	if((int)from->size() < ulen + 3)
-		return 0;
-	unsigned char plen = from->at(ulen+2);
-	if((int)from->size() < ulen + plen + 3)
-		return 0;
-	QByteArray a = ByteStream::takeArray(from, ulen + plen + 3);
-
-	QCString user, pass;
-	user.resize(ulen+1);
-	pass.resize(plen+1);
-	memcpy(user.data(), a.data()+2, ulen);
-	memcpy(pass.data(), a.data()+ulen+3, plen);
-	s->user = QString::fromUtf8(user);
-	s->pass = QString::fromUtf8(pass);
-	return 1;
-}
-
-struct SPSS_AUTHUSERNAME
-{
-	unsigned char version;
-	bool success;
-};
-
-static int sps_get_authUsername(QByteArray *from, SPSS_AUTHUSERNAME *s)
-{
-	if(from->size() < 2)
-		return 0;
-	QByteArray a = ByteStream::takeArray(from, 2);
-	s->version = a[0];
-	s->success = a[1] == 0 ? true: false;
-	return 1;
-}
-
 // connectRequest
 static QByteArray sp_set_request(const QHostAddress &addr, unsigned short port, unsigned char cmd1)
 {
@@ -429,81 +605,69 @@ static QByteArray sp_set_request(const QString &host, Q_UINT16 port, unsigned ch
 	return a;
 }
 
-struct SPS_CONNREQ
-{
-	unsigned char version;
-	unsigned char cmd;
-	int address_type;
-	QString host;
-	QHostAddress addr;
-	Q_UINT16 port;
-};
-
-static int sp_get_request(QByteArray *from, SPS_CONNREQ *s)
-{
-	int full_len = 4;
-	if((int)from->size() < full_len)
-		return 0;
-
-	QString host;
-	QHostAddress addr;
-	unsigned char atype = from->at(3);
-
-	if(atype == 0x01) {
-		full_len += 4;
-		if((int)from->size() < full_len)
-			return 0;
-		Q_UINT32 ip4;
-		memcpy(&ip4, from->data() + 4, 4);
-		addr.setAddress(ntohl(ip4));
-	}
-	else if(atype == 0x03) {
-		++full_len;
-		if((int)from->size() < full_len)
-			return 0;
-		unsigned char host_len = from->at(4);
-		full_len += host_len;
-		if((int)from->size() < full_len)
-			return 0;
-		QCString cs(host_len+1);
-		memcpy(cs.data(), from->data() + 5, host_len);
-		host = QString::fromLatin1(cs);
-	}
-	else if(atype == 0x04) {
-		full_len += 16;
-		if((int)from->size() < full_len)
-			return 0;
-		Q_UINT8 a6[16];
-		memcpy(a6, from->data() + 4, 16);
-		addr.setAddress(a6);
-	}
-
-	full_len += 2;
-	if((int)from->size() < full_len)
-		return 0;
+enum { StepVersion, StepAuth, StepRequest };
 
-	QByteArray a = ByteStream::takeArray(from, full_len);
+// proxies that didn't take a pipelined handshake, as "host:port"
+static QStringList *sequential_proxies = 0;
 
-	Q_UINT16 p;
-	memcpy(&p, a.data() + full_len - 2, 2);
+static QString proxy_key(const QString &host, int port)
+{
+	return host + ':' + QString::number(port);
+}
 
-	s->version = a[0];
-	s->cmd = a[1];
-	s->address_type = atype;
-	s->host = host;
-	s->addr = addr;
-	s->port = ntohs(p);
+static bool proxy_is_sequential(const QString &host, int port)
+{
+	return (sequential_proxies && sequential_proxies->contains(proxy_key(host, port)));
+}
 
-	return 1;
+static void proxy_set_sequential(const QString &host, int port)
+{
+	if(!sequential_proxies)
+		sequential_proxies = new QStringList;
+	if(!sequential_proxies->contains(proxy_key(host, port)))
+		sequential_proxies->append(proxy_key(host, port));
 }
 
-enum { StepVersion, StepAuth, StepRequest };
+// parses the next handshake message in place, from the front of what sock
+//   has read, and removes it from there once it is complete
+static int sp_next(BSocket *sock, SocksParser *parser, const char *who)
+{
+	ByteSpanList spans;
+	sock->peek(&spans);
+	SpanView v(spans);
+	int r = parser->parse(v);
+	if(r <= 0)
+		return r;
+#ifdef PROX_DEBUG
+	// show hex
+	fprintf(stderr, "SocksClient: %s recv { ", who);
+	for(int n = 0; n < r; ++n)
+		fprintf(stderr, "%02X ", v.at(n));
+	fprintf(stderr, " } \n");
+#else
+	Q_UNUSED(who);
+#endif
+	sock->consume(r);
+	return r;
+}
 
 class SocksClient::Private
 {
 public:
 	Private() {}
 
+	// the message expected next depends on the step and the direction
+	void setStep(int s)
+	{
+		step = s;
+		if(s == StepVersion)
+			parser.reset(incoming ? SocksParser::ClientVersion : SocksParser::ServerVersion);
+		else if(s == StepAuth)
+			parser.reset(incoming ? SocksParser::ClientAuth : SocksParser::ServerAuth);
+		else
+			parser.reset(SocksParser::Request);
+	}
+
 	BSocket sock;
 	QString host;
 	int port;
@@ -511,7 +675,7 @@ public:
 	QString real_host;
 	int real_port;
 
-	QByteArray recvBuf;
+	SocksParser parser;
 	bool active;
 	int step;
 	int authMethod;
@@ -522,6 +686,10 @@ public:
 
 	int pending;
 
+	// pipelined handshake, or one starting on a connection from a SocksPool
+	bool pipelined, pipelining, flightSent, pooled;
+	QValueList<QByteArray> early;
+
 	bool udp;
 	QString udpAddr;
 	int udpPort;
@@ -548,6 +716,7 @@ SocksClient::SocksClient(int s, QObject *parent)
 void SocksClient::init()
 {
 	d = new Private;
+	d->pipelined = false;
 	connect(&d->sock, SIGNAL(connected()), SLOT(sock_connected()));
 	connect(&d->sock, SIGNAL(connectionClosed()), SLOT(sock_connectionClosed()));
 	connect(&d->sock, SIGNAL(delayedCloseFinished()), SLOT(sock_delayedCloseFinished()));
@@ -570,11 +739,14 @@ void SocksClient::reset(bool clear)
 		d->sock.close();
 	if(clear)
 		clearReadBuffer();
-	d->recvBuf.resize(0);
 	d->active = false;
 	d->waiting = false;
 	d->udp = false;
 	d->pending = 0;
+	d->pipelining = false;
+	d->flightSent = false;
+	d->pooled = false;
+	d->early.clear();
 }
 
 bool SocksClient::isIncoming() const
@@ -588,6 +760,22 @@ void SocksClient::setAuth(const QString &user, const QString &pass)
 	d->pass = pass;
 }
 
+//!
+//! Enables or disables the pipelined handshake for outgoing connections.
+//! When enabled, the greeting (offering only the method that will be used),
+//! the username authentication and the request all go out at once, saving
+//! two round trips, and the replies are checked in order as they arrive.
+//! Anything written before connected() is sent right behind the request,
+//! and reported through bytesWritten() once the proxy has accepted it.
+//!
+//! Only enable this for proxies known to handle it.  If the proxy fails the
+//! handshake or closes the connection, the client connects again and goes
+//! one step at a time, and keeps doing so for that proxy from then on.
+void SocksClient::setPipelined(bool b)
+{
+	d->pipelined = b;
+}
+
 void SocksClient::connectToHost(const QString &proxyHost, int proxyPort, const QString &host, int port, bool udpMode)
 {
 	reset(true);
@@ -608,6 +796,40 @@ void SocksClient::connectToHost(const QString &proxyHost, int proxyPort, const Q
 	d->sock.connectToHost(d->host, d->port);
 }
 
+//!
+//! Connects to \a host port \a port through the proxy of \a pool.  If the
+//! pool has a connection ready, which has already been through method
+//! negotiation and authentication, only the request is left to send.
+//! Otherwise this is the same as connecting to the pool's proxy directly.
+void SocksClient::connectToHost(SocksPool *pool, const QString &host, int port, bool udpMode)
+{
+	setAuth(pool->user(), pool->pass());
+	int fd = pool->take();
+	if(fd == -1) {
+		connectToHost(pool->proxyHost(), pool->proxyPort(), host, port, udpMode);
+		return;
+	}
+
+	reset(true);
+	d->host = pool->proxyHost();
+	d->port = pool->proxyPort();
+	d->real_host = host;
+	d->real_port = port;
+	d->udp = udpMode;
+	d->pooled = true;
+
+#ifdef PROX_DEBUG
+	fprintf(stderr, "SocksClient: Using pooled connection to %s:%d\n", d->host.latin1(), d->port);
+#endif
+	d->sock.setSocket(fd);
+	do_request();
+	if(d->pipelined) {
+		for(QValueList<QByteArray>::ConstIterator it = d->early.begin(); it != d->early.end(); ++it)
+			writeData(*it);
+		d->flightSent = true;
+	}
+}
+
 bool SocksClient::isOpen() const
 {
 	return d->active;
@@ -628,8 +850,30 @@ void SocksClient::writeData(const QByteArray &buf)
 
 void SocksClient::write(const QByteArray &buf)
 {
-	if(d->active && !d->udp)
+	if(d->active && !d->udp) {
 		d->sock.write(buf);
+		recordWrite(buf.size());
+	}
+	else if(!d->active && d->pipelined && !d->udp && !d->incoming && !buf.isEmpty()) {
+		// kept until the handshake is through, in case it has to be redone
+		d->early += buf.copy();
+		if(d->flightSent)
+			writeData(buf);
+		recordWrite(buf.size());
+	}
+}
+
+void SocksClient::writev(const QValueList<QByteArray> &list)
+{
+	if(d->active && !d->udp) {
+		d->sock.writev(list);
+		for(QValueList<QByteArray>::ConstIterator it = list.begin(); it != list.end(); ++it)
+			recordWrite((*it).size());
+	}
+	else if(!d->active && d->pipelined && !d->udp && !d->incoming) {
+		for(QValueList<QByteArray>::ConstIterator it = list.begin(); it != list.end(); ++it)
+			write(*it);
+	}
 }
 
 QByteArray SocksClient::read(int bytes)
@@ -642,6 +886,23 @@ int SocksClient::bytesAvailable() const
 	return ByteStream::bytesAvailable();
 }
 
+bool SocksClient::isDetachable() const
+{
+	if(!d->active || d->udp || ByteStream::bytesAvailable() > 0)
+		return false;
+	return d->sock.isDetachable();
+}
+
+int SocksClient::detachSocket()
+{
+	if(!isDetachable())
+		return -1;
+	int fd = d->sock.detachSocket();
+	if(fd != -1)
+		reset(true);
+	return fd;
+}
+
 int SocksClient::bytesToWrite() const
 {
 	if(d->active)
@@ -656,8 +917,29 @@ void SocksClient::sock_connected()
 	fprintf(stderr, "SocksClient: Connected\n");
 #endif
 
-	d->step = StepVersion;
-	writeData(spc_set_version());
+	d->setStep(StepVersion);
+	if(!d->pipelined || proxy_is_sequential(d->host, d->port)) {
+		writeData(spc_set_version(AuthNone | AuthUsername));
+		return;
+	}
+
+	// offer just the one method, so that everything after it can be sent
+	//   without waiting for the choice
+	d->pipelining = true;
+	d->authMethod = d->user.isEmpty() ? AuthNone : AuthUsername;
+#ifdef PROX_DEBUG
+	fprintf(stderr, "SocksClient: Sending pipelined handshake\n");
+#endif
+	writeData(spc_set_version(d->authMethod));
+	if(d->authMethod == AuthUsername)
+		writeData(spc_set_authUsername(d->user.latin1(), d->pass.latin1()));
+	do_request();
+	for(QValueList<QByteArray>::ConstIterator it = d->early.begin(); it != d->early.end(); ++it)
+		writeData(*it);
+	d->flightSent = true;
+
+	// the replies are still checked one by one
+	d->setStep(StepVersion);
 }
 
 void SocksClient::sock_connectionClosed()
@@ -667,6 +949,8 @@ void SocksClient::sock_connectionClosed()
 		connectionClosed();
 	}
 	else {
+		if(fallBack())
+			return;
 		error(ErrProxyNeg);
 	}
 }
@@ -679,65 +963,83 @@ void SocksClient::sock_delayedCloseFinished()
 	}
 }
 
+void SocksClient::setReadEnabled(bool b)
+{
+	// while we stop taking from the socket, it fills up to the same limit
+	//   and then stops reading too
+	d->sock.setReadLimit(readLimit());
+	if(b && d->active && !d->udp && d->sock.bytesAvailable() > 0)
+		QTimer::singleShot(0, this, SLOT(sock_readyRead()));
+}
+
 void SocksClient::sock_readyRead()
 {
-	QByteArray block = d->sock.read();
+	if(d->active && !d->udp && isReadPaused())
+		return;
 
+	// the handshake is parsed where it lies, in the socket's buffer
 	if(!d->active) {
-		if(d->incoming)
-			processIncoming(block);
-		else
-			processOutgoing(block);
+		if(!d->incoming)
+			processOutgoing();
+		else if(!d->waiting)
+			continueIncoming();
+		return;
 	}
-	else {
-		if(!d->udp) {
-			appendRead(block);
-			readyRead();
-		}
+
+	QByteArray block = d->sock.read();
+	if(!d->udp && !block.isEmpty()) {
+		appendRead(block);
+		readyRead();
 	}
 }
 
-void SocksClient::processOutgoing(const QByteArray &block)
+void SocksClient::processOutgoing()
 {
-#ifdef PROX_DEBUG
-	// show hex
-	fprintf(stderr, "SocksClient: client recv { ");
-	for(int n = 0; n < (int)block.size(); ++n)
-		fprintf(stderr, "%02X ", (unsigned char)block[n]);
-	fprintf(stderr, " } \n");
-#endif
-	ByteStream::appendArray(&d->recvBuf, block);
-
-	if(d->step == StepVersion) {
-		SPSS_VERSION s;
-		int r = sps_get_version(&d->recvBuf, &s);
+	// there may be more than one reply waiting
+	while(!d->active) {
+		int r = sp_next(&d->sock, &d->parser, "client");
 		if(r == -1) {
+			if(fallBack())
+				return;
 			reset(true);
 			error(ErrProxyNeg);
 			return;
 		}
-		else if(r == 1) {
-			if(s.version != 0x05 || s.method == 0xff) {
+		if(r == 0)
+			return;
+
+		SocksParser &s = d->parser;
+		if(d->step == StepVersion) {
+			if(s.version != 0x05 || s.code == 0xff) {
 #ifdef PROX_DEBUG
 				fprintf(stderr, "SocksClient: Method selection failed\n");
 #endif
+				if(fallBack())
+					return;
 				reset(true);
 				error(ErrProxyNeg);
 				return;
 			}
 
-			QString str;
-			if(s.method == 0x00) {
-				str = "None";
+			if(d->pipelining) {
+				// it has to be the one offered, the rest is already sent
+				if(s.code != (d->authMethod == AuthUsername ? 0x02 : 0x00)) {
+					fallBack();
+					return;
+				}
+				d->setStep(d->authMethod == AuthUsername ? StepAuth : StepRequest);
+				continue;
+			}
+
+			if(s.code == 0x00) {
 				d->authMethod = AuthNone;
 			}
-			else if(s.method == 0x02) {
-				str = "Username/Password";
+			else if(s.code == 0x02) {
 				d->authMethod = AuthUsername;
 			}
 			else {
 #ifdef PROX_DEBUG
-				fprintf(stderr, "SocksClient: Server wants to use unknown method '%02x'\n", s.method);
+				fprintf(stderr, "SocksClient: Server wants to use unknown method '%02x'\n", s.code);
 #endif
 				reset(true);
 				error(ErrProxyNeg);
@@ -749,56 +1051,40 @@ void SocksClient::processOutgoing(const QByteArray &block)
 				do_request();
 			}
 			else if(d->authMethod == AuthUsername) {
-				d->step = StepAuth;
+				d->setStep(StepAuth);
 #ifdef PROX_DEBUG
 				fprintf(stderr, "SocksClient: Authenticating [Username] ...\n");
 #endif
 				writeData(spc_set_authUsername(d->user.latin1(), d->pass.latin1()));
 			}
 		}
-	}
-	if(d->step == StepAuth) {
-		if(d->authMethod == AuthUsername) {
-			SPSS_AUTHUSERNAME s;
-			int r = sps_get_authUsername(&d->recvBuf, &s);
-			if(r == -1) {
+		else if(d->step == StepAuth) {
+			if(s.version != 0x01) {
 				reset(true);
 				error(ErrProxyNeg);
 				return;
 			}
-			else if(r == 1) {
-				if(s.version != 0x01) {
-					reset(true);
-					error(ErrProxyNeg);
-					return;
-				}
-				if(!s.success) {
-					reset(true);
-					error(ErrProxyAuth);
-					return;
-				}
+			if(s.code != 0x00) {
+				reset(true);
+				error(ErrProxyAuth);
+				return;
+			}
 
+			if(d->pipelining)
+				d->setStep(StepRequest);
+			else
 				do_request();
-			}
-		}
-	}
-	else if(d->step == StepRequest) {
-		SPS_CONNREQ s;
-		int r = sp_get_request(&d->recvBuf, &s);
-		if(r == -1) {
-			reset(true);
-			error(ErrProxyNeg);
-			return;
 		}
-		else if(r == 1) {
-			if(s.cmd != RET_SUCCESS) {
+		else if(d->step == StepRequest) {
+			if(s.code != RET_SUCCESS) {
 #ifdef PROX_DEBUG
-				fprintf(stderr, "SocksClient: client << Error >> [%02x]\n", s.cmd);
+				fprintf(stderr, "SocksClient: client << Error >> [%02x]\n", s.code);
 #endif
+				int x = s.code;
 				reset(true);
-				if(s.cmd == RET_UNREACHABLE)
+				if(x == RET_UNREACHABLE)
 					error(ErrHostNotFound);
-				else if(s.cmd == RET_CONNREFUSED)
+				else if(x == RET_CONNREFUSED)
 					error(ErrConnectionRefused);
 				else
 					error(ErrProxyNeg);
@@ -817,27 +1103,66 @@ void SocksClient::processOutgoing(const QByteArray &block)
 			}
 
 			d->active = true;
+			int sent = flushEarly();
 
 			QGuardedPtr<QObject> self = this;
 			connected();
 			if(!self)
 				return;
-
-			if(!d->recvBuf.isEmpty()) {
-				appendRead(d->recvBuf);
-				d->recvBuf.resize(0);
-				readyRead();
+			if(sent > 0) {
+				checkWriteLimit();
+				bytesWritten(sent);
+				if(!self)
+					return;
 			}
+
+			flushHandshake();
 		}
 	}
 }
 
+// sends what was written before the handshake was through, unless it went
+//   out with the pipelined handshake already, in which case the number of
+//   bytes is returned so that they can be reported as written
+int SocksClient::flushEarly()
+{
+	int sent = 0;
+	if(d->flightSent) {
+		for(QValueList<QByteArray>::ConstIterator it = d->early.begin(); it != d->early.end(); ++it)
+			sent += (*it).size();
+	}
+	else if(!d->early.isEmpty())
+		d->sock.writev(d->early);
+	d->early.clear();
+	return sent;
+}
+
+// a pipelined handshake went wrong (remember that this proxy can't take one),
+//   or a pooled connection turned out to be dead: start over one step at a
+//   time on a new connection
+bool SocksClient::fallBack()
+{
+	if(!d->pipelining && !d->pooled)
+		return false;
+#ifdef PROX_DEBUG
+	fprintf(stderr, "SocksClient: %s failed, trying again step by step\n", d->pipelining ? "pipelined handshake" : "pooled connection");
+#endif
+	if(d->pipelining)
+		proxy_set_sequential(d->host, d->port);
+	d->pipelining = false;
+	d->pooled = false;
+	d->flightSent = false;
+	d->pending = 0;
+	d->sock.connectToHost(d->host, d->port);
+	return true;
+}
+
 void SocksClient::do_request()
 {
 #ifdef PROX_DEBUG
 	fprintf(stderr, "SocksClient: Requesting ...\n");
 #endif
-	d->step = StepRequest;
+	d->setStep(StepRequest);
 	int cmd = d->udp ? REQ_UDPASSOCIATE : REQ_CONNECT;
 	QByteArray buf;
 	if(!d->real_host.isEmpty())
@@ -858,8 +1183,10 @@ void SocksClient::sock_bytesWritten(int x)
 		bytes -= d->pending;
 		d->pending = 0;
 	}
-	if(bytes > 0)
+	if(bytes > 0) {
+		checkWriteLimit();
 		bytesWritten(bytes);
+	}
 }
 
 void SocksClient::sock_error(int x)
@@ -869,6 +1196,8 @@ void SocksClient::sock_error(int x)
 		error(ErrRead);
 	}
 	else {
+		if(x == BSocket::ErrRead && fallBack())
+			return;
 		reset(true);
 		if(x == BSocket::ErrHostNotFound)
 			error(ErrProxyConnect);
@@ -882,95 +1211,49 @@ void SocksClient::sock_error(int x)
 void SocksClient::serve()
 {
 	d->waiting = false;
-	d->step = StepVersion;
+	d->setStep(StepVersion);
 	continueIncoming();
 }
 
-void SocksClient::processIncoming(const QByteArray &block)
-{
-#ifdef PROX_DEBUG
-	// show hex
-	fprintf(stderr, "SocksClient: server recv { ");
-	for(int n = 0; n < (int)block.size(); ++n)
-		fprintf(stderr, "%02X ", (unsigned char)block[n]);
-	fprintf(stderr, " } \n");
-#endif
-	ByteStream::appendArray(&d->recvBuf, block);
-
-	if(!d->waiting)
-		continueIncoming();
-}
-
 void SocksClient::continueIncoming()
 {
-	if(d->recvBuf.isEmpty())
+	int r = sp_next(&d->sock, &d->parser, "server");
+	if(r == -1) {
+		reset(true);
+		error(ErrProxyNeg);
+		return;
+	}
+	if(r == 0)
 		return;
 
+	SocksParser &s = d->parser;
 	if(d->step == StepVersion) {
-		SPCS_VERSION s;
-		int r = spc_get_version(&d->recvBuf, &s);
-		if(r == -1) {
-			reset(true);
-			error(ErrProxyNeg);
-			return;
-		}
-		else if(r == 1) {
-			if(s.version != 0x05) {
-				reset(true);
-				error(ErrProxyNeg);
-				return;
-			}
-
-			int methods = 0;
-			for(int n = 0; n < (int)s.methodList.size(); ++n) {
-				unsigned char c = s.methodList[n];
-				if(c == 0x00)
-					methods |= AuthNone;
-				else if(c == 0x02)
-					methods |= AuthUsername;
-			}
-			d->waiting = true;
-			incomingMethods(methods);
-		}
+		d->waiting = true;
+		incomingMethods(s.methods);
 	}
 	else if(d->step == StepAuth) {
-		SPCS_AUTHUSERNAME s;
-		int r = spc_get_authUsername(&d->recvBuf, &s);
-		if(r == -1) {
-			reset(true);
-			error(ErrProxyNeg);
-			return;
-		}
-		else if(r == 1) {
-			d->waiting = true;
-			incomingAuth(s.user, s.pass);
-		}
+		// the parser is reused by the next message, so don't hand it out
+		QString user = s.user;
+		QString pass = s.pass;
+		d->waiting = true;
+		incomingAuth(user, pass);
 	}
 	else if(d->step == StepRequest) {
-		SPS_CONNREQ s;
-		int r = sp_get_request(&d->recvBuf, &s);
-		if(r == -1) {
-			reset(true);
-			error(ErrProxyNeg);
-			return;
+		d->waiting = true;
+		if(s.code == REQ_CONNECT) {
+			if(!s.host.isEmpty())
+				d->rhost = s.host;
+			else
+				d->rhost = s.addr.toString();
+			d->rport = s.port;
+			incomingConnectRequest(d->rhost, d->rport);
 		}
-		else if(r == 1) {
-			d->waiting = true;
-			if(s.cmd == REQ_CONNECT) {
-				if(!s.host.isEmpty())
-					d->rhost = s.host;
-				else
-					d->rhost = s.addr.toString();
-				d->rport = s.port;
-				incomingConnectRequest(d->rhost, d->rport);
-			}
-			else if(s.cmd == REQ_UDPASSOCIATE) {
-				incomingUDPAssociateRequest();
-			}
-			else {
-				requestDeny();
-				return;
-			}
+		else if(s.code == REQ_UDPASSOCIATE) {
+			incomingUDPAssociateRequest();
+		}
+		else {
+			requestDeny();
+			return;
 		}
 	}
 }
@@ -982,11 +1265,11 @@ void SocksClient::chooseMethod(int method)
 
 	unsigned char c;
 	if(method == AuthNone) {
-		d->step = StepRequest;
+		d->setStep(StepRequest);
 		c = 0x00;
 	}
 	else {
-		d->step = StepAuth;
+		d->setStep(StepAuth);
 		c = 0x02;
 	}
 
@@ -1002,7 +1285,7 @@ void SocksClient::authGrant(bool b)
 		return;
 
 	if(b)
-		d->step = StepRequest;
+		d->setStep(StepRequest);
 
 	// auth response
 	d->waiting = false;
@@ -1038,11 +1321,7 @@ void SocksClient::grantConnect()
 	fprintf(stderr, "SocksClient: server << Success >>\n");
 #endif
 
-	if(!d->recvBuf.isEmpty()) {
-		appendRead(d->recvBuf);
-		d->recvBuf.resize(0);
-		readyRead();
-	}
+	flushHandshake();
 }
 
 void SocksClient::grantUDPAssociate(const QString &relayHost, int relayPort)
@@ -1059,8 +1338,15 @@ void SocksClient::grantUDPAssociate(const QString &relayHost, int relayPort)
 	fprintf(stderr, "SocksClient: server << Success >>\n");
 #endif
 
-	if(!d->recvBuf.isEmpty())
-		d->recvBuf.resize(0);
+	// anything sent after the request is dropped, as in UDP mode
+	flushHandshake();
+}
+
+void SocksClient::flushHandshake()
+{
+	// data that came in right behind the handshake is still in the socket
+	if(d->sock.bytesAvailable() > 0)
+		sock_readyRead();
 }
 
 QHostAddress SocksClient::peerAddress() const
@@ -1073,6 +1359,11 @@ Q_UINT16 SocksClient::peerPort() const
 	return d->sock.peerPort();
 }
 
+QHostAddress SocksClient::address() const
+{
+	return d->sock.address();
+}
+
 QString SocksClient::udpAddress() const
 {
 	return d->udpAddr;
@@ -1099,7 +1390,7 @@ public:
 	ServSock serv;
 	QPtrList<SocksClient> incomingConns;
 	QSocketDevice *sd;
-	QSocketNotifier *sn;
+	SocketWatcher *sn;
 };
 
 SocksServer::SocksServer(QObject *parent)
@@ -1138,7 +1429,7 @@ bool SocksServer::listen(Q_UINT16 port, bool udp)
 			d->serv.stop();
 			return false;
 		}
-		d->sn = new QSocketNotifier(d->sd->socket(), QSocketNotifier::Read);
+		d->sn = new SocketWatcher(d->sd->socket(), SocketWatcher::Read);
 		connect(d->sn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
 	}
 	return true;
@@ -1180,6 +1471,29 @@ SocksClient *SocksServer::takeIncoming()
 	return c;
 }
 
+//!
+//! Sets the options of the listening socket (see ServSock::setOptions()).
+//! Call before listen().
+void SocksServer::setListenOptions(int options)
+{
+	d->serv.setOptions(options);
+}
+
+//!
+//! Spreads incoming connections over the workers of \a pool (see
+//! ServSock::setWorkerPool()).  The UDP socket, if any, is kept by the
+//! acceptor only.
+void SocksServer::setWorkerPool(WorkerPool *pool)
+{
+	d->serv.setWorkerPool(pool);
+	if(pool && pool->isWorker()) {
+		delete d->sn;
+		d->sn = 0;
+		delete d->sd;
+		d->sd = 0;
+	}
+}
+
 void SocksServer::writeUDP(const QHostAddress &addr, int port, const QByteArray &data)
 {
 	if(d->sd) {
@@ -1202,20 +1516,389 @@ void SocksServer::connectionError()
 	SocksClient *c = (SocksClient *)sender();
 	d->incomingConns.removeRef(c);
 	c->deleteLater();
+
+	// never made it to the application, so account for it here
+	if(d->serv.workerPool())
+		d->serv.workerPool()->connectionFinished();
 }
 
 void SocksServer::sn_activated(int)
 {
-	QByteArray buf(8192);
-	int actual = d->sd->readBlock(buf.data(), buf.size());
-	buf.resize(actual);
-	QHostAddress pa = d->sd->peerAddress();
-	int pp = d->sd->peerPort();
-	SPS_UDP s;
-	int r = sp_read_udp(&buf, &s);
-	if(r != 1)
+	// drain the socket, the watcher may be edge-triggered
+	QGuardedPtr<QObject> self = this;
+	QByteArray scratch = BufferPool::take(8192);
+	while(d->sd) {
+		int actual = d->sd->readBlock(scratch.data(), scratch.size());
+		if(actual < 0)
+			break;
+		QHostAddress pa = d->sd->peerAddress();
+		int pp = d->sd->peerPort();
+
+		// parse straight out of the scratch buffer
+		SPS_UDP s;
+		int r = sp_read_udp(scratch.data(), actual, &s);
+		if(r != 1)
+			continue;
+		incomingUDP(s.host, s.port, pa, pp, s.data);
+		BufferPool::give(s.data);
+		if(!self)
+			break;
+	}
+	BufferPool::give(scratch);
+}
+
+
+//----------------------------------------------------------------------------
+// SocksPool
+//----------------------------------------------------------------------------
+// wait this long before trying again after the proxy failed a warm-up
+#define POOL_RETRY_MSECS 2000
+
+// how often connections are checked for idling too long
+#define POOL_CHECK_MSECS 1000
+
+//! \class SocksPool socks.h
+//! \brief Keeps connections to a SOCKS5 proxy ready for use
+//!
+//! Every outgoing SocksClient normally pays for a TCP connect, method
+//! negotiation and (with a username) authentication before it can even send
+//! its request.  SocksPool keeps up to size() connections to one proxy open
+//! that have been through all that already.  SocksClient::connectToHost()
+//! takes one of them when given the pool, so that only the request is left,
+//! a single round trip.
+//!
+//! The pool refills itself in the background whenever a connection is taken
+//! or lost.  A connection that has been sitting unused for longer than the
+//! idle timeout (60 seconds by default) is replaced with a fresh one, so that
+//! clients don't get connections the proxy (or something in between) has
+//! since given up on.  Should a pooled connection turn out to be dead anyway,
+//! SocksClient quietly starts over on a new one.
+//!
+//! Handing a connection over relies on BSocket::detachSocket(), which only
+//! works on Unix.  Elsewhere the pool keeps nothing open, and clients given
+//! the pool connect as usual.
+//!
+//! \code
+//! SocksPool *pool = new SocksPool;
+//! pool->setProxy("proxy.example.com", 1080, "user", "secret");
+//! pool->setSize(4);
+//!
+//! ...
+//!
+//! SocksClient *c = new SocksClient;
+//! c->connectToHost(pool, "www.example.com", 80);
+//! \endcode
+class SocksPool::Private
+{
+public:
+	Private() {}
+
+	class Entry
+	{
+	public:
+		BSocket *sock;
+		SocksParser parser;
+		int step;
+		bool ready;
+		QTime since;
+	};
+
+	QString host;
+	int port;
+	QString user, pass;
+	int size;
+	int idleTimeout;
+	QPtrList<Entry> entries;
+	QTimer t;
+	bool retrying;
+	QTime retry;
+
+	Entry *find(QObject *sock)
+	{
+		QPtrListIterator<Entry> it(entries);
+		for(Entry *e; (e = it.current()); ++it) {
+			if(e->sock == sock)
+				return e;
+		}
+		return 0;
+	}
+};
+
+SocksPool::SocksPool(QObject *parent)
+:QObject(parent)
+{
+	d = new Private;
+	d->port = 0;
+	d->size = 0;
+	d->idleTimeout = 60000;
+	d->retrying = false;
+	connect(&d->t, SIGNAL(timeout()), SLOT(t_timeout()));
+}
+
+SocksPool::~SocksPool()
+{
+	clear();
+	delete d;
+}
+
+//!
+//! Sets the proxy to keep connections to, at \a host port \a port, with
+//! \a user and \a pass for authentication (none if \a user is empty).  Any
+//! connections to the previous proxy are closed.
+void SocksPool::setProxy(const QString &host, int port, const QString &user, const QString &pass)
+{
+	clear();
+	d->retrying = false;
+	d->host = host;
+	d->port = port;
+	d->user = user;
+	d->pass = pass;
+	refill();
+}
+
+//!
+//! Returns the host of the proxy.
+QString SocksPool::proxyHost() const
+{
+	return d->host;
+}
+
+//!
+//! Returns the port of the proxy.
+int SocksPool::proxyPort() const
+{
+	return d->port;
+}
+
+//!
+//! Returns the username used to authenticate with the proxy.
+QString SocksPool::user() const
+{
+	return d->user;
+}
+
+//!
+//! Returns the password used to authenticate with the proxy.
+QString SocksPool::pass() const
+{
+	return d->pass;
+}
+
+//!
+//! Sets the number of connections to keep ready to \a n.  0, the default,
+//! disables the pool.
+void SocksPool::setSize(int n)
+{
+#ifdef Q_OS_UNIX
+	d->size = QMAX(n, 0);
+#else
+	// connections couldn't be handed over, so don't open any
+	Q_UNUSED(n);
+	d->size = 0;
+#endif
+	while((int)d->entries.count() > d->size)
+		drop(d->entries.getFirst()->sock);
+	if(d->size > 0)
+		d->t.start(POOL_CHECK_MSECS);
+	else
+		d->t.stop();
+	refill();
+}
+
+//!
+//! Returns the number of connections the pool keeps ready.
+int SocksPool::size() const
+{
+	return d->size;
+}
+
+//!
+//! Sets how long a connection may sit unused before it is replaced, to
+//! \a secs seconds.
+void SocksPool::setIdleTimeout(int secs)
+{
+	d->idleTimeout = secs * 1000;
+}
+
+//!
+//! Returns the number of connections ready to be used right now.
+int SocksPool::count() const
+{
+	int n = 0;
+	QPtrListIterator<Private::Entry> it(d->entries);
+	for(Private::Entry *e; (e = it.current()); ++it) {
+		if(e->ready)
+			++n;
+	}
+	return n;
+}
+
+int SocksPool::take()
+{
+	// the newest is the least likely to have been dropped by the proxy
+	int fd = -1;
+	while(fd == -1) {
+		Private::Entry *e = 0;
+		QPtrListIterator<Private::Entry> it(d->entries);
+		for(Private::Entry *i; (i = it.current()); ++it) {
+			if(i->ready && (!e || i->since.elapsed() < e->since.elapsed()))
+				e = i;
+		}
+		if(!e)
+			break;
+
+		fd = e->sock->detachSocket();
+		drop(e->sock);
+	}
+
+	refill();
+	return fd;
+}
+
+void SocksPool::drop(BSocket *sock)
+{
+	Private::Entry *e = d->find(sock);
+	if(!e)
+		return;
+	d->entries.removeRef(e);
+	sock->disconnect(this);
+	sock->close();
+	sock->deleteLater();
+	delete e;
+}
+
+void SocksPool::clear()
+{
+	while(!d->entries.isEmpty())
+		drop(d->entries.getFirst()->sock);
+}
+
+void SocksPool::refill()
+{
+#ifdef Q_OS_UNIX
+	if(d->retrying)
+		return;
+	if(d->host.isEmpty())
+		return;
+
+	while((int)d->entries.count() < d->size) {
+		Private::Entry *e = new Private::Entry;
+		e->sock = new BSocket;
+		e->step = StepVersion;
+		e->ready = false;
+		e->parser.reset(SocksParser::ServerVersion);
+		connect(e->sock, SIGNAL(connected()), SLOT(sock_connected()));
+		connect(e->sock, SIGNAL(readyRead()), SLOT(sock_readyRead()));
+		connect(e->sock, SIGNAL(connectionClosed()), SLOT(sock_closed()));
+		connect(e->sock, SIGNAL(error(int)), SLOT(sock_closed()));
+		d->entries.append(e);
+		e->sock->connectToHost(d->host, d->port);
+	}
+#endif
+}
+
+void SocksPool::sock_connected()
+{
+	Private::Entry *e = d->find((QObject *)sender());
+	if(!e)
+		return;
+
+	int methods = SocksClient::AuthNone;
+	if(!d->user.isEmpty())
+		methods |= SocksClient::AuthUsername;
+	e->sock->write(spc_set_version(methods));
+}
+
+void SocksPool::sock_readyRead()
+{
+	BSocket *sock = (BSocket *)sender();
+	Private::Entry *e = d->find(sock);
+	if(!e)
+		return;
+
+	// nothing is expected once the connection is ready
+	bool ok = !e->ready;
+	while(ok && !e->ready) {
+		int r = sp_next(e->sock, &e->parser, "pool");
+		if(r == 0)
+			return;
+		if(r == -1)
+			ok = false;
+		else if(e->step == StepVersion) {
+			SocksParser &s = e->parser;
+			if(s.version != 0x05 || (s.code != 0x00 && (s.code != 0x02 || d->user.isEmpty())))
+				ok = false;
+			else if(s.code == 0x02) {
+				e->step = StepAuth;
+				e->parser.reset(SocksParser::ServerAuth);
+				e->sock->write(spc_set_authUsername(d->user.latin1(), d->pass.latin1()));
+			}
+			else
+				e->ready = true;
+		}
+		else {
+			SocksParser &s = e->parser;
+			if(s.version != 0x01 || s.code != 0x00)
+				ok = false;
+			else
+				e->ready = true;
+		}
+	}
+
+	if(!ok) {
+#ifdef PROX_DEBUG
+		fprintf(stderr, "SocksPool: warm-up with %s:%d failed\n", d->host.latin1(), d->port);
+#endif
+		drop(sock);
+		d->retrying = true;
+		d->retry.start();
+		return;
+	}
+
+	e->since.start();
+}
+
+void SocksPool::sock_closed()
+{
+	BSocket *sock = (BSocket *)sender();
+	Private::Entry *e = d->find(sock);
+	if(!e)
+		return;
+
+	// lost before it was ready means the proxy is having trouble, so don't
+	//   hammer it
+	bool wasReady = e->ready;
+	drop(sock);
+	if(wasReady)
+		refill();
+	else if(!d->retrying) {
+		d->retrying = true;
+		d->retry.start();
+	}
+}
+
+void SocksPool::t_timeout()
+{
+	if(d->retrying) {
+		if(d->retry.elapsed() < POOL_RETRY_MSECS)
+			return;
+		d->retrying = false;
+		refill();
+	}
+
+	// replace whatever has been idle for too long
+	QPtrList<BSocket> stale;
+	QPtrListIterator<Private::Entry> it(d->entries);
+	for(Private::Entry *e; (e = it.current()); ++it) {
+		if(e->ready && e->since.elapsed() > d->idleTimeout)
+			stale.append(e->sock);
+	}
+	if(stale.isEmpty())
 		return;
-	incomingUDP(s.host, s.port, pa, pp, s.data);
+	QPtrListIterator<BSocket> sit(stale);
+	for(BSocket *sock; (sock = sit.current()); ++sit)
+		drop(sock);
+	refill();
 }
 
 // CS_NAMESPACE_END
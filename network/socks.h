@@ -28,6 +28,9 @@
 class QHostAddress;
 class SocksClient;
 class SocksServer;
+class SocksPool;
+class BSocket;
+class WorkerPool;
 
 class SocksUDP : public QObject
 {
@@ -67,7 +70,9 @@ public:
 
 	// outgoing
 	void setAuth(const QString &user, const QString &pass="");
+	void setPipelined(bool);
 	void connectToHost(const QString &proxyHost, int proxyPort, const QString &host, int port, bool udpMode=false);
+	void connectToHost(SocksPool *pool, const QString &host, int port, bool udpMode=false);
 
 	// incoming
 	void chooseMethod(int);
@@ -83,11 +88,17 @@ public:
 	QByteArray read(int bytes=0);
 	int bytesAvailable() const;
 	int bytesToWrite() const;
+	void writev(const QValueList<QByteArray> &);
+	bool isDetachable() const;
+	int detachSocket();
 
 	// remote address
 	QHostAddress peerAddress() const;
 	Q_UINT16 peerPort() const;
 
+	// local address
+	QHostAddress address() const;
+
 	// udp
 	QString udpAddress() const;
 	Q_UINT16 udpPort() const;
@@ -103,6 +114,9 @@ signals:
 	void incomingConnectRequest(const QString &host, int port);
 	void incomingUDPAssociateRequest();
 
+protected:
+	void setReadEnabled(bool);
+
 private slots:
 	void sock_connected();
 	void sock_connectionClosed();
@@ -119,9 +133,11 @@ private:
 	void init();
 	void reset(bool clear=false);
 	void do_request();
-	void processOutgoing(const QByteArray &);
-	void processIncoming(const QByteArray &);
+	void processOutgoing();
 	void continueIncoming();
+	void flushHandshake();
+	int flushEarly();
+	bool fallBack();
 	void writeData(const QByteArray &a);
 };
 
@@ -138,6 +154,8 @@ public:
 	int port() const;
 	QHostAddress address() const;
 	SocksClient *takeIncoming();
+	void setListenOptions(int);
+	void setWorkerPool(WorkerPool *);
 
 	void writeUDP(const QHostAddress &addr, int port, const QByteArray &data);
 
@@ -155,6 +173,41 @@ private:
 	Private *d;
 };
 
+class SocksPool : public QObject
+{
+	Q_OBJECT
+public:
+	SocksPool(QObject *parent=0);
+	~SocksPool();
+
+	void setProxy(const QString &host, int port, const QString &user="", const QString &pass="");
+	QString proxyHost() const;
+	int proxyPort() const;
+	QString user() const;
+	QString pass() const;
+
+	void setSize(int);
+	int size() const;
+	void setIdleTimeout(int secs);
+	int count() const;
+
+private slots:
+	void sock_connected();
+	void sock_readyRead();
+	void sock_closed();
+	void refill();
+	void t_timeout();
+
+private:
+	class Private;
+	Private *d;
+
+	friend class SocksClient;
+	int take();
+	void drop(BSocket *);
+	void clear();
+};
+
 // CS_NAMESPACE_END
 
 #endif
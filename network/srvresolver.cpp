@@ -28,6 +28,9 @@
 #ifndef NO_NDNS
 #include"ndns.h"
 #endif
+#ifndef NO_DNSCLIENT
+#include"dnsclient.h"
+#endif
 
 // CS_NAMESPACE_BEGIN
 
@@ -61,6 +64,9 @@ public:
 	Private() {}
 
 	QDns *qdns;
+#ifndef NO_DNSCLIENT
+	DnsClient dns;
+#endif
 #ifndef NO_NDNS
 	NDns ndns;
 #endif
@@ -84,6 +90,9 @@ SrvResolver::SrvResolver(QObject *parent)
 	d = new Private;
 	d->qdns = 0;
 
+#ifndef NO_DNSCLIENT
+	connect(&d->dns, SIGNAL(resultsReady()), SLOT(dns_done()));
+#endif
 #ifndef NO_NDNS
 	connect(&d->ndns, SIGNAL(resultsReady()), SLOT(ndns_done()));
 #endif
@@ -104,11 +113,7 @@ void SrvResolver::resolve(const QString &server, const QString &type, const QStr
 	d->failed = false;
 	d->srvonly = false;
 	d->srv = QString("_") + type + "._" + proto + '.' + server;
-	d->t.start(15000, true);
-	d->qdns = new QDns;
-	connect(d->qdns, SIGNAL(resultsReady()), SLOT(qdns_done()));
-	d->qdns->setRecordType(QDns::Srv);
-	d->qdns->setLabel(d->srv);
+	lookupSrv();
 }
 
 void SrvResolver::resolveSrvOnly(const QString &server, const QString &type, const QString &proto)
@@ -118,7 +123,18 @@ void SrvResolver::resolveSrvOnly(const QString &server, const QString &type, con
 	d->failed = false;
 	d->srvonly = true;
 	d->srv = QString("_") + type + "._" + proto + '.' + server;
+	lookupSrv();
+}
+
+void SrvResolver::lookupSrv()
+{
 	d->t.start(15000, true);
+#ifndef NO_DNSCLIENT
+	if(DnsClient::isAvailable()) {
+		d->dns.resolve(d->srv, DnsClient::Srv);
+		return;
+	}
+#endif
 	d->qdns = new QDns;
 	connect(d->qdns, SIGNAL(resultsReady()), SLOT(qdns_done()));
 	d->qdns->setRecordType(QDns::Srv);
@@ -142,6 +158,10 @@ void SrvResolver::stop()
 		d->sd.deleteLater(d->qdns);
 		d->qdns = 0;
 	}
+#ifndef NO_DNSCLIENT
+	if(d->dns.isBusy())
+		d->dns.stop();
+#endif
 #ifndef NO_NDNS
 	if(d->ndns.isBusy())
 		d->ndns.stop();
@@ -155,14 +175,17 @@ void SrvResolver::stop()
 
 bool SrvResolver::isBusy() const
 {
-#ifndef NO_NDNS
-	if(d->qdns || d->ndns.isBusy())
-#else
 	if(d->qdns)
+		return true;
+#ifndef NO_DNSCLIENT
+	if(d->dns.isBusy())
+		return true;
 #endif
+#ifndef NO_NDNS
+	if(d->ndns.isBusy())
 		return true;
-	else
-		return false;
+#endif
+	return false;
 }
 
 QValueList<QDns::Server> SrvResolver::servers() const
@@ -220,11 +243,31 @@ void SrvResolver::qdns_done()
 	d->sd.deleteLater(d->qdns);
 	d->qdns = 0;
 
-	if(list.isEmpty()) {
+	gotServers(list);
+}
+
+void SrvResolver::dns_done()
+{
+#ifndef NO_DNSCLIENT
+	d->t.stop();
+
+	SafeDeleteLock s(&d->sd);
+
+	QValueList<QDns::Server> list;
+	if(d->dns.success())
+		list = d->dns.servers();
+	gotServers(list);
+#endif
+}
+
+void SrvResolver::gotServers(const QValueList<QDns::Server> &_list)
+{
+	if(_list.isEmpty()) {
 		stop();
 		resultsReady();
 		return;
 	}
+	QValueList<QDns::Server> list = _list;
 	sortSRVList(list);
 	d->servers = list;
 
@@ -49,6 +49,7 @@ signals:
 	void resultsReady();
 
 private slots:
+	void dns_done();
 	void qdns_done();
 	void ndns_done();
 	void t_timeout();
@@ -57,6 +58,8 @@ private:
 	class Private;
 	Private *d;
 
+	void lookupSrv();
+	void gotServers(const QValueList<QDns::Server> &list);
 	void tryNext();
 };
 
@@ -0,0 +1,377 @@
+/*
+ * streamrelay.cpp - copy data between two ByteStreams
+ * Copyright (C) 2003  Justin Karneges
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+//! \class StreamRelay streamrelay.h
+//! \brief Copies data both ways between two connected ByteStreams
+//!
+//! StreamRelay forwards everything read from one stream to the other, and
+//! stops reading from a side while its peer has too much left to write.  When
+//! one side closes, whatever it sent is flushed before the other is closed,
+//! and finished() is emitted once both are done.
+//!
+//! On Linux, as soon as both streams are plain connected sockets with nothing
+//! buffered (see ByteStream::isDetachable()), the relay takes their
+//! descriptors and moves the data inside the kernel with splice(), so that it
+//! never has to be copied through userspace.  The streams are left idle in
+//! that case, and should be deleted only after finished().
+
+#include"streamrelay.h"
+
+#include<qguardedptr.h>
+#include"bytestream.h"
+#include"bufferpool.h"
+
+#if defined(Q_OS_LINUX) && !defined(NO_SPLICE)
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+# endif
+# include<fcntl.h>
+# include<unistd.h>
+# include<errno.h>
+# include<sys/socket.h>
+# include"reactor.h"
+# define HAVE_SPLICE
+#endif
+
+#ifdef PROX_DEBUG
+#include<stdio.h>
+#endif
+
+// stop reading from one side while the other has this much left to write,
+//   and start again once it has drained to the low mark
+#define RELAY_HIGHWATER 65536
+#define RELAY_LOWWATER  16384
+
+// most bytes moved by one splice() call, and chunks moved per wakeup
+#define SPLICE_CHUNK    65536
+#define SPLICE_ROUNDS   16
+
+// CS_NAMESPACE_BEGIN
+
+#ifdef HAVE_SPLICE
+// one direction of a spliced relay
+class SpliceDir
+{
+public:
+	SpliceDir()
+	{
+		from = to = -1;
+		pipe[0] = pipe[1] = -1;
+		pending = 0;
+		eof = false;
+		done = false;
+		rn = wn = 0;
+	}
+
+	~SpliceDir()
+	{
+		delete rn;
+		delete wn;
+		if(pipe[0] != -1)
+			::close(pipe[0]);
+		if(pipe[1] != -1)
+			::close(pipe[1]);
+	}
+
+	// returns false on a socket error
+	bool move()
+	{
+		for(int n = 0; n < SPLICE_ROUNDS; ++n) {
+			// empty the pipe before taking more from the socket
+			while(pending > 0) {
+				int r = ::splice(pipe[0], 0, to, 0, pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				if(r < 0) {
+					if(errno == EINTR)
+						continue;
+					if(errno != EAGAIN)
+						return false;
+
+					// peer is full, so wait for it rather than for more input
+					rn->setEnabled(false);
+					wn->setEnabled(true);
+					return true;
+				}
+				pending -= r;
+			}
+			wn->setEnabled(false);
+
+			if(eof) {
+				if(!done) {
+					::shutdown(to, SHUT_WR);
+					done = true;
+					rn->setEnabled(false);
+				}
+				return true;
+			}
+
+			rn->setEnabled(true);
+			int r = ::splice(from, 0, pipe[1], 0, SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if(r < 0) {
+				if(errno == EINTR)
+					continue;
+				if(errno == EAGAIN)
+					return true;
+				return false;
+			}
+			if(r == 0)
+				eof = true;
+			else
+				pending = r;
+		}
+
+		// give the other connections a turn
+		rn->retry();
+		return true;
+	}
+
+	int from, to;
+	int pipe[2];
+	int pending;
+	bool eof, done;
+	SocketWatcher *rn, *wn;
+};
+#endif
+
+//----------------------------------------------------------------------------
+// StreamRelay
+//----------------------------------------------------------------------------
+class StreamRelay::Private
+{
+public:
+	Private() {}
+
+	ByteStream *a, *b;
+	bool closing;
+	bool spliced;
+#ifdef HAVE_SPLICE
+	int fa, fb;
+	SpliceDir dir[2];
+#endif
+};
+
+StreamRelay::StreamRelay(ByteStream *a, ByteStream *b, QObject *parent)
+:QObject(parent)
+{
+	d = new Private;
+	d->a = a;
+	d->b = b;
+	d->closing = false;
+	d->spliced = false;
+#ifdef HAVE_SPLICE
+	d->fa = -1;
+	d->fb = -1;
+#endif
+
+	ByteStream *list[2] = { a, b };
+	for(int n = 0; n < 2; ++n) {
+		connect(list[n], SIGNAL(readyRead()), SLOT(bs_readyRead()));
+		connect(list[n], SIGNAL(bytesWritten(int)), SLOT(bs_bytesWritten(int)));
+		connect(list[n], SIGNAL(connectionClosed()), SLOT(bs_connectionClosed()));
+		connect(list[n], SIGNAL(delayedCloseFinished()), SLOT(bs_delayedCloseFinished()));
+		connect(list[n], SIGNAL(error(int)), SLOT(bs_error(int)));
+	}
+
+	// what isn't taken from one side for lack of room in the other should
+	//   stay in the kernel, rather than pile up in the stream
+	for(int n = 0; n < 2; ++n) {
+		if(list[n]->readLimit() == 0)
+			list[n]->setReadLimit(RELAY_HIGHWATER);
+	}
+
+	// either side may already hold data
+	pump(a, b);
+	pump(b, a);
+	trySplice();
+}
+
+StreamRelay::~StreamRelay()
+{
+#ifdef HAVE_SPLICE
+	// the watchers must go before the descriptors they watch
+	delete d->dir[0].rn;
+	delete d->dir[0].wn;
+	delete d->dir[1].rn;
+	delete d->dir[1].wn;
+	d->dir[0].rn = d->dir[0].wn = 0;
+	d->dir[1].rn = d->dir[1].wn = 0;
+	if(d->fa != -1)
+		::close(d->fa);
+	if(d->fb != -1)
+		::close(d->fb);
+#endif
+	delete d;
+}
+
+//!
+//! Returns TRUE if the data is being moved by the kernel rather than through
+//! the two ByteStreams.
+bool StreamRelay::isSpliced() const
+{
+	return d->spliced;
+}
+
+ByteStream *StreamRelay::peer(ByteStream *bs) const
+{
+	if(bs == d->a)
+		return d->b;
+	else
+		return d->a;
+}
+
+void StreamRelay::pump(ByteStream *from, ByteStream *to, bool all)
+{
+	while(from->bytesAvailable() > 0) {
+		int room = RELAY_HIGHWATER - to->bytesToWrite();
+		if(!all && room <= 0)
+			break; // wait for bytesWritten
+		QByteArray block = from->read(all ? 0 : room);
+		to->write(block);
+
+		// the block has been copied into the other side by now, so it can
+		//   serve the next read (unless the stream kept a reference)
+		BufferPool::give(block);
+	}
+}
+
+void StreamRelay::trySplice()
+{
+#ifdef HAVE_SPLICE
+	if(d->spliced || d->closing)
+		return;
+	if(!d->a->isDetachable() || !d->b->isDetachable())
+		return;
+
+	// pipes made by an earlier attempt are kept for the next one
+	SpliceDir *x = d->dir;
+	for(int n = 0; n < 2; ++n) {
+		if(x[n].pipe[0] == -1 && ::pipe(x[n].pipe) != 0)
+			return;
+	}
+
+	int fa = d->a->detachSocket();
+	if(fa == -1)
+		return; // stay buffered
+	int fb = d->b->detachSocket();
+	if(fb == -1) {
+		// too late to go back, since a is no longer a stream
+		::close(fa);
+		d->closing = true;
+		finished();
+		return;
+	}
+
+	disconnect(d->a, 0, this, 0);
+	disconnect(d->b, 0, this, 0);
+	d->fa = fa;
+	d->fb = fb;
+	d->spliced = true;
+	::fcntl(fa, F_SETFL, ::fcntl(fa, F_GETFL) | O_NONBLOCK);
+	::fcntl(fb, F_SETFL, ::fcntl(fb, F_GETFL) | O_NONBLOCK);
+
+#ifdef PROX_DEBUG
+	fprintf(stderr, "StreamRelay: splicing fd %d <-> fd %d\n", fa, fb);
+#endif
+
+	x[0].from = fa;
+	x[0].to = fb;
+	x[1].from = fb;
+	x[1].to = fa;
+	for(int n = 0; n < 2; ++n) {
+		x[n].rn = new SocketWatcher(x[n].from, SocketWatcher::Read);
+		connect(x[n].rn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
+		x[n].wn = new SocketWatcher(x[n].to, SocketWatcher::Write);
+		x[n].wn->setEnabled(false);
+		connect(x[n].wn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
+	}
+
+	doSplice();
+#endif
+}
+
+void StreamRelay::doSplice()
+{
+#ifdef HAVE_SPLICE
+	if(!d->dir[0].move() || !d->dir[1].move()) {
+#ifdef PROX_DEBUG
+		fprintf(stderr, "StreamRelay: splice error\n");
+#endif
+		d->dir[0].rn->setEnabled(false);
+		d->dir[1].rn->setEnabled(false);
+		d->dir[0].wn->setEnabled(false);
+		d->dir[1].wn->setEnabled(false);
+		finished();
+		return;
+	}
+
+	if(d->dir[0].done && d->dir[1].done) {
+		d->dir[0].rn->setEnabled(false);
+		d->dir[1].rn->setEnabled(false);
+		finished();
+	}
+#endif
+}
+
+void StreamRelay::sn_activated(int)
+{
+	doSplice();
+}
+
+void StreamRelay::bs_readyRead()
+{
+	ByteStream *from = (ByteStream *)sender();
+	pump(from, peer(from));
+	trySplice();
+}
+
+void StreamRelay::bs_bytesWritten(int)
+{
+	// drained enough to take more from the other side?
+	ByteStream *to = (ByteStream *)sender();
+	if(to->bytesToWrite() <= RELAY_LOWWATER)
+		pump(peer(to), to);
+	trySplice();
+}
+
+void StreamRelay::bs_connectionClosed()
+{
+	// flush what is left, then close the other side
+	ByteStream *from = (ByteStream *)sender();
+	ByteStream *to = peer(from);
+	disconnect(from, 0, this, 0);
+	pump(from, to, true);
+	d->closing = true;
+	to->close();
+	if(to->bytesToWrite() == 0)
+		finished();
+}
+
+void StreamRelay::bs_delayedCloseFinished()
+{
+	if(d->closing)
+		finished();
+}
+
+void StreamRelay::bs_error(int)
+{
+	d->closing = true;
+	finished();
+}
+
+// CS_NAMESPACE_END
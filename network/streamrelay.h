@@ -0,0 +1,62 @@
+/*
+ * streamrelay.h - copy data between two ByteStreams
+ * Copyright (C) 2003  Justin Karneges
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CS_STREAMRELAY_H
+#define CS_STREAMRELAY_H
+
+#include<qobject.h>
+
+// CS_NAMESPACE_BEGIN
+
+class ByteStream;
+
+class StreamRelay : public QObject
+{
+	Q_OBJECT
+public:
+	StreamRelay(ByteStream *a, ByteStream *b, QObject *parent=0);
+	~StreamRelay();
+
+	bool isSpliced() const;
+
+signals:
+	void finished();
+
+private slots:
+	void bs_readyRead();
+	void bs_bytesWritten(int);
+	void bs_connectionClosed();
+	void bs_delayedCloseFinished();
+	void bs_error(int);
+	void sn_activated(int);
+
+private:
+	class Private;
+	Private *d;
+
+	ByteStream *peer(ByteStream *) const;
+	void pump(ByteStream *from, ByteStream *to, bool all=false);
+	void trySplice();
+	void doSplice();
+};
+
+// CS_NAMESPACE_END
+
+#endif
@@ -0,0 +1,889 @@
+/*
+ * udprelay.cpp - relay for SOCKS5 UDP associations
+ * Copyright (C) 2003  Justin Karneges
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include"udprelay.h"
+
+#include<qptrlist.h>
+#include<qstringlist.h>
+#include<qintdict.h>
+#include<qdict.h>
+#include<qtimer.h>
+#include<qdatetime.h>
+#include"reactor.h"
+#include"bufferpool.h"
+#include"ndns.h"
+
+#if defined(Q_OS_UNIX) && !defined(NO_UDP_RELAY)
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+# endif
+# include<sys/types.h>
+# include<sys/socket.h>
+# include<sys/uio.h>
+# include<netinet/in.h>
+# include<arpa/inet.h>
+# include<unistd.h>
+# include<fcntl.h>
+# include<errno.h>
+# include<string.h>
+# define HAVE_UDP_RELAY
+# if defined(Q_OS_LINUX) && !defined(NO_MMSG)
+#  define HAVE_MMSG
+# endif
+#endif
+
+#ifdef PROX_DEBUG
+#include<stdio.h>
+#endif
+
+// datagrams moved per system call
+#define RELAY_BATCH 32
+
+// batches moved per wakeup, before giving the rest of the event loop a turn
+#define RELAY_ROUNDS 8
+
+// largest datagram relayed, anything bigger is dropped
+#define RELAY_MTU 8192
+
+// room kept in front of a datagram from a target, for the header that goes
+//   back to the client (always an IPv4 address)
+#define RELAY_HEADROOM 10
+
+// receive queue of the client side socket, to ride out bursts between
+//   wakeups
+#define RELAY_RCVBUF (1024 * 1024)
+
+// initial number of hash buckets for sessions, a power of two
+#define RELAY_TABLE 64
+
+// how often sessions and names are checked for expiry
+#define RELAY_CHECK_MSECS 1000
+
+// how long a looked up name is used, and how long a failed lookup is
+//   remembered
+#define RELAY_NAME_MSECS 300000
+#define RELAY_NAME_FAIL_MSECS 10000
+
+// names remembered at once, and lookups one session may have going.  A
+//   datagram for a new name beyond either is dropped.
+#define RELAY_NAMES_MAX 256
+#define RELAY_NAME_LOOKUPS 4
+
+// CS_NAMESPACE_BEGIN
+
+#ifdef HAVE_UDP_RELAY
+#ifdef HAVE_MMSG
+typedef struct mmsghdr RelayMsg;
+#else
+struct RelayMsg
+{
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+};
+#endif
+
+// receives up to n datagrams, returns how many, or -1 if there were none
+static int relay_recv(int fd, RelayMsg *v, int n)
+{
+#ifdef HAVE_MMSG
+	int r;
+	do {
+		r = recvmmsg(fd, v, n, MSG_DONTWAIT, 0);
+	} while(r == -1 && errno == EINTR);
+	return r;
+#else
+	int at = 0;
+	while(at < n) {
+		int r = recvmsg(fd, &v[at].msg_hdr, MSG_DONTWAIT);
+		if(r == -1) {
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+		v[at++].msg_len = r;
+	}
+	return at > 0 ? at : -1;
+#endif
+}
+
+// sends n datagrams, returns how many made it.  One the kernel refuses is
+//   lost, as the network might have lost it, but a full send buffer ends the
+//   batch.
+static int relay_send(int fd, RelayMsg *v, int n)
+{
+	int at = 0;
+	int sent = 0;
+	while(at < n) {
+#ifdef HAVE_MMSG
+		int r = sendmmsg(fd, v + at, n - at, MSG_DONTWAIT);
+#else
+		int r = sendmsg(fd, &v[at].msg_hdr, MSG_DONTWAIT) == -1 ? -1 : 1;
+#endif
+		if(r == -1) {
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			++at;
+			continue;
+		}
+		at += r;
+		sent += r;
+	}
+	return sent;
+}
+
+static inline uint key_hash(const struct sockaddr_in &a)
+{
+	Q_UINT32 h = a.sin_addr.s_addr ^ ((Q_UINT32)a.sin_port << 16) ^ a.sin_port;
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return h;
+}
+
+static inline bool key_equal(const struct sockaddr_in &a, const struct sockaddr_in &b)
+{
+	return (a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port);
+}
+
+//----------------------------------------------------------------------------
+// UDPRelay
+//----------------------------------------------------------------------------
+class UDPRelay::Session
+{
+public:
+	Session *next;                 // next in the same hash bucket
+	struct sockaddr_in client;
+	int grant;
+	int fd;                        // socket facing the targets
+	SocketWatcher *sn;
+	int last;                      // last activity, on the relay clock
+	int lookups;                   // names being looked up for it
+};
+
+class UDPRelay::Name
+{
+public:
+	Name() : dns(0), owner(0) {}
+	~Name() { delete dns; }
+
+	NDns *dns;
+	Session *owner;                // whose lookup it is, while not done
+	bool done, ok;
+	Q_UINT32 addr;
+	int when;
+};
+
+class UDPRelay::Private
+{
+public:
+	Private(UDPRelay *_q) : q(_q)
+	{
+		tableSize = RELAY_TABLE;
+		table = new Session*[tableSize];
+		memset(table, 0, tableSize * sizeof(Session *));
+		tableCount = 0;
+		grants.setAutoDelete(true);
+		names.setAutoDelete(true);
+	}
+
+	~Private()
+	{
+		delete[] table;
+	}
+
+	class Grant
+	{
+	public:
+		int id;
+		Q_UINT32 addr;                 // network order
+		Q_UINT16 port;                 // network order, 0 for any
+		bool claimed;
+	};
+
+	UDPRelay *q;
+	int fd;
+	SocketWatcher *sn;
+	int port;
+	int idleTimeout;
+	QTimer t;
+	QTime clock;
+	int now;
+	UDPRelayStats stats;
+
+	// sessions by client address
+	Session **table;
+	int tableSize, tableCount;
+	QIntDict<Session> byFd;
+
+	QPtrList<Grant> grants;
+	int nextGrant;
+	QDict<Name> names;
+
+	// one batch of datagrams, reused by every call
+	QByteArray slot[RELAY_BATCH];
+	struct iovec iov[RELAY_BATCH];
+	struct sockaddr_in peer[RELAY_BATCH];
+	RelayMsg msg[RELAY_BATCH];
+
+	// and where they go
+	struct iovec outIov[RELAY_BATCH];
+	struct sockaddr_in outAddr[RELAY_BATCH];
+	Session *outSession[RELAY_BATCH];
+	RelayMsg out[RELAY_BATCH];
+
+	Session *find(const struct sockaddr_in &a) const
+	{
+		Session *s = table[key_hash(a) & (tableSize - 1)];
+		while(s && !key_equal(s->client, a))
+			s = s->next;
+		return s;
+	}
+
+	void insert(Session *s)
+	{
+		if(tableCount * 4 >= tableSize * 3)
+			grow();
+		Session **b = &table[key_hash(s->client) & (tableSize - 1)];
+		s->next = *b;
+		*b = s;
+		++tableCount;
+	}
+
+	void remove(Session *s)
+	{
+		Session **b = &table[key_hash(s->client) & (tableSize - 1)];
+		while(*b != s)
+			b = &(*b)->next;
+		*b = s->next;
+		--tableCount;
+	}
+
+	void grow()
+	{
+		int size = tableSize * 2;
+		Session **t = new Session*[size];
+		memset(t, 0, size * sizeof(Session *));
+		for(int n = 0; n < tableSize; ++n) {
+			Session *next;
+			for(Session *s = table[n]; s; s = next) {
+				next = s->next;
+				Session **b = &t[key_hash(s->client) & (size - 1)];
+				s->next = *b;
+				*b = s;
+			}
+		}
+		delete[] table;
+		table = t;
+		tableSize = size;
+	}
+
+	Grant *findGrant(int id) const
+	{
+		QPtrListIterator<Grant> it(grants);
+		for(Grant *g; (g = it.current()); ++it) {
+			if(g->id == id)
+				return g;
+		}
+		return 0;
+	}
+
+	// start a session for a client that hasn't got one, if it was allowed
+	Session *claim(const struct sockaddr_in &from)
+	{
+		Grant *g = 0;
+		QPtrListIterator<Grant> it(grants);
+		for(Grant *i; (i = it.current()); ++it) {
+			if(i->addr != from.sin_addr.s_addr)
+				continue;
+			if(i->port == from.sin_port) {
+				g = i;
+				break;
+			}
+			if(i->port == 0 && !i->claimed && !g)
+				g = i;
+		}
+		if(!g)
+			return 0;
+
+		int s = socket(AF_INET, SOCK_DGRAM, 0);
+		if(s == -1)
+			return 0;
+		fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+		fcntl(s, F_SETFD, FD_CLOEXEC);
+
+		Session *e = new Session;
+		e->client = from;
+		e->grant = g->id;
+		e->fd = s;
+		e->last = now;
+		e->lookups = 0;
+		e->sn = new SocketWatcher(s, SocketWatcher::Read);
+		QObject::connect(e->sn, SIGNAL(activated(int)), q, SLOT(sn_target(int)));
+		insert(e);
+		byFd.insert(s, e);
+		g->claimed = true;
+#ifdef PROX_DEBUG
+		fprintf(stderr, "UDPRelay: session for %s:%d\n", inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+#endif
+		return e;
+	}
+
+	void close(Session *e)
+	{
+		remove(e);
+		byFd.remove(e->fd);
+		delete e->sn;
+		::close(e->fd);
+
+		// lookups it started go on, but no longer count against anyone
+		if(e->lookups > 0) {
+			QDictIterator<Name> nit(names);
+			for(Name *n; (n = nit.current()); ++nit) {
+				if(n->owner == e)
+					n->owner = 0;
+			}
+		}
+
+		// the client may start over with the same grant
+		Grant *g = findGrant(e->grant);
+		if(g)
+			g->claimed = false;
+		delete e;
+	}
+
+	void closeAll()
+	{
+		QPtrList<Session> list;
+		QIntDictIterator<Session> it(byFd);
+		for(Session *e; (e = it.current()); ++it)
+			list.append(e);
+		QPtrListIterator<Session> lit(list);
+		for(Session *e; (e = lit.current()); ++lit)
+			close(e);
+	}
+
+	// an address for a name from a client, or false if there is none yet
+	bool resolve(Session *e, const char *name, struct in_addr *addr)
+	{
+		if(inet_pton(AF_INET, name, addr) == 1)
+			return true;
+
+		QString key = QString::fromLatin1(name);
+		Name *n = names.find(key);
+		if(n) {
+			if(!n->done || !n->ok)
+				return false;
+			addr->s_addr = n->addr;
+			return true;
+		}
+
+		// a client could name a new host in every datagram, so the table and
+		//   the lookups going on for one session are kept in bounds
+		if((int)names.count() >= RELAY_NAMES_MAX || e->lookups >= RELAY_NAME_LOOKUPS)
+			return false;
+
+		// datagrams for the name are dropped until it has been looked up
+		n = new Name;
+		n->done = false;
+		n->ok = false;
+		n->addr = 0;
+		n->when = now;
+		n->owner = e;
+		++e->lookups;
+		n->dns = new NDns;
+		QObject::connect(n->dns, SIGNAL(resultsReady()), q, SLOT(dns_resultsReady()));
+		names.insert(key, n);
+		n->dns->resolve(key);
+		return false;
+	}
+
+	// reads the header in front of a datagram from a client, returning its
+	//   length, or 0 if the datagram can't be relayed
+	int decode(Session *e, const unsigned char *p, int len, struct sockaddr_in *to)
+	{
+		// fragments aren't supported, which RFC 1928 allows
+		if(len < 4 || p[0] != 0 || p[1] != 0 || p[2] != 0)
+			return 0;
+
+		memset(to, 0, sizeof(*to));
+		to->sin_family = AF_INET;
+		int at = 4;
+		if(p[3] == 0x01) {
+			if(len < at + 6)
+				return 0;
+			memcpy(&to->sin_addr.s_addr, p + at, 4);
+			at += 4;
+		}
+		else if(p[3] == 0x03) {
+			if(len < at + 1)
+				return 0;
+			int size = p[at++];
+			if(len < at + size + 2)
+				return 0;
+			char name[256];
+			memcpy(name, p + at, size);
+			name[size] = 0;
+			if(!resolve(e, name, &to->sin_addr))
+				return 0;
+			at += size;
+		}
+		else {
+			// the sockets facing the targets are IPv4
+			return 0;
+		}
+		memcpy(&to->sin_port, p + at, 2);
+		at += 2;
+		return at;
+	}
+
+	// receives a batch, each datagram landing at offset in its slot
+	int receive(int s, int offset)
+	{
+		for(int n = 0; n < RELAY_BATCH; ++n) {
+			iov[n].iov_base = slot[n].data() + offset;
+			iov[n].iov_len = RELAY_MTU;
+			memset(&msg[n], 0, sizeof(RelayMsg));
+			msg[n].msg_hdr.msg_name = &peer[n];
+			msg[n].msg_hdr.msg_namelen = sizeof(peer[n]);
+			msg[n].msg_hdr.msg_iov = &iov[n];
+			msg[n].msg_hdr.msg_iovlen = 1;
+		}
+		return relay_recv(s, msg, RELAY_BATCH);
+	}
+
+	void setOut(int n, char *data, int size, struct sockaddr_in *to)
+	{
+		outIov[n].iov_base = data;
+		outIov[n].iov_len = size;
+		memset(&out[n], 0, sizeof(RelayMsg));
+		out[n].msg_hdr.msg_name = to;
+		out[n].msg_hdr.msg_namelen = sizeof(*to);
+		out[n].msg_hdr.msg_iov = &outIov[n];
+		out[n].msg_hdr.msg_iovlen = 1;
+	}
+};
+
+//! \class UDPRelay udprelay.h
+//! \brief Relays datagrams for SOCKS5 UDP associations
+//!
+//! UDPRelay carries the traffic of the UDP associations a SocksServer grants.
+//! Clients send their datagrams, each behind a SOCKS5 UDP header, to the
+//! relay's port.  Every client (address and port) gets a session with a socket
+//! of its own facing the targets, so that replies find their way back, and
+//! what comes in on that socket is sent to the client behind a header naming
+//! the sender.
+//!
+//! The relay is built to move a lot of small datagrams.  Sessions are found
+//! through a hash table, datagrams are moved 32 at a time with
+//! recvmmsg()/sendmmsg() where the system has them, and headers are read and
+//! written in place in buffers from the BufferPool, so no datagram is copied
+//! on its way through.
+//!
+//! A client has to be allowed with allow() first, normally when its
+//! association is granted, and is cut off with revoke() when the TCP
+//! connection holding the association goes away.  A session that has been
+//! quiet for longer than the idle timeout (60 seconds by default) is closed,
+//! and is opened again should the client send more.
+//!
+//! Only IPv4 is relayed.  Fragmented datagrams are dropped, and so are
+//! datagrams for a name until the name has been looked up.  Only so many
+//! names are remembered, and a session only gets a few lookups going at once;
+//! datagrams for further new names are dropped until there is room again.
+UDPRelay::UDPRelay(QObject *parent)
+:QObject(parent)
+{
+	d = new Private(this);
+	d->fd = -1;
+	d->sn = 0;
+	d->port = 0;
+	d->idleTimeout = 60000;
+	d->now = 0;
+	d->nextGrant = 1;
+	d->stats.toTarget = 0;
+	d->stats.toClient = 0;
+	d->stats.dropped = 0;
+	d->stats.sessions = 0;
+	connect(&d->t, SIGNAL(timeout()), SLOT(t_timeout()));
+}
+
+UDPRelay::~UDPRelay()
+{
+	stop();
+	delete d;
+}
+
+//!
+//! Opens the relay on UDP port \a port of all interfaces, or on a free port
+//! if \a port is 0.  Returns FALSE if that fails.
+bool UDPRelay::bind(Q_UINT16 port)
+{
+	stop();
+
+	int s = socket(AF_INET, SOCK_DGRAM, 0);
+	if(s == -1)
+		return false;
+
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+	sa.sin_port = htons(port);
+	socklen_t len = sizeof(sa);
+	if(::bind(s, (struct sockaddr *)&sa, sizeof(sa)) == -1 || getsockname(s, (struct sockaddr *)&sa, &len) == -1) {
+		::close(s);
+		return false;
+	}
+	int size = RELAY_RCVBUF;
+	setsockopt(s, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+	fcntl(s, F_SETFD, FD_CLOEXEC);
+
+	d->fd = s;
+	d->port = ntohs(sa.sin_port);
+	for(int n = 0; n < RELAY_BATCH; ++n)
+		d->slot[n] = BufferPool::take(RELAY_HEADROOM + RELAY_MTU);
+	d->sn = new SocketWatcher(s, SocketWatcher::Read);
+	connect(d->sn, SIGNAL(activated(int)), SLOT(sn_client(int)));
+	d->clock.start();
+	d->t.start(RELAY_CHECK_MSECS);
+	return true;
+}
+
+//!
+//! Closes the relay, along with all sessions.  Clients have to be allowed
+//! again afterwards.
+void UDPRelay::stop()
+{
+	d->t.stop();
+	d->closeAll();
+	d->grants.clear();
+	d->names.clear();
+	delete d->sn;
+	d->sn = 0;
+	if(d->fd != -1) {
+		::close(d->fd);
+		d->fd = -1;
+		for(int n = 0; n < RELAY_BATCH; ++n) {
+			BufferPool::give(d->slot[n]);
+			d->slot[n] = QByteArray();
+		}
+	}
+	d->port = 0;
+}
+
+//!
+//! Returns TRUE if the relay is open.
+bool UDPRelay::isActive() const
+{
+	return (d->fd != -1);
+}
+
+//!
+//! Returns the port the relay is open on.
+int UDPRelay::port() const
+{
+	return d->port;
+}
+
+//!
+//! Sets how long a session may go without traffic before it is closed, to
+//! \a secs seconds.
+void UDPRelay::setIdleTimeout(int secs)
+{
+	d->idleTimeout = secs * 1000;
+}
+
+//!
+//! Lets the client at \a addr port \a port use the relay, and returns an id
+//! for revoke(), or -1 if \a addr isn't an IPv4 address.  With \a port 0,
+//! the port is taken from the first datagram the client sends.
+int UDPRelay::allow(const QHostAddress &addr, int port)
+{
+	if(!addr.isIp4Addr())
+		return -1;
+
+	Private::Grant *g = new Private::Grant;
+	g->id = d->nextGrant++;
+	g->addr = htonl(addr.ip4Addr());
+	g->port = htons(port);
+	g->claimed = false;
+	d->grants.append(g);
+	return g->id;
+}
+
+//!
+//! Cuts off the client allowed as \a id, closing its session.
+void UDPRelay::revoke(int id)
+{
+	Private::Grant *g = d->findGrant(id);
+	if(!g)
+		return;
+
+	QPtrList<Session> list;
+	QIntDictIterator<Session> it(d->byFd);
+	for(Session *e; (e = it.current()); ++it) {
+		if(e->grant == id)
+			list.append(e);
+	}
+	QPtrListIterator<Session> lit(list);
+	for(Session *e; (e = lit.current()); ++lit)
+		d->close(e);
+	d->grants.removeRef(g);
+}
+
+//!
+//! Returns the number of datagrams relayed each way and dropped, and the
+//! number of sessions open.
+UDPRelayStats UDPRelay::stats() const
+{
+	UDPRelayStats s = d->stats;
+	s.sessions = d->tableCount;
+	return s;
+}
+
+void UDPRelay::sn_client(int)
+{
+	d->now = d->clock.elapsed();
+	for(int round = 0; round < RELAY_ROUNDS; ++round) {
+		int n = d->receive(d->fd, 0);
+		if(n <= 0)
+			return;
+
+		// datagrams from one client tend to come in runs, so keep the last
+		//   session at hand
+		int outs = 0;
+		Session *e = 0;
+		for(int i = 0; i < n; ++i) {
+			if(!e || !key_equal(e->client, d->peer[i])) {
+				e = d->find(d->peer[i]);
+				if(!e)
+					e = d->claim(d->peer[i]);
+			}
+			if(!e || (d->msg[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+				++d->stats.dropped;
+				continue;
+			}
+			e->last = d->now;
+
+			unsigned char *p = (unsigned char *)d->iov[i].iov_base;
+			int len = d->msg[i].msg_len;
+			int hlen = d->decode(e, p, len, &d->outAddr[outs]);
+			if(hlen == 0) {
+				++d->stats.dropped;
+				continue;
+			}
+			d->setOut(outs, (char *)p + hlen, len - hlen, &d->outAddr[outs]);
+			d->outSession[outs] = e;
+			++outs;
+		}
+
+		// each session has its own socket, so send per run of one session
+		int at = 0;
+		while(at < outs) {
+			int end = at + 1;
+			while(end < outs && d->outSession[end] == d->outSession[at])
+				++end;
+			int sent = relay_send(d->outSession[at]->fd, d->out + at, end - at);
+			d->stats.toTarget += sent;
+			d->stats.dropped += (end - at) - sent;
+			at = end;
+		}
+
+		if(n < RELAY_BATCH)
+			return;
+	}
+
+	// more is waiting, pick it up after the rest of the event loop had a turn
+	d->sn->retry();
+}
+
+void UDPRelay::sn_target(int s)
+{
+	Session *e = d->byFd.find(s);
+	if(!e)
+		return;
+
+	d->now = d->clock.elapsed();
+	for(int round = 0; round < RELAY_ROUNDS; ++round) {
+		int n = d->receive(s, RELAY_HEADROOM);
+		if(n <= 0)
+			return;
+		e->last = d->now;
+
+		// write the header into the room in front of each datagram, naming
+		//   the sender
+		int outs = 0;
+		for(int i = 0; i < n; ++i) {
+			if(d->msg[i].msg_hdr.msg_flags & MSG_TRUNC) {
+				++d->stats.dropped;
+				continue;
+			}
+			unsigned char *p = (unsigned char *)d->slot[i].data();
+			p[0] = 0x00; // reserved
+			p[1] = 0x00; // reserved
+			p[2] = 0x00; // frag
+			p[3] = 0x01; // address type = ipv4
+			memcpy(p + 4, &d->peer[i].sin_addr.s_addr, 4);
+			memcpy(p + 8, &d->peer[i].sin_port, 2);
+			d->setOut(outs++, (char *)p, RELAY_HEADROOM + d->msg[i].msg_len, &e->client);
+		}
+
+		int sent = relay_send(d->fd, d->out, outs);
+		d->stats.toClient += sent;
+		d->stats.dropped += outs - sent;
+
+		if(n < RELAY_BATCH)
+			return;
+	}
+
+	e->sn->retry();
+}
+
+void UDPRelay::dns_resultsReady()
+{
+	NDns *dns = (NDns *)sender();
+	QDictIterator<Name> it(d->names);
+	for(Name *n; (n = it.current()); ++it) {
+		if(n->dns != dns)
+			continue;
+		n->done = true;
+		n->ok = (dns->result() != 0);
+		n->addr = htonl(dns->result());
+		n->when = d->clock.elapsed();
+		if(n->owner) {
+			--n->owner->lookups;
+			n->owner = 0;
+		}
+		n->dns = 0;
+		dns->deleteLater();
+		break;
+	}
+}
+
+void UDPRelay::t_timeout()
+{
+	int now = d->clock.elapsed();
+
+	QPtrList<Session> idle;
+	QIntDictIterator<Session> it(d->byFd);
+	for(Session *e; (e = it.current()); ++it) {
+		if(now - e->last > d->idleTimeout)
+			idle.append(e);
+	}
+	QPtrListIterator<Session> lit(idle);
+	for(Session *e; (e = lit.current()); ++lit) {
+#ifdef PROX_DEBUG
+		fprintf(stderr, "UDPRelay: session for %s:%d expired\n", inet_ntoa(e->client.sin_addr), ntohs(e->client.sin_port));
+#endif
+		d->close(e);
+	}
+
+	// names are looked up again once in a while
+	QStringList stale;
+	QDictIterator<Name> nit(d->names);
+	for(Name *n; (n = nit.current()); ++nit) {
+		if(n->done && now - n->when > (n->ok ? RELAY_NAME_MSECS : RELAY_NAME_FAIL_MSECS))
+			stale.append(nit.currentKey());
+	}
+	for(QStringList::ConstIterator sit = stale.begin(); sit != stale.end(); ++sit)
+		d->names.remove(*sit);
+}
+
+#else
+
+class UDPRelay::Private
+{
+public:
+	Private() {}
+};
+
+UDPRelay::UDPRelay(QObject *parent)
+:QObject(parent)
+{
+	d = new Private;
+}
+
+UDPRelay::~UDPRelay()
+{
+	delete d;
+}
+
+bool UDPRelay::bind(Q_UINT16)
+{
+	return false;
+}
+
+void UDPRelay::stop()
+{
+}
+
+bool UDPRelay::isActive() const
+{
+	return false;
+}
+
+int UDPRelay::port() const
+{
+	return 0;
+}
+
+void UDPRelay::setIdleTimeout(int)
+{
+}
+
+int UDPRelay::allow(const QHostAddress &, int)
+{
+	return -1;
+}
+
+void UDPRelay::revoke(int)
+{
+}
+
+UDPRelayStats UDPRelay::stats() const
+{
+	UDPRelayStats s;
+	s.toTarget = 0;
+	s.toClient = 0;
+	s.dropped = 0;
+	s.sessions = 0;
+	return s;
+}
+
+void UDPRelay::sn_client(int)
+{
+}
+
+void UDPRelay::sn_target(int)
+{
+}
+
+void UDPRelay::dns_resultsReady()
+{
+}
+
+void UDPRelay::t_timeout()
+{
+}
+#endif
+
+// CS_NAMESPACE_END
@@ -0,0 +1,69 @@
+/*
+ * udprelay.h - relay for SOCKS5 UDP associations
+ * Copyright (C) 2003  Justin Karneges
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CS_UDPRELAY_H
+#define CS_UDPRELAY_H
+
+#include<qobject.h>
+#include<qhostaddress.h>
+
+// CS_NAMESPACE_BEGIN
+
+struct UDPRelayStats
+{
+	Q_ULLONG toTarget, toClient;
+	Q_ULLONG dropped;
+	int sessions;
+};
+
+class UDPRelay : public QObject
+{
+	Q_OBJECT
+public:
+	UDPRelay(QObject *parent=0);
+	~UDPRelay();
+
+	bool bind(Q_UINT16 port=0);
+	void stop();
+	bool isActive() const;
+	int port() const;
+
+	void setIdleTimeout(int secs);
+	int allow(const QHostAddress &addr, int port=0);
+	void revoke(int id);
+
+	UDPRelayStats stats() const;
+
+private slots:
+	void sn_client(int);
+	void sn_target(int);
+	void dns_resultsReady();
+	void t_timeout();
+
+private:
+	class Private;
+	Private *d;
+	class Session;
+	class Name;
+};
+
+// CS_NAMESPACE_END
+
+#endif
@@ -0,0 +1,497 @@
+/*
+ * workerpool.cpp - hand accepted connections to worker processes
+ * Copyright (C) 2003  Justin Karneges
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+//! \class WorkerPool workerpool.h
+//! \brief Spreads accepted connections over several worker processes
+//!
+//! Everything in this library runs on the one Qt event loop, which caps a
+//! busy server at a single core.  WorkerPool gets around that by forking
+//! worker processes, each with its own event loop and its own, disjoint set
+//! of connections.  The original process (the acceptor) keeps the listening
+//! socket, and passes every accepted descriptor over a UNIX socket to the
+//! worker with the fewest open connections, where connectionReady() is
+//! emitted for it.
+//!
+//! Workers are processes rather than threads because the Qt 3 event loop,
+//! and with it QSocket, QSocketNotifier and QTimer, only works in the GUI
+//! thread.
+//!
+//! Call start() after the listening socket is set up, but before entering the
+//! event loop, starting any threads, or enabling the epoll Reactor (whose
+//! descriptor would end up shared by all processes).  It returns in the
+//! acceptor as well as in every worker; use isWorker() to tell them apart.
+//! Normally the pool is attached to a ServSock (or a SocksServer or
+//! RTSP::Server) with setWorkerPool(), which takes care of the rest.
+//!
+//! A worker should call connectionFinished() whenever it is done with a
+//! connection, so that the acceptor can keep track of the load.  A worker
+//! that accepts connections on a listening socket of its own (see
+//! ServSock::ReusePort) reports those with connectionAccepted().  If a worker
+//! exits, workerDied() is emitted in the acceptor and no more connections are
+//! sent there.  If the acceptor exits, acceptorGone() is emitted in the
+//! workers.
+
+#include"workerpool.h"
+
+#include<qguardedptr.h>
+#include<qtimer.h>
+#include"reactor.h"
+
+#if defined(Q_OS_UNIX) && !defined(NO_WORKERS)
+# include<sys/types.h>
+# include<sys/socket.h>
+# include<sys/wait.h>
+# include<unistd.h>
+# include<fcntl.h>
+# include<errno.h>
+# include<string.h>
+# define HAVE_WORKERS
+#endif
+
+#ifdef PROX_DEBUG
+#include<stdio.h>
+#endif
+
+// what a worker tells the acceptor, one byte per event
+#define REPORT_FINISHED 0
+#define REPORT_ACCEPTED 1
+
+// msecs between tries at reaping workers that hadn't exited yet when removed
+#define REAP_MSECS 1000
+
+// CS_NAMESPACE_BEGIN
+
+#ifdef HAVE_WORKERS
+static bool set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+	return (flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1);
+}
+
+// one byte, carrying the descriptor along as ancillary data
+static bool send_socket(int channel, int s)
+{
+	char c = 0;
+	struct iovec iov;
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	memset(cbuf, 0, sizeof(cbuf));
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &s, sizeof(int));
+
+	int flags = 0;
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	return (sendmsg(channel, &msg, flags) == 1);
+}
+
+// returns the descriptor received, -1 if there is nothing to read, or -2 once
+//   the other end is closed
+static int recv_socket(int channel)
+{
+	char c;
+	struct iovec iov;
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	int r = recvmsg(channel, &msg, 0);
+	if(r == 0)
+		return -2;
+	if(r < 0)
+		return (errno == EAGAIN || errno == EINTR ? -1 : -2);
+
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+	if(!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+		return -1;
+	int s;
+	memcpy(&s, CMSG_DATA(cm), sizeof(int));
+	return s;
+}
+#endif
+
+class WorkerPool::Private
+{
+public:
+	Private() {}
+
+	class Worker
+	{
+	public:
+		int fd;
+		SocketWatcher *sn;
+		WorkerStats stats;
+	};
+
+	// acceptor: one entry per worker
+	QValueList<Worker> workers;
+
+	// acceptor: removed workers that are still to be waited for
+	QValueList<int> unreaped;
+	QTimer reap;
+
+	// worker: the channel back to the acceptor
+	int index;
+	int fd;
+	SocketWatcher *sn;
+};
+
+WorkerPool::WorkerPool(QObject *parent)
+:QObject(parent)
+{
+	d = new Private;
+	d->index = -1;
+	d->fd = -1;
+	d->sn = 0;
+	connect(&d->reap, SIGNAL(timeout()), SLOT(reap_timeout()));
+}
+
+WorkerPool::~WorkerPool()
+{
+#ifdef HAVE_WORKERS
+	// closing the channels tells the workers (or the acceptor) to go away
+	for(QValueList<Private::Worker>::Iterator it = d->workers.begin(); it != d->workers.end(); ++it) {
+		delete (*it).sn;
+		if((*it).fd != -1)
+			::close((*it).fd);
+	}
+	delete d->sn;
+	if(d->fd != -1)
+		::close(d->fd);
+#endif
+	delete d;
+}
+
+//!
+//! Forks \a count worker processes.  Returns TRUE, in the acceptor and in
+//! each worker, if at least one worker could be started.
+bool WorkerPool::start(int count)
+{
+#ifdef HAVE_WORKERS
+	if(isWorker() || !d->workers.isEmpty() || count <= 0)
+		return false;
+
+	for(int n = 0; n < count; ++n) {
+		int pair[2];
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1)
+			break;
+
+		pid_t pid = fork();
+		if(pid == -1) {
+			::close(pair[0]);
+			::close(pair[1]);
+			break;
+		}
+
+		if(pid == 0) {
+			// the channels to the other workers belong to the acceptor
+			for(QValueList<Private::Worker>::Iterator it = d->workers.begin(); it != d->workers.end(); ++it) {
+				delete (*it).sn;
+				::close((*it).fd);
+			}
+			d->workers.clear();
+			::close(pair[0]);
+
+			d->index = n;
+			d->fd = pair[1];
+			set_nonblocking(d->fd);
+			d->sn = new SocketWatcher(d->fd, SocketWatcher::Read);
+			connect(d->sn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
+			return true;
+		}
+
+		::close(pair[1]);
+		set_nonblocking(pair[0]);
+
+		Private::Worker w;
+		w.fd = pair[0];
+		w.sn = new SocketWatcher(w.fd, SocketWatcher::Read);
+		connect(w.sn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
+		w.stats.pid = pid;
+		w.stats.alive = true;
+		w.stats.handed = 0;
+		w.stats.finished = 0;
+		d->workers.append(w);
+#ifdef PROX_DEBUG
+		fprintf(stderr, "WorkerPool: started worker %d, pid %d\n", n, (int)pid);
+#endif
+	}
+	return !d->workers.isEmpty();
+#else
+	Q_UNUSED(count);
+	return false;
+#endif
+}
+
+//!
+//! Returns the number of workers started, in the acceptor.
+int WorkerPool::count() const
+{
+	return d->workers.count();
+}
+
+//!
+//! Returns TRUE if this process is one of the workers.
+bool WorkerPool::isWorker() const
+{
+	return (d->index != -1);
+}
+
+//!
+//! Returns the index of this worker, counting from 0, or -1 in the acceptor.
+int WorkerPool::workerIndex() const
+{
+	return d->index;
+}
+
+//!
+//! Passes accepted socket \a s to the least loaded worker, and closes it here.
+//! Returns FALSE if no worker could take it, in which case the socket is left
+//! open for the caller to serve or close.
+bool WorkerPool::dispatch(int s)
+{
+#ifdef HAVE_WORKERS
+	// a worker whose channel is full is busy (or stuck), so try the others
+	QValueList<int> tried;
+	while(1) {
+		int best = -1;
+		Q_ULLONG bestLoad = 0;
+		int n = 0;
+		for(QValueList<Private::Worker>::ConstIterator it = d->workers.begin(); it != d->workers.end(); ++it, ++n) {
+			if(!(*it).stats.alive || tried.contains(n))
+				continue;
+			Q_ULLONG load = (*it).stats.handed - (*it).stats.finished;
+			if(best == -1 || load < bestLoad) {
+				best = n;
+				bestLoad = load;
+			}
+		}
+		if(best == -1)
+			return false;
+
+		Private::Worker &w = d->workers[best];
+		if(send_socket(w.fd, s)) {
+			::close(s);
+			++w.stats.handed;
+#ifdef PROX_DEBUG
+			fprintf(stderr, "WorkerPool: connection to worker %d (%d open)\n", best, (int)(w.stats.handed - w.stats.finished));
+#endif
+			return true;
+		}
+
+		if(errno == EAGAIN || errno == EINTR)
+			tried += best;
+		else {
+			removeWorker(best);
+			workerDied(best);
+		}
+	}
+#else
+	Q_UNUSED(s);
+	return false;
+#endif
+}
+
+//!
+//! Returns the statistics of each worker, in the acceptor.  The number of
+//! connections a worker currently has open is handed - finished, where
+//! handed includes the connections the worker reported accepting itself.
+WorkerStatsList WorkerPool::stats() const
+{
+	WorkerStatsList list;
+	for(QValueList<Private::Worker>::ConstIterator it = d->workers.begin(); it != d->workers.end(); ++it)
+		list += (*it).stats;
+	return list;
+}
+
+//!
+//! Tells the acceptor that this worker has accepted a connection by itself.
+//! Does nothing in the acceptor.
+void WorkerPool::connectionAccepted()
+{
+	report(REPORT_ACCEPTED);
+}
+
+//!
+//! Tells the acceptor that this worker is done with one of its connections.
+//! Does nothing in the acceptor.
+void WorkerPool::connectionFinished()
+{
+	report(REPORT_FINISHED);
+}
+
+void WorkerPool::report(char c)
+{
+#ifdef HAVE_WORKERS
+	if(d->fd == -1)
+		return;
+
+	// if the channel is full the acceptor isn't reading, and the count is
+	//   off by one at worst
+	int flags = 0;
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	send(d->fd, &c, 1, flags);
+#else
+	Q_UNUSED(c);
+#endif
+}
+
+void WorkerPool::sn_activated(int fd)
+{
+#ifdef HAVE_WORKERS
+	if(fd == d->fd) {
+		readAcceptor();
+		return;
+	}
+
+	int n = 0;
+	for(QValueList<Private::Worker>::ConstIterator it = d->workers.begin(); it != d->workers.end(); ++it, ++n) {
+		if((*it).fd == fd) {
+			readWorker(n);
+			return;
+		}
+	}
+#else
+	Q_UNUSED(fd);
+#endif
+}
+
+void WorkerPool::readAcceptor()
+{
+#ifdef HAVE_WORKERS
+	// drain the channel, the watcher may be edge-triggered
+	QGuardedPtr<QObject> self = this;
+	while(d->fd != -1) {
+		int s = recv_socket(d->fd);
+		if(s == -1)
+			break;
+		if(s == -2) {
+			delete d->sn;
+			d->sn = 0;
+			::close(d->fd);
+			d->fd = -1;
+#ifdef PROX_DEBUG
+			fprintf(stderr, "WorkerPool: worker %d: acceptor gone\n", d->index);
+#endif
+			acceptorGone();
+			return;
+		}
+
+		connectionReady(s);
+		if(!self)
+			return;
+	}
+#endif
+}
+
+void WorkerPool::readWorker(int n)
+{
+#ifdef HAVE_WORKERS
+	// each byte stands for one connection accepted or finished
+	Private::Worker &w = d->workers[n];
+	char buf[256];
+	while(1) {
+		int r = ::read(w.fd, buf, sizeof(buf));
+		if(r > 0) {
+			for(int i = 0; i < r; ++i) {
+				if(buf[i] == REPORT_ACCEPTED)
+					++w.stats.handed;
+				else
+					++w.stats.finished;
+			}
+			continue;
+		}
+		if(r < 0 && (errno == EAGAIN || errno == EINTR))
+			break;
+
+		removeWorker(n);
+		workerDied(n);
+		return;
+	}
+#else
+	Q_UNUSED(n);
+#endif
+}
+
+void WorkerPool::removeWorker(int n)
+{
+#ifdef HAVE_WORKERS
+	Private::Worker &w = d->workers[n];
+	if(!w.stats.alive)
+		return;
+	w.stats.alive = false;
+	delete w.sn;
+	w.sn = 0;
+	::close(w.fd);
+	w.fd = -1;
+
+	// reap it if it's gone already.  otherwise it exits on its own once it
+	//   sees the channel close, and is reaped later
+	if(waitpid(w.stats.pid, 0, WNOHANG) == 0) {
+		d->unreaped += w.stats.pid;
+		if(!d->reap.isActive())
+			d->reap.start(REAP_MSECS);
+	}
+#ifdef PROX_DEBUG
+	fprintf(stderr, "WorkerPool: worker %d (pid %d) removed\n", n, w.stats.pid);
+#endif
+#else
+	Q_UNUSED(n);
+#endif
+}
+
+void WorkerPool::reap_timeout()
+{
+#ifdef HAVE_WORKERS
+	for(QValueList<int>::Iterator it = d->unreaped.begin(); it != d->unreaped.end();) {
+		// gone, or not ours to wait for after all
+		if(waitpid(*it, 0, WNOHANG) != 0)
+			it = d->unreaped.remove(it);
+		else
+			++it;
+	}
+	if(d->unreaped.isEmpty())
+		d->reap.stop();
+#endif
+}
+
+// CS_NAMESPACE_END
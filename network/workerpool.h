@@ -0,0 +1,79 @@
+/*
+ * workerpool.h - hand accepted connections to worker processes
+ * Copyright (C) 2003  Justin Karneges
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CS_WORKERPOOL_H
+#define CS_WORKERPOOL_H
+
+#include<qobject.h>
+#include<qvaluelist.h>
+
+// CS_NAMESPACE_BEGIN
+
+struct WorkerStats
+{
+	int pid;
+	bool alive;
+	Q_ULLONG handed, finished;
+};
+
+typedef QValueList<WorkerStats> WorkerStatsList;
+
+class WorkerPool : public QObject
+{
+	Q_OBJECT
+public:
+	WorkerPool(QObject *parent=0);
+	~WorkerPool();
+
+	bool start(int count);
+	int count() const;
+	bool isWorker() const;
+	int workerIndex() const;
+
+	// acceptor
+	bool dispatch(int socket);
+	WorkerStatsList stats() const;
+
+	// worker
+	void connectionAccepted();
+	void connectionFinished();
+
+signals:
+	void connectionReady(int);
+	void workerDied(int index);
+	void acceptorGone();
+
+private slots:
+	void sn_activated(int);
+	void reap_timeout();
+
+private:
+	class Private;
+	Private *d;
+
+	void readAcceptor();
+	void readWorker(int index);
+	void removeWorker(int index);
+	void report(char);
+};
+
+// CS_NAMESPACE_END
+
+#endif
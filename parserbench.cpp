@@ -0,0 +1,195 @@
+#include<qstring.h>
+#include<qstringlist.h>
+#include<qcstring.h>
+#include"bytestream.h"
+#include"httpparser.h"
+
+#include<stdio.h>
+#include<string.h>
+#include<sys/time.h>
+
+static const char *response =
+	"HTTP/1.1 200 OK\r\n"
+	"Date: Mon, 03 Nov 2003 12:00:00 GMT\r\n"
+	"Server: Apache/1.3.27 (Unix)\r\n"
+	"Set-Cookie: ID=0123456789abcdef:0; path=/\r\n"
+	"Cache-Control: no-cache, must-revalidate\r\n"
+	"Expires: Thu, 01 Jan 1970 00:00:00 GMT\r\n"
+	"Pragma: no-cache\r\n"
+	"Connection: Keep-Alive\r\n"
+	"Keep-Alive: timeout=15, max=100\r\n"
+	"Content-Type: application/octet-stream\r\n"
+	"Content-Length: 42\r\n"
+	"\r\n";
+
+static long usecs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// the way the header used to be read, for comparison
+static QString extractLine(QByteArray *buf, bool *found)
+{
+	int n;
+	for(n = 0; n < (int)buf->size()-1; ++n) {
+		if(buf->at(n) == '\r' && buf->at(n+1) == '\n') {
+			QCString cstr;
+			cstr.resize(n+1);
+			memcpy(cstr.data(), buf->data(), n);
+			n += 2;
+
+			memmove(buf->data(), buf->data() + n, buf->size() - n);
+			buf->resize(buf->size() - n);
+			QString s = QString::fromUtf8(cstr);
+
+			if(found)
+				*found = true;
+			return s;
+		}
+	}
+
+	if(found)
+		*found = false;
+	return "";
+}
+
+static bool extractMainHeader(const QString &line, QString *proto, int *code, QString *msg)
+{
+	int n = line.find(' ');
+	if(n == -1)
+		return false;
+	if(proto)
+		*proto = line.mid(0, n);
+	++n;
+	int n2 = line.find(' ', n);
+	if(n2 == -1)
+		return false;
+	if(code)
+		*code = line.mid(n, n2-n).toInt();
+	n = n2+1;
+	if(msg)
+		*msg = line.mid(n);
+	return true;
+}
+
+static QString findHeader(const QStringList &lines, const QString &var)
+{
+	QString low = var.lower();
+	for(QStringList::ConstIterator it = lines.begin(); it != lines.end(); ++it) {
+		const QString &s = *it;
+		int n = s.find(':');
+		if(n == -1)
+			continue;
+		if(s.mid(0, n).stripWhiteSpace().lower() == low)
+			return s.mid(n+1).stripWhiteSpace();
+	}
+	return QString::null;
+}
+
+static int runLines(const QValueList<QByteArray> &pieces)
+{
+	QByteArray buf;
+	QStringList lines;
+	bool inHeader = true;
+	for(QValueList<QByteArray>::ConstIterator it = pieces.begin(); it != pieces.end() && inHeader; ++it) {
+		ByteStream::appendArray(&buf, *it);
+		while(1) {
+			bool found;
+			QString line = extractLine(&buf, &found);
+			if(!found)
+				break;
+			if(line.isEmpty()) {
+				inHeader = false;
+				break;
+			}
+			lines += line;
+		}
+	}
+	if(inHeader)
+		return -1;
+
+	QString proto, msg;
+	int code;
+	QString str = lines.first();
+	lines.remove(lines.begin());
+	if(!extractMainHeader(str, &proto, &code, &msg))
+		return -1;
+	findHeader(lines, "Connection");
+	findHeader(lines, "Transfer-Encoding");
+	return findHeader(lines, "Content-Length").toInt();
+}
+
+static int runParser(const QValueList<QByteArray> &pieces)
+{
+	QByteArray buf;
+	HttpResponseParser p;
+	int r = 0;
+	for(QValueList<QByteArray>::ConstIterator it = pieces.begin(); it != pieces.end() && r == 0; ++it) {
+		ByteStream::appendArray(&buf, *it);
+		r = p.parse(buf.data(), buf.size());
+	}
+	if(r <= 0)
+		return -1;
+
+	p.connection();
+	p.isChunked();
+	return p.contentLength();
+}
+
+int main(int argc, char **argv)
+{
+	int total = 200000;
+	int split = 0;
+	for(int n = 1; n < argc; ++n) {
+		QString s = argv[n];
+		if(s.left(8) == "--total=")
+			total = s.mid(8).toInt();
+		else if(s.left(8) == "--split=")
+			split = s.mid(8).toInt();
+		else {
+			printf("usage: parserbench [--total=N] [--split=bytes]\n\n");
+			return 0;
+		}
+	}
+	if(total < 1 || split < 0) {
+		printf("total must be positive\n");
+		return 1;
+	}
+
+	// the response as it arrives, in pieces of split bytes
+	int len = strlen(response);
+	if(split == 0)
+		split = len;
+	QValueList<QByteArray> pieces;
+	for(int at = 0; at < len; at += split) {
+		QByteArray a(QMIN(split, len - at));
+		memcpy(a.data(), response + at, a.size());
+		pieces += a;
+	}
+
+	printf("%d responses of %d bytes, arriving in %d pieces\n", total, len, (int)pieces.count());
+
+	long start = usecs();
+	for(int n = 0; n < total; ++n) {
+		if(runLines(pieces) != 42) {
+			printf("line parser failed\n");
+			return 1;
+		}
+	}
+	double secs = (usecs() - start) / 1000000.0;
+	printf("lines:  %.2f seconds, %.0f responses/sec\n", secs, secs > 0 ? total / secs : 0.0);
+
+	start = usecs();
+	for(int n = 0; n < total; ++n) {
+		if(runParser(pieces) != 42) {
+			printf("HttpResponseParser failed\n");
+			return 1;
+		}
+	}
+	secs = (usecs() - start) / 1000000.0;
+	printf("parser: %.2f seconds, %.0f responses/sec\n", secs, secs > 0 ? total / secs : 0.0);
+
+	return 0;
+}
@@ -0,0 +1,15 @@
+CONFIG += thread
+TARGET  = parserbench
+
+INCLUDEPATH += util network
+
+HEADERS = \
+	util/bytestream.h \
+	util/bufferpool.h \
+	network/httpparser.h
+
+SOURCES = \
+	util/bytestream.cpp \
+	util/bufferpool.cpp \
+	network/httpparser.cpp \
+	parserbench.cpp
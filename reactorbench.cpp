@@ -0,0 +1,150 @@
+#include"reactorbench.h"
+
+#include<qapplication.h>
+#include<qeventloop.h>
+#include<qptrlist.h>
+#include<qmemarray.h>
+#include"reactor.h"
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/time.h>
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<sys/resource.h>
+#include<sys/select.h>
+
+// sockets made ready per round
+#define BURST 100
+
+static long usecs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+class App::Private
+{
+public:
+	Private() {}
+
+	QPtrList<SocketWatcher> watchers;
+	QMemArray<int> peers;
+	int got;
+};
+
+App::App()
+:QObject(0)
+{
+	d = new Private;
+	d->watchers.setAutoDelete(true);
+	d->got = 0;
+}
+
+App::~App()
+{
+	delete d;
+}
+
+void App::run(int sockets, int rounds)
+{
+	// one end is watched, the other is written to
+	d->peers.resize(sockets);
+	int made = 0;
+	for(; made < sockets; ++made) {
+		int sv[2];
+		if(socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) == -1)
+			break;
+		fcntl(sv[0], F_SETFL, O_NONBLOCK);
+		if(!Reactor::isEnabled() && sv[0] >= FD_SETSIZE) {
+			::close(sv[0]);
+			::close(sv[1]);
+			break;
+		}
+		SocketWatcher *sw = new SocketWatcher(sv[0], SocketWatcher::Read);
+		connect(sw, SIGNAL(activated(int)), SLOT(sw_activated(int)));
+		d->watchers.append(sw);
+		d->peers[made] = sv[1];
+	}
+
+	if(made < sockets) {
+		printf("%6d sockets: only %d could be watched%s\n", sockets, made, Reactor::isEnabled() ? "" : " (select limit)");
+	}
+	else {
+		int burst = QMIN(BURST, sockets);
+		long total = 0;
+		for(int r = 0; r < rounds; ++r) {
+			d->got = 0;
+			long start = usecs();
+			for(int n = 0; n < burst; ++n)
+				::write(d->peers[rand() % sockets], "x", 1);
+			while(d->got < burst)
+				qApp->eventLoop()->processEvents(QEventLoop::WaitForMore);
+			total += usecs() - start;
+		}
+		printf("%6d sockets: %8.2f usec per wakeup\n", sockets, (double)total / (rounds * burst));
+	}
+
+	QPtrListIterator<SocketWatcher> it(d->watchers);
+	for(SocketWatcher *sw; (sw = it.current()); ++it)
+		::close(sw->socket());
+	d->watchers.clear();
+	for(int n = 0; n < made; ++n)
+		::close(d->peers[n]);
+}
+
+void App::sw_activated(int s)
+{
+	// drain, the watcher may be edge-triggered
+	char buf[64];
+	while(::read(s, buf, sizeof(buf)) > 0)
+		++d->got;
+}
+
+int main(int argc, char **argv)
+{
+	QApplication app(argc, argv, false);
+
+	bool epoll = false;
+	int rounds = 100;
+	QValueList<int> counts;
+	for(int n = 1; n < argc; ++n) {
+		QString s = argv[n];
+		if(s == "--epoll")
+			epoll = true;
+		else if(s.left(9) == "--rounds=")
+			rounds = s.mid(9).toInt();
+		else if(s.toInt() > 0)
+			counts += s.toInt();
+		else {
+			printf("usage: reactorbench [--epoll] [--rounds=N] [sockets ...]\n\n");
+			return 0;
+		}
+	}
+	if(counts.isEmpty())
+		counts << 100 << 1000 << 5000 << 20000;
+
+	if(epoll && !Reactor::isAvailable()) {
+		printf("epoll is not available here\n");
+		return 1;
+	}
+	Reactor::setEnabled(epoll);
+
+	// each socket needs two descriptors
+	struct rlimit rl;
+	if(getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	printf("dispatch through %s, %d ready sockets per round, %d rounds\n", epoll ? "epoll" : "select", BURST, rounds);
+	App *a = new App;
+	for(QValueList<int>::ConstIterator it = counts.begin(); it != counts.end(); ++it)
+		a->run(*it, rounds);
+	delete a;
+
+	return 0;
+}
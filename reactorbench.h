@@ -0,0 +1,23 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include<qobject.h>
+
+class App : public QObject
+{
+	Q_OBJECT
+public:
+	App();
+	~App();
+
+	void run(int sockets, int rounds);
+
+private slots:
+	void sw_activated(int);
+
+private:
+	class Private;
+	Private *d;
+};
+
+#endif
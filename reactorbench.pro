@@ -0,0 +1,12 @@
+CONFIG += thread
+TARGET  = reactorbench
+
+INCLUDEPATH += util
+
+HEADERS = \
+	util/reactor.h \
+	reactorbench.h
+
+SOURCES = \
+	util/reactor.cpp \
+	reactorbench.cpp
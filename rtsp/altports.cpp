@@ -21,8 +21,37 @@
 #include "altports.h"
 
 #include <qsocketdevice.h>
-#include <qsocketnotifier.h>
 #include <qptrlist.h>
+#include <qguardedptr.h>
+#include <qtimer.h>
+#include "reactor.h"
+#include "bufferpool.h"
+
+#include <errno.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+#if defined(Q_OS_LINUX) && !defined(NO_MMSG)
+#define HAVE_MMSG
+#endif
+
+#define UDP_BUFSIZE    8192
+#define UDP_BATCH      32   // datagrams per system call
+#define UDP_DRAIN_MAX  4    // batches per wakeup, so one socket can't starve the rest
+#define UDP_QUEUE_MAX  256
+
+#ifdef HAVE_MMSG
+# define UDP_SCRATCH   UDP_BATCH
+#else
+# define UDP_SCRATCH   1
+#endif
+
+// why a send failed
+enum { SendFull, SendRefused, SendFailed };
 
 //----------------------------------------------------------------------------
 // PortRange
@@ -121,15 +150,20 @@ public:
 			return 0;
 		UDPItem *i = new UDPItem;
 		i->sd = sd;
-		i->sn = new QSocketNotifier(i->sd->socket(), QSocketNotifier::Read);
+		i->sn = new SocketWatcher(i->sd->socket(), SocketWatcher::Read);
 		i->connect(i->sn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
+		i->wn = new SocketWatcher(i->sd->socket(), SocketWatcher::Write);
+		i->wn->setEnabled(false);
+		i->connect(i->wn, SIGNAL(activated(int)), SLOT(wn_activated(int)));
 		i->_port = port;
+		i->flushPending = false;
 		//printf("UDP BIND: [%d]\n", port);
 		return i;
 	}
 
 	~UDPItem()
 	{
+		delete wn;
 		delete sn;
 		delete sd;
 		//printf("UDP UNBIND: [%d]\n", _port);
@@ -142,23 +176,101 @@ public:
 
 	void write(const QByteArray &buf, const QHostAddress &addr, int port)
 	{
-		sd->setBlocking(true);
-		sd->writeBlock(buf.data(), buf.size(), addr, port);
-		sd->setBlocking(false);
+		// the socket stays non-blocking, so sends are queued and flushed
+		//   together once control returns to the event loop
+		if((int)outq.count() >= UDP_QUEUE_MAX)
+			return; // it's UDP, drop it
+
+		UDPPacket p;
+		p.addr = addr;
+		p.port = port;
+		p.buf = buf;
+		outq.append(p);
+
+		if((int)outq.count() >= UDP_BATCH && !wn->isEnabled())
+			flush();
+		else if(!flushPending)
+		{
+			flushPending = true;
+			QTimer::singleShot(0, this, SLOT(flush()));
+		}
 	}
 
 signals:
-	void packetReady(const QByteArray &buf, const QHostAddress &addr, int port);
+	void packetsReady(const UDPPacketList &list);
 
 private slots:
 	void sn_activated(int)
 	{
-		QByteArray buf(8192);
-		int actual = sd->readBlock(buf.data(), buf.size());
-		buf.resize(actual);
-		QHostAddress pa = sd->peerAddress();
-		int pp = sd->peerPort();
-		packetReady(buf, pa, pp);
+		QGuardedPtr<UDPItem> self = this;
+		for(int n = 0; n < UDP_DRAIN_MAX; ++n)
+		{
+			UDPPacketList list;
+			int count = readBatch(&list);
+			if(count <= 0)
+				return;
+
+			packetsReady(list);
+
+			// hand the buffers back, if nobody kept them
+			QValueList<QByteArray> bufs;
+			for(UDPPacketList::ConstIterator it = list.begin(); it != list.end(); ++it)
+				bufs += (*it).buf;
+			list.clear();
+			for(QValueList<QByteArray>::ConstIterator it = bufs.begin(); it != bufs.end(); ++it)
+				BufferPool::give(*it);
+
+			if(!self || count < UDP_BATCH)
+				return;
+		}
+
+		// gave up before the socket ran dry, come back for the rest
+		sn->retry();
+	}
+
+	void wn_activated(int)
+	{
+		wn->setEnabled(false);
+		flush();
+	}
+
+	void flush()
+	{
+		flushPending = false;
+		bool retried = false;
+		while(!outq.isEmpty())
+		{
+			int err;
+			int count = writeBatch(&err);
+			if(count < 0)
+			{
+				// full?  wait until there is room
+				if(err == SendFull)
+				{
+					wn->setEnabled(true);
+					break;
+				}
+
+				// an ICMP error from an earlier datagram is reported by the
+				//   next send, which then didn't happen.  try it again.
+				if(err == SendRefused && !retried)
+				{
+					retried = true;
+					continue;
+				}
+
+				// otherwise the first packet is bad, skip it
+				count = 1;
+			}
+			retried = false;
+			for(int n = 0; n < count; ++n)
+			{
+				// relayed packets are usually our own receive buffers
+				QByteArray buf = outq.first().buf;
+				outq.remove(outq.begin());
+				BufferPool::give(buf);
+			}
+		}
 	}
 
 private:
@@ -167,8 +279,130 @@ private:
 	}
 
 	QSocketDevice *sd;
-	QSocketNotifier *sn;
+	SocketWatcher *sn, *wn;
 	int _port;
+	UDPPacketList outq;
+	bool flushPending;
+
+	// full-size receive buffers, shared by every socket since a batch is
+	//   copied out before the next one is read
+	static QByteArray *scratch()
+	{
+		static QByteArray *bufs = 0;
+		if(!bufs)
+		{
+			bufs = new QByteArray[UDP_SCRATCH];
+			for(int n = 0; n < UDP_SCRATCH; ++n)
+				bufs[n].resize(UDP_BUFSIZE);
+		}
+		return bufs;
+	}
+
+	int readBatch(UDPPacketList *list)
+	{
+		// datagrams land in the scratch buffers and are copied out at their
+		//   real size, so that the pool hands out the same sizes it gets back
+		QByteArray *bufs = scratch();
+		int count = 0;
+
+#ifdef HAVE_MMSG
+		mmsghdr msgs[UDP_BATCH];
+		iovec iov[UDP_BATCH];
+		sockaddr_in from[UDP_BATCH];
+		memset(msgs, 0, sizeof(msgs));
+		for(int n = 0; n < UDP_BATCH; ++n)
+		{
+			iov[n].iov_base = bufs[n].data();
+			iov[n].iov_len = bufs[n].size();
+			msgs[n].msg_hdr.msg_iov = &iov[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			msgs[n].msg_hdr.msg_name = &from[n];
+			msgs[n].msg_hdr.msg_namelen = sizeof(from[n]);
+		}
+
+		count = recvmmsg(sd->socket(), msgs, UDP_BATCH, MSG_DONTWAIT, 0);
+		for(int n = 0; n < count; ++n)
+		{
+			UDPPacket p;
+			p.addr = QHostAddress(ntohl(from[n].sin_addr.s_addr));
+			p.port = ntohs(from[n].sin_port);
+			p.buf = BufferPool::take(msgs[n].msg_len);
+			memcpy(p.buf.data(), bufs[n].data(), msgs[n].msg_len);
+			list->append(p);
+		}
+#else
+		for(; count < UDP_BATCH; ++count)
+		{
+			int actual = sd->readBlock(bufs[0].data(), bufs[0].size());
+			if(actual < 0)
+				break;
+			UDPPacket p;
+			p.addr = sd->peerAddress();
+			p.port = sd->peerPort();
+			p.buf = BufferPool::take(actual);
+			memcpy(p.buf.data(), bufs[0].data(), actual);
+			list->append(p);
+		}
+#endif
+		return count;
+	}
+
+	int writeBatch(int *err)
+	{
+#ifdef HAVE_MMSG
+		mmsghdr msgs[UDP_BATCH];
+		iovec iov[UDP_BATCH];
+		sockaddr_in to[UDP_BATCH];
+		memset(msgs, 0, sizeof(msgs));
+		memset(to, 0, sizeof(to));
+
+		int count = 0;
+		for(UDPPacketList::ConstIterator it = outq.begin(); it != outq.end() && count < UDP_BATCH; ++it)
+		{
+			to[count].sin_family = AF_INET;
+			to[count].sin_port = htons((*it).port);
+			to[count].sin_addr.s_addr = htonl((*it).addr.ip4Addr());
+			iov[count].iov_base = (*it).buf.data();
+			iov[count].iov_len = (*it).buf.size();
+			msgs[count].msg_hdr.msg_name = &to[count];
+			msgs[count].msg_hdr.msg_namelen = sizeof(to[count]);
+			msgs[count].msg_hdr.msg_iov = &iov[count];
+			msgs[count].msg_hdr.msg_iovlen = 1;
+			++count;
+		}
+		int r = sendmmsg(sd->socket(), msgs, count, MSG_DONTWAIT);
+		if(r < 0)
+		{
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				*err = SendFull;
+			else if(errno == ECONNREFUSED)
+				*err = SendRefused;
+			else
+				*err = SendFailed;
+		}
+		return r;
+#else
+		int count = 0;
+		for(UDPPacketList::ConstIterator it = outq.begin(); it != outq.end() && count < UDP_BATCH; ++it)
+		{
+			int size = (*it).buf.size();
+			Q_LONG r = sd->writeBlock((*it).buf.data(), size, (*it).addr, (*it).port);
+			if(r < 0 || (r == 0 && size > 0))
+			{
+				// nothing taken without an error means the socket is full
+				if(sd->error() == QSocketDevice::NoError)
+					*err = SendFull;
+				else if(sd->error() == QSocketDevice::ConnectionRefused)
+					*err = SendRefused;
+				else
+					*err = SendFailed;
+				return (count > 0 ? count : -1);
+			}
+			++count;
+		}
+		return count;
+#endif
+	}
 };
 
 //----------------------------------------------------------------------------
@@ -236,9 +470,10 @@ public:
 
 signals:
 	void packetReady(int index, const QHostAddress &addr, int port, const QByteArray &buf);
+	void packetsReady(int index, const UDPPacketList &list);
 
 private slots:
-	void udp_packetReady(const QByteArray &buf, const QHostAddress &addr, int port)
+	void udp_packetsReady(const UDPPacketList &packets)
 	{
 		UDPItem *su = (UDPItem *)sender();
 		bool found = false;
@@ -256,7 +491,10 @@ private slots:
 		if(!found)
 			return;
 
-		packetReady(index, addr, port, buf);
+		QGuardedPtr<PortSequence> self = this;
+		packetsReady(index, packets);
+		for(UDPPacketList::ConstIterator it = packets.begin(); self && it != packets.end(); ++it)
+			packetReady(index, (*it).addr, (*it).port, (*it).buf);
 	}
 
 private:
@@ -305,7 +543,7 @@ private:
 
 		QPtrListIterator<UDPItem> it(list);
 		for(UDPItem *u; (u = it.current()); ++it)
-			connect(u, SIGNAL(packetReady(const QByteArray &, const QHostAddress &, int)), SLOT(udp_packetReady(const QByteArray &, const QHostAddress &, int)));
+			connect(u, SIGNAL(packetsReady(const UDPPacketList &)), SLOT(udp_packetsReady(const UDPPacketList &)));
 
 		return true;
 	}
@@ -334,6 +572,11 @@ public slots:
 	{
 		par->packetReady(index, addr, port, buf);
 	}
+
+	void range_packetsReady(int index, const UDPPacketList &list)
+	{
+		par->packetsReady(index, list);
+	}
 };
 
 AltPorts::AltPorts()
@@ -421,6 +664,7 @@ void AltPorts::keep(const PortRange &r)
 	d->list.clear();
 	d->list.setAutoDelete(false);
 	connect(d->ports, SIGNAL(packetReady(int, const QHostAddress &, int, const QByteArray &)), d, SLOT(range_packetReady(int, const QHostAddress &, int, const QByteArray &)));
+	connect(d->ports, SIGNAL(packetsReady(int, const UDPPacketList &)), d, SLOT(range_packetsReady(int, const UDPPacketList &)));
 }
 
 PortRange AltPorts::range() const
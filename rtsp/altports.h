@@ -44,6 +44,18 @@ public:
 	int findByBase(int base) const;
 };
 
+class UDPPacket
+{
+public:
+	UDPPacket() : port(0) {}
+
+	QHostAddress addr;
+	int port;
+	QByteArray buf;
+};
+
+typedef QValueList<UDPPacket> UDPPacketList;
+
 class AltPorts : public QObject
 {
 	Q_OBJECT
@@ -62,6 +74,7 @@ public:
 
 signals:
 	void packetReady(int index, const QHostAddress &addr, int sourcePort, const QByteArray &buf);
+	void packetsReady(int index, const UDPPacketList &list);
 
 public:
 	class Private;
@@ -24,6 +24,7 @@
 #include <qguardedptr.h>
 #include "bsocket.h"
 #include "servsock.h"
+#include "workerpool.h"
 
 #ifdef Q_OS_WIN
 # include <windows.h>
@@ -460,19 +461,28 @@ void Packet::setResource(const QString &s)
 }
 
 QByteArray Packet::toArray() const
+{
+	QValueList<QByteArray> list = toArrayList();
+	QByteArray buf = list.first();
+	if(list.count() > 1)
+		ByteStream::appendArray(&buf, list.last());
+	return buf;
+}
+
+// returns the header and the content as separate arrays, without copying the content
+QValueList<QByteArray> Packet::toArrayList() const
 {
 	QByteArray buf;
 
 	if(t == Data)
 	{
-		buf.resize(4 + _data.size());
+		buf.resize(4);
 
 		buf[0] = '$';
 		buf[1] = chan;
 		ushort ssa = _data.size();
 		ushort ssb = htons(ssa);
 		memcpy(buf.data() + 2, &ssb, 2);
-		memcpy(buf.data() + 4, _data.data(), _data.size());
 	}
 	else
 	{
@@ -496,10 +506,13 @@ QByteArray Packet::toArray() const
 		QCString cs = str.utf8();
 		buf.resize(cs.length());
 		memcpy(buf.data(), cs.data(), buf.size());
-		ByteStream::appendArray(&buf, _data);
 	}
 
-	return buf;
+	QValueList<QByteArray> list;
+	list += buf;
+	if(!_data.isEmpty())
+		list += _data;
+	return list;
 }
 
 //----------------------------------------------------------------------------
@@ -771,12 +784,17 @@ public:
 		using_sock = false;
 		conn = false;
 		active = false;
+		readLimit = 0;
+		writeLimit = 0;
+		readEnabled = true;
 	}
 
 	ByteStream *bs;
 	bool using_sock;
 	bool conn;
 	bool active;
+	int readLimit, writeLimit;
+	bool readEnabled;
 	Parser parser;
 	QValueList<int> trackQueue;
 };
@@ -811,6 +829,10 @@ void Client::hook()
 	connect(d->bs, SIGNAL(readyRead()), SLOT(bs_readyRead()));
 	connect(d->bs, SIGNAL(bytesWritten(int)), SLOT(bs_bytesWritten(int)));
 	connect(d->bs, SIGNAL(error(int)), SLOT(bs_error(int)));
+	connect(d->bs, SIGNAL(writePaused()), SIGNAL(writePaused()));
+	connect(d->bs, SIGNAL(writeResumed()), SIGNAL(writeResumed()));
+	d->bs->setReadLimit(d->readLimit);
+	d->bs->setWriteLimit(d->writeLimit);
 }
 
 void Client::processPackets()
@@ -863,9 +885,42 @@ void Client::close()
 
 void Client::write(const Packet &p)
 {
-	QByteArray buf = p.toArray();
-	d->trackQueue.append(buf.size());
-	d->bs->write(buf);
+	QValueList<QByteArray> list = p.toArrayList();
+	int size = 0;
+	for(QValueList<QByteArray>::ConstIterator it = list.begin(); it != list.end(); ++it)
+		size += (*it).size();
+	d->trackQueue.append(size);
+	d->bs->writev(list);
+}
+
+void Client::setReadLimit(int bytes)
+{
+	d->readLimit = bytes;
+	if(d->bs)
+		d->bs->setReadLimit(bytes);
+}
+
+void Client::setWriteLimit(int bytes)
+{
+	d->writeLimit = bytes;
+	if(d->bs)
+		d->bs->setWriteLimit(bytes);
+}
+
+void Client::setReadEnabled(bool b)
+{
+	// while disabled, the data stays in the stream, which stops reading once
+	//   it holds the read limit
+	d->readEnabled = b;
+	if(b && d->bs && d->bs->bytesAvailable() > 0)
+		QTimer::singleShot(0, this, SLOT(bs_readyRead()));
+}
+
+bool Client::isWritePaused() const
+{
+	if(d->bs)
+		return d->bs->isWritePaused();
+	return false;
 }
 
 QHostAddress Client::peerAddress() const
@@ -891,6 +946,9 @@ void Client::bs_connectionClosed()
 
 void Client::bs_readyRead()
 {
+	if(!d->readEnabled || !d->bs)
+		return;
+
 	QByteArray buf = d->bs->read();
 	d->parser.appendData(buf);
 	if(d->active)
@@ -1010,6 +1068,16 @@ Client *Server::takeIncoming()
 	return c;
 }
 
+void Server::setListenOptions(int options)
+{
+	d->serv.setOptions(options);
+}
+
+void Server::setWorkerPool(WorkerPool *pool)
+{
+	d->serv.setWorkerPool(pool);
+}
+
 void Server::connectionReady(int s)
 {
 	Client *c = new Client(s);
@@ -1023,6 +1091,10 @@ void Server::connectionError()
 	Client *c = (Client *)sender();
 	d->incomingConns.removeRef(c);
 	c->deleteLater();
+
+	// never made it to the application, so account for it here
+	if(d->serv.workerPool())
+		d->serv.workerPool()->connectionFinished();
 }
 
 }
@@ -35,6 +35,7 @@
 #include <qhostaddress.h>
 
 class ByteStream;
+class WorkerPool;
 
 namespace RTSP
 {
@@ -118,6 +119,7 @@ namespace RTSP
 		void setResource(const QString &s);
 
 		QByteArray toArray() const;
+		QValueList<QByteArray> toArrayList() const;
 
 	private:
 		friend class Parser;
@@ -169,6 +171,11 @@ namespace RTSP
 
 		void write(const Packet &p);
 
+		void setReadLimit(int bytes);
+		void setWriteLimit(int bytes);
+		void setReadEnabled(bool);
+		bool isWritePaused() const;
+
 		QHostAddress peerAddress() const;
 
 	signals:
@@ -176,6 +183,8 @@ namespace RTSP
 		void connectionClosed();
 		void packetReady(const Packet &p);
 		void packetWritten();
+		void writePaused();
+		void writeResumed();
 		void error(int);
 
 	private slots:
@@ -209,6 +218,8 @@ namespace RTSP
 		int port() const;
 		QHostAddress address() const;
 		Client *takeIncoming();
+		void setListenOptions(int);
+		void setWorkerPool(WorkerPool *);
 
 	signals:
 		void incomingReady();
@@ -21,6 +21,7 @@
 #include "rtspproxy.h"
 
 #include <qurl.h>
+#include <qguardedptr.h>
 #include "servsock.h"
 #include "bsocket.h"
 #include "rtspbase.h"
@@ -29,6 +30,10 @@
 #define SERVER_ALLOC_BASE 16000
 #define SERVER_ALLOC_MAX  65535
 
+// most data a session holds for a slow peer in either direction before it
+//   stops reading from the other one
+#define SESSION_BUFFER_MAX 65536
+
 static bool try_serve(RTSP::Server *s)
 {
 	for(int n = SERVER_ALLOC_BASE; n <= SERVER_ALLOC_MAX; ++n)
@@ -107,8 +112,8 @@ signals:
 	void packetFromServer(int source, int dest, const QByteArray &buf);
 
 private slots:
-	void client_packetReady(int index, const QHostAddress &addr, int sourcePort, const QByteArray &buf);
-	void server_packetReady(int index, const QHostAddress &addr, int sourcePort, const QByteArray &buf);
+	void client_packetsReady(int index, const UDPPacketList &list);
+	void server_packetsReady(int index, const UDPPacketList &list);
 
 private:
 	MapItem client, server;
@@ -117,8 +122,8 @@ private:
 
 PortMapper::PortMapper()
 {
-	connect(&client.altPorts, SIGNAL(packetReady(int, const QHostAddress &, int, const QByteArray &)), SLOT(client_packetReady(int, const QHostAddress &, int, const QByteArray &)));
-	connect(&server.altPorts, SIGNAL(packetReady(int, const QHostAddress &, int, const QByteArray &)), SLOT(server_packetReady(int, const QHostAddress &, int, const QByteArray &)));
+	connect(&client.altPorts, SIGNAL(packetsReady(int, const UDPPacketList &)), SLOT(client_packetsReady(int, const UDPPacketList &)));
+	connect(&server.altPorts, SIGNAL(packetsReady(int, const UDPPacketList &)), SLOT(server_packetsReady(int, const UDPPacketList &)));
 	ready = false;
 }
 
@@ -243,20 +248,28 @@ void PortMapper::writeAsServer(int source, int, const QByteArray &buf)
 	server.altPorts.send(index, client.host, client.realPorts.base + index, buf);
 }
 
-void PortMapper::client_packetReady(int index, const QHostAddress &, int, const QByteArray &buf)
+void PortMapper::client_packetsReady(int index, const UDPPacketList &list)
 {
-	if(server.virt)
-		emit packetFromServer(server.altPortRanges.first().base + index, client.realPorts.base + index, buf);
-	else
-		server.altPorts.send(index, client.host, client.realPorts.base + index, buf);
+	QGuardedPtr<PortMapper> self = this;
+	for(UDPPacketList::ConstIterator it = list.begin(); self && it != list.end(); ++it)
+	{
+		if(server.virt)
+			emit packetFromServer(server.altPortRanges.first().base + index, client.realPorts.base + index, (*it).buf);
+		else
+			server.altPorts.send(index, client.host, client.realPorts.base + index, (*it).buf);
+	}
 }
 
-void PortMapper::server_packetReady(int index, const QHostAddress &, int, const QByteArray &buf)
+void PortMapper::server_packetsReady(int index, const UDPPacketList &list)
 {
-	if(client.virt)
-		emit packetFromClient(client.altPortRanges.first().base + index, server.realPorts.base + index, buf);
-	else
-		client.altPorts.send(index, server.host, server.realPorts.base + index, buf);
+	QGuardedPtr<PortMapper> self = this;
+	for(UDPPacketList::ConstIterator it = list.begin(); self && it != list.end(); ++it)
+	{
+		if(client.virt)
+			emit packetFromClient(client.altPortRanges.first().base + index, server.realPorts.base + index, (*it).buf);
+		else
+			client.altPorts.send(index, server.host, server.realPorts.base + index, (*it).buf);
+	}
 }
 
 //----------------------------------------------------------------------------
@@ -459,7 +472,11 @@ private slots:
 		connect(client, SIGNAL(connectionClosed()), SLOT(client_connectionClosed()));
 		connect(client, SIGNAL(packetReady(const Packet &)), SLOT(client_packetReady(const Packet &)));
 		connect(client, SIGNAL(packetWritten()), SLOT(client_packetWritten()));
+		connect(client, SIGNAL(writePaused()), SLOT(client_writePaused()));
+		connect(client, SIGNAL(writeResumed()), SLOT(client_writeResumed()));
 		connect(client, SIGNAL(error(int)), SLOT(client_error(int)));
+		client->setReadLimit(SESSION_BUFFER_MAX);
+		client->setWriteLimit(SESSION_BUFFER_MAX);
 	}
 
 	void client_connectionClosed()
@@ -467,6 +484,8 @@ private slots:
 		printf("Session: Client: connectionClosed\n");
 		delete client;
 		client = 0;
+		if(server)
+			server->setReadEnabled(true);
 	}
 
 	void client_packetReady(const Packet &p)
@@ -525,7 +544,11 @@ private slots:
 			connect(server, SIGNAL(connectionClosed()), SLOT(server_connectionClosed()));
 			connect(server, SIGNAL(packetReady(const Packet &)), SLOT(server_packetReady(const Packet &)));
 			connect(server, SIGNAL(packetWritten()), SLOT(server_packetWritten()));
+			connect(server, SIGNAL(writePaused()), SLOT(server_writePaused()));
+			connect(server, SIGNAL(writeResumed()), SLOT(server_writeResumed()));
 			connect(server, SIGNAL(error(int)), SLOT(server_error(int)));
+			server->setReadLimit(SESSION_BUFFER_MAX);
+			server->setWriteLimit(SESSION_BUFFER_MAX);
 			printf("Session: Server: connecting to server\n");
 			server->connectToHost(shost, sport);
 			return;
@@ -539,11 +562,26 @@ private slots:
 		//printf("Session: Client: packetWritten\n");
 	}
 
+	void client_writePaused()
+	{
+		// the client can't keep up, so stop taking from the server
+		if(server)
+			server->setReadEnabled(false);
+	}
+
+	void client_writeResumed()
+	{
+		if(server)
+			server->setReadEnabled(true);
+	}
+
 	void client_error(int x)
 	{
 		printf("Session: Client: error %d\n", x);
 		delete client;
 		client = 0;
+		if(server)
+			server->setReadEnabled(true);
 	}
 
 	void server_connected()
@@ -599,6 +637,18 @@ private slots:
 		//printf("Session: Server: packetWritten\n");
 	}
 
+	void server_writePaused()
+	{
+		if(client)
+			client->setReadEnabled(false);
+	}
+
+	void server_writeResumed()
+	{
+		if(client)
+			client->setReadEnabled(true);
+	}
+
 	void server_error(int x)
 	{
 		printf("Session: Server: error %d\n", x);
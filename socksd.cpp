@@ -1,152 +1,287 @@
 #include"socksd.h"
 
 #include<qapplication.h>
-#include"bconsole.h"
+#include<qptrlist.h>
+#include<qguardedptr.h>
+#include<qtimer.h>
 #include"bsocket.h"
+#include"servsock.h"
 #include"socks.h"
+#include"streamrelay.h"
+#include"workerpool.h"
+#include"udprelay.h"
 
 #include<stdio.h>
 
-class App::Private
+//----------------------------------------------------------------------------
+// Relay
+//----------------------------------------------------------------------------
+class Relay::Private
 {
 public:
 	Private() {}
 
-	ByteStream *bs;
-	BConsole *c;
-	SocksServer *serv;
 	SocksClient *client;
-
+	BSocket *target;
+	StreamRelay *relay;
+	UDPRelay *udp;
+	int grant;
 	QString user, pass;
 };
 
-App::App(int port, const QString &user, const QString &pass)
+Relay::Relay(SocksClient *client, const QString &user, const QString &pass, UDPRelay *udp)
 :QObject(0)
 {
 	d = new Private;
+	d->client = client;
+	d->target = 0;
+	d->relay = 0;
+	d->udp = udp;
+	d->grant = -1;
 	d->user = user;
 	d->pass = pass;
-	d->c = new BConsole;
-	connect(d->c, SIGNAL(connectionClosed()), SLOT(con_connectionClosed()));
-	connect(d->c, SIGNAL(readyRead()), SLOT(con_readyRead()));
-
-	d->bs = 0;
-	d->client = 0;
-	d->serv = new SocksServer;
-	connect(d->serv, SIGNAL(incomingReady()), SLOT(ss_incomingReady()));
-	d->serv->listen(port);
 
-	fprintf(stderr, "socksd: listening on port %d\n", port);
+	connect(client, SIGNAL(incomingMethods(int)), SLOT(sc_incomingMethods(int)));
+	connect(client, SIGNAL(incomingAuth(const QString &, const QString &)), SLOT(sc_incomingAuth(const QString &, const QString &)));
+	connect(client, SIGNAL(incomingConnectRequest(const QString &, int)), SLOT(sc_incomingConnectRequest(const QString &, int)));
+	connect(client, SIGNAL(incomingUDPAssociateRequest()), SLOT(sc_incomingUDPAssociateRequest()));
+	connect(client, SIGNAL(error(int)), SLOT(sc_error(int)));
 }
 
-App::~App()
+Relay::~Relay()
 {
-	if(d->client)
-		d->client->deleteLater();
-	delete d->serv;
-	delete d->c;
+	if(d->grant != -1)
+		d->udp->revoke(d->grant);
+	delete d->relay;
+	delete d->target;
+	delete d->client;
 	delete d;
 }
 
-void App::st_connectionClosed()
+void Relay::sc_incomingMethods(int m)
 {
-	fprintf(stderr, "socksd: Connection closed by foreign host.\n");
-	quit();
+	if(d->user.isEmpty() && m & SocksClient::AuthNone)
+		d->client->chooseMethod(SocksClient::AuthNone);
+	else if(m & SocksClient::AuthUsername)
+		d->client->chooseMethod(SocksClient::AuthUsername);
+	else {
+		fprintf(stderr, "socksd: unsupported method!\n");
+		finished();
+	}
 }
 
-void App::st_delayedCloseFinished()
+void Relay::sc_incomingAuth(const QString &user, const QString &pass)
 {
-	quit();
+	if(user == d->user && pass == d->pass) {
+		d->client->authGrant(true);
+	}
+	else {
+		fprintf(stderr, "socksd: auth failed for user [%s]\n", user.latin1());
+		d->client->authGrant(false);
+		finished();
+	}
 }
 
-void App::st_readyRead()
+void Relay::sc_incomingConnectRequest(const QString &host, int port)
 {
-	QByteArray a = d->bs->read();
-	d->c->write(a);
+#ifdef PROX_DEBUG
+	fprintf(stderr, "socksd: request: host=[%s], port=[%d]\n", host.latin1(), port);
+#endif
+	d->target = new BSocket;
+	connect(d->target, SIGNAL(connected()), SLOT(target_connected()));
+	connect(d->target, SIGNAL(error(int)), SLOT(target_error(int)));
+	d->target->connectToHost(host, port);
 }
 
-void App::st_error(int x)
+void Relay::sc_incomingUDPAssociateRequest()
 {
-	fprintf(stderr, "socksd: Stream error [%d].\n", x);
-	quit();
+	if(d->udp)
+		d->grant = d->udp->allow(d->client->peerAddress());
+	if(d->grant == -1) {
+		d->client->requestDeny();
+		finished();
+		return;
+	}
+
+	// the association lasts as long as this connection, so watch for it
+	//   closing
+	connect(d->client, SIGNAL(connectionClosed()), SLOT(sc_connectionClosed()));
+	d->client->grantUDPAssociate(d->client->address().toString(), d->udp->port());
 }
 
-void App::con_connectionClosed()
+void Relay::sc_connectionClosed()
 {
-	fprintf(stderr, "adconn: Closing.\n");
-	d->bs->close();
-	if(d->bs->bytesToWrite() == 0)
-		quit();
+	finished();
 }
 
-void App::con_readyRead()
+void Relay::sc_error(int)
 {
-	QByteArray a = d->c->read();
-	d->bs->write(a);
+	finished();
 }
 
-void App::ss_incomingReady()
+void Relay::target_connected()
 {
-	fprintf(stderr, "incoming connection!\n");
-	SocksClient *c = d->serv->takeIncoming();
-	if(!c)
+	disconnect(d->client, SIGNAL(error(int)), this, SLOT(sc_error(int)));
+	disconnect(d->target, SIGNAL(error(int)), this, SLOT(target_error(int)));
+
+	QGuardedPtr<QObject> self = this;
+	d->client->grantConnect();
+	if(!self)
 		return;
-	fprintf(stderr, "accepted\n");
-	connect(c, SIGNAL(incomingMethods(int)), SLOT(sc_incomingMethods(int)));
-	connect(c, SIGNAL(incomingAuth(const QString &, const QString &)), SLOT(sc_incomingAuth(const QString &, const QString &)));
-	connect(c, SIGNAL(incomingRequest(const QString &, int)), SLOT(sc_incomingRequest(const QString &, int)));
-	connect(c, SIGNAL(error(int)), SLOT(sc_error(int)));
-	d->client = c;
+
+	// the relay takes over from here, splicing the two sockets together
+	//   once the reply has gone out
+	d->relay = new StreamRelay(d->client, d->target);
+	connect(d->relay, SIGNAL(finished()), SIGNAL(finished()));
 }
 
-void App::sc_incomingMethods(int m)
+void Relay::target_error(int)
 {
-	fprintf(stderr, "m=%d\n", m);
-	if(d->user.isEmpty() && m & SocksClient::AuthNone)
-		d->client->chooseMethod(SocksClient::AuthNone);
-	else if(m & SocksClient::AuthUsername)
-		d->client->chooseMethod(SocksClient::AuthUsername);
-	else {
-		d->client->deleteLater();
-		d->client = 0;
-		fprintf(stderr, "unsupported method!\n");
-	}
+	d->client->requestDeny();
+	finished();
 }
 
-void App::sc_incomingAuth(const QString &user, const QString &pass)
+//----------------------------------------------------------------------------
+// App
+//----------------------------------------------------------------------------
+class App::Private
 {
-	fprintf(stderr, "incoming auth: user=[%s], pass=[%s]\n", user.latin1(), pass.latin1());
-	if(user == d->user && pass == d->pass) {
-		d->client->authGrant(true);
+public:
+	Private() {}
+
+	SocksServer *serv;
+	WorkerPool *pool;
+	UDPRelay *udp;
+	QPtrList<Relay> relays;
+	int maxClients;
+
+	QString user, pass;
+};
+
+App::App(int port, const QString &user, const QString &pass, int maxClients, int workers, bool reusePort, bool udp)
+:QObject(0)
+{
+	d = new Private;
+	d->user = user;
+	d->pass = pass;
+	d->maxClients = maxClients;
+	d->pool = 0;
+	d->udp = 0;
+
+	d->serv = new SocksServer;
+	connect(d->serv, SIGNAL(incomingReady()), SLOT(ss_incomingReady()));
+
+	// SOCKS clients speak first, so there is nothing to do for a connection
+	//   until its greeting has arrived
+	int options = ServSock::DeferAccept;
+	if(reusePort && workers > 0)
+		options |= ServSock::ReusePort;
+	d->serv->setListenOptions(options);
+	if(!d->serv->listen(port)) {
+		fprintf(stderr, "socksd: unable to listen on port %d\n", port);
+		QTimer::singleShot(0, this, SIGNAL(quit()));
+		return;
 	}
-	else {
-		d->client->authGrant(false);
-		d->client->deleteLater();
-		d->client = 0;
+
+	// fork the workers now that the socket is listening, everything after
+	//   this runs in each process
+	if(workers > 0) {
+		d->pool = new WorkerPool;
+		if(!d->pool->start(workers)) {
+			fprintf(stderr, "socksd: unable to start workers, serving everything here\n");
+			delete d->pool;
+			d->pool = 0;
+		}
+		else if(d->pool->isWorker()) {
+			connect(d->pool, SIGNAL(acceptorGone()), SIGNAL(quit()));
+			d->serv->setWorkerPool(d->pool);
+			if(udp)
+				startUDP(0);
+			return;
+		}
+		else {
+			connect(d->pool, SIGNAL(workerDied(int)), SLOT(pool_workerDied(int)));
+			d->serv->setWorkerPool(d->pool);
+		}
 	}
+
+	// each worker has a relay of its own, on whatever port it gets
+	if(udp && !d->pool)
+		startUDP(port);
+
+	fprintf(stderr, "socksd: listening on port %d", port);
+	if(d->pool)
+		fprintf(stderr, ", %d workers%s", d->pool->count(), reusePort ? " listening themselves" : "");
+	if(d->udp || (udp && d->pool))
+		fprintf(stderr, ", relaying UDP");
+	if(maxClients > 0)
+		fprintf(stderr, ", up to %d clients%s\n", maxClients, d->pool ? " each" : "");
+	else
+		fprintf(stderr, "\n");
 }
 
-void App::sc_incomingRequest(const QString &host, int port)
+App::~App()
 {
-	fprintf(stderr, "request: host=[%s], port=[%d]\n", host.latin1(), port);
+	delete d->serv;
+	d->relays.setAutoDelete(true);
+	d->relays.clear();
+	delete d->udp;
+	delete d->pool;
+	delete d;
+}
 
-	disconnect(d->client, SIGNAL(error(int)), this, SLOT(sc_error(int)));
-	connect(d->client, SIGNAL(connectionClosed()), SLOT(st_connectionClosed()));
-	connect(d->client, SIGNAL(delayedCloseFinished()), SLOT(st_delayedCloseFinished()));
-	connect(d->client, SIGNAL(readyRead()), SLOT(st_readyRead()));
-	connect(d->client, SIGNAL(error(int)), SLOT(st_error(int)));
-	d->bs = d->client;
+void App::ss_incomingReady()
+{
+	SocksClient *c = d->serv->takeIncoming();
+	if(!c)
+		return;
 
-	d->client->requestGrant(true);
-	fprintf(stderr, "<< Active >>\n");
+	if(d->maxClients > 0 && (int)d->relays.count() >= d->maxClients) {
+#ifdef PROX_DEBUG
+		fprintf(stderr, "socksd: connection limit reached, dropping client\n");
+#endif
+		c->deleteLater();
+		if(d->pool)
+			d->pool->connectionFinished();
+		return;
+	}
+
+	Relay *r = new Relay(c, d->user, d->pass, d->udp);
+	connect(r, SIGNAL(finished()), SLOT(relay_finished()));
+	d->relays.append(r);
 }
 
-void App::sc_error(int)
+void App::relay_finished()
 {
-	d->client->deleteLater();
-	d->client = 0;
+	Relay *r = (Relay *)sender();
+	if(d->relays.removeRef(r)) {
+		r->deleteLater();
+		if(d->pool)
+			d->pool->connectionFinished();
+	}
+}
 
-	fprintf(stderr, "error!\n");
+void App::startUDP(int port)
+{
+	d->udp = new UDPRelay;
+	if(!d->udp->bind(port)) {
+		fprintf(stderr, "socksd: unable to relay UDP on port %d\n", port);
+		delete d->udp;
+		d->udp = 0;
+	}
+}
+
+void App::pool_workerDied(int x)
+{
+	fprintf(stderr, "socksd: worker %d exited\n", x);
+
+	// show what each worker has been doing
+	WorkerStatsList list = d->pool->stats();
+	int n = 0;
+	for(WorkerStatsList::ConstIterator it = list.begin(); it != list.end(); ++it, ++n) {
+		fprintf(stderr, "socksd:   worker %d: pid %d, %s, %llu connections, %llu open\n", n, (*it).pid,
+			(*it).alive ? "running" : "gone", (*it).handed, (*it).handed - (*it).finished);
+	}
 }
 
 
@@ -154,25 +289,43 @@ int main(int argc, char **argv)
 {
 	QApplication app(argc, argv, false);
 
-	if(argc < 2) {
-		printf("usage: socksd [port] [user] [pass]\n\n");
+	int maxClients = 0;
+	int workers = 0;
+	bool reusePort = false;
+	bool udp = false;
+	int at = 1;
+	for(; argc > at; ++at) {
+		QString opt = argv[at];
+		if(opt.left(6) == "--max=")
+			maxClients = opt.mid(6).toInt();
+		else if(opt.left(10) == "--workers=")
+			workers = opt.mid(10).toInt();
+		else if(opt == "--reuseport")
+			reusePort = true;
+		else if(opt == "--udp")
+			udp = true;
+		else
+			break;
+	}
+
+	if(argc - at < 1) {
+		printf("usage: socksd [--max=clients] [--workers=processes [--reuseport]] [--udp] [port] [user] [pass]\n\n");
 		return 0;
 	}
 
-	QString p = argv[1];
+	QString p = argv[at];
 	int port = p.toInt();
 
 	QString user, pass;
-	if(argc >= 4) {
-		user = argv[2];
-		pass = argv[3];
+	if(argc - at >= 3) {
+		user = argv[at + 1];
+		pass = argv[at + 2];
 	}
 
-	App *a = new App(port, user, pass);
+	App *a = new App(port, user, pass, maxClients, workers, reusePort, udp);
 	QObject::connect(a, SIGNAL(quit()), &app, SLOT(quit()));
 	app.exec();
 	delete a;
 
 	return 0;
 }
-
@@ -3,34 +3,55 @@
 
 #include<qobject.h>
 
+class SocksClient;
+class UDPRelay;
+
+class Relay : public QObject
+{
+	Q_OBJECT
+public:
+	Relay(SocksClient *client, const QString &user, const QString &pass, UDPRelay *udp);
+	~Relay();
+
+signals:
+	void finished();
+
+private slots:
+	void sc_incomingMethods(int);
+	void sc_incomingAuth(const QString &user, const QString &pass);
+	void sc_incomingConnectRequest(const QString &host, int port);
+	void sc_incomingUDPAssociateRequest();
+	void sc_connectionClosed();
+	void sc_error(int);
+
+	void target_connected();
+	void target_error(int);
+
+private:
+	class Private;
+	Private *d;
+};
+
 class App : public QObject
 {
 	Q_OBJECT
 public:
-	App(int, const QString &, const QString &);
+	App(int port, const QString &user, const QString &pass, int maxClients, int workers, bool reusePort, bool udp);
 	~App();
 
 signals:
 	void quit();
 
 private slots:
-	void st_connectionClosed();
-	void st_delayedCloseFinished();
-	void st_readyRead();
-	void st_error(int);
-
-	void con_connectionClosed();
-	void con_readyRead();
-
 	void ss_incomingReady();
-	void sc_incomingMethods(int);
-	void sc_incomingAuth(const QString &user, const QString &pass);
-	void sc_incomingRequest(const QString &host, int port);
-	void sc_error(int);
+	void relay_finished();
+	void pool_workerDied(int);
 
 private:
 	class Private;
 	Private *d;
+
+	void startUDP(int port);
 };
 
 #endif
@@ -7,19 +7,35 @@ INCLUDEPATH += util network
 
 HEADERS = \
 	util/bytestream.h \
-	util/bconsole.h \
+	util/bufferpool.h \
+	util/reactor.h \
+	util/safedelete.h \
+	util/qrandom.h \
 	network/ndns.h \
+	network/dnsclient.h \
+	network/srvresolver.h \
 	network/bsocket.h \
 	network/servsock.h \
 	network/socks.h \
+	network/streamrelay.h \
+	network/workerpool.h \
+	network/udprelay.h \
 	socksd.h
 
 SOURCES = \
 	util/bytestream.cpp \
-	util/bconsole.cpp \
+	util/bufferpool.cpp \
+	util/reactor.cpp \
+	util/safedelete.cpp \
+	util/qrandom.cpp \
 	network/ndns.cpp \
+	network/dnsclient.cpp \
+	network/srvresolver.cpp \
 	network/bsocket.cpp \
 	network/servsock.cpp \
 	network/socks.cpp \
+	network/streamrelay.cpp \
+	network/workerpool.cpp \
+	network/udprelay.cpp \
 	socksd.cpp
 
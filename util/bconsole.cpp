@@ -20,9 +20,15 @@
 
 #include"bconsole.h"
 
-#include<qsocketnotifier.h>
+#include<qguardedptr.h>
 #include<unistd.h>
 #include<fcntl.h>
+#include<errno.h>
+#include<sys/uio.h>
+#include"reactor.h"
+
+// most spans handed to a single readv()/writev()
+#define MAX_IOV 16
 
 //----------------------------------------------------------------------------
 // BConsole
@@ -32,7 +38,7 @@ class BConsole::Private
 public:
 	Private() {}
 
-	QSocketNotifier *r, *w;
+	SocketWatcher *r, *w;
 	bool closing;
 	bool closed;
 };
@@ -48,9 +54,11 @@ BConsole::BConsole(QObject *parent)
 	fcntl(0, F_SETFL, O_NONBLOCK);
 	fcntl(1, F_SETFL, O_NONBLOCK);
 
-	d->r = new QSocketNotifier(0, QSocketNotifier::Read);
+	d->r = new SocketWatcher(0, SocketWatcher::Read);
 	connect(d->r, SIGNAL(activated(int)), SLOT(sn_read()));
-	d->w = 0;
+	d->w = new SocketWatcher(1, SocketWatcher::Write);
+	d->w->setEnabled(false);
+	connect(d->w, SIGNAL(activated(int)), SLOT(sn_write()));
 }
 
 BConsole::~BConsole()
@@ -78,27 +86,61 @@ void BConsole::close()
 	}
 }
 
-void BConsole::sn_read()
+static int toIovec(const ByteSpanList &spans, struct iovec *iov)
 {
-	QByteArray a(1024);
-	int r = ::read(0, a.data(), a.size());
-	if(r < 0) {
-		error(ErrRead);
+	int n = 0;
+	for(ByteSpanList::ConstIterator it = spans.begin(); it != spans.end() && n < MAX_IOV; ++it) {
+		iov[n].iov_base = (*it).data;
+		iov[n].iov_len = (*it).size;
+		++n;
 	}
-	else if(r == 0) {
-		connectionClosed();
+	return n;
+}
+
+void BConsole::sn_read()
+{
+	// read straight into the free space of the read buffer, until it runs
+	//   dry, since the watcher may be edge-triggered
+	int total = 0;
+	bool closed = false;
+	while(1) {
+		ByteSpanList spans;
+		readChain().prepare(1024, &spans);
+		struct iovec iov[MAX_IOV];
+		int r = ::readv(0, iov, toIovec(spans, iov));
+		if(r < 0) {
+			readChain().commit(0);
+			if(errno == EAGAIN || errno == EINTR)
+				break;
+			error(ErrRead);
+			return;
+		}
+		readChain().commit(r);
+		recordRead(r);
+		if(r == 0) {
+			closed = true;
+			break;
+		}
+		total += r;
+		if(r < 1024)
+			break;
+
+		// leave the rest in the kernel once the reader is this far behind,
+		//   setReadEnabled() will pick it up again
+		if(readLimit() > 0 && bytesAvailable() >= readLimit())
+			break;
 	}
-	else {
-		a.resize(r);
-		appendRead(a);
+
+	QGuardedPtr<QObject> self = this;
+	if(total > 0)
 		readyRead();
-	}
+	if(self && closed)
+		connectionClosed();
 }
 
 void BConsole::sn_write()
 {
-	d->w->deleteLater();
-	d->w = 0;
+	d->w->setEnabled(false);
 
 	if(bytesToWrite() > 0)
 		tryWrite();
@@ -109,22 +151,26 @@ void BConsole::sn_write()
 	}
 }
 
-int BConsole::tryWrite()
+void BConsole::setReadEnabled(bool b)
 {
-	// try a section of the write buffer
-	QByteArray a = takeWrite(1024, false);
+	d->r->setEnabled(b);
+}
 
-	// write it
-	int r = ::write(1, a.data(), a.size());
+int BConsole::tryWrite()
+{
+	// write as much of the write buffer as the kernel takes, in place
+	ByteSpanList spans;
+	writeChain().spans(&spans);
+	struct iovec iov[MAX_IOV];
+	int r = ::writev(1, iov, toIovec(spans, iov));
 	if(r < 0) {
 		error(ErrWrite);
 		return -1;
 	}
 
-	d->w = new QSocketNotifier(1, QSocketNotifier::Write);
-	connect(d->w, SIGNAL(activated(int)), SLOT(sn_write()));
-
-	takeWrite(r);
+	d->w->setEnabled(true);
+	writeChain().discard(r);
+	recordWrite(r);
 	bytesWritten(r);
 	return r;
 }
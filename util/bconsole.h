@@ -35,6 +35,7 @@ public:
 
 protected:
 	int tryWrite();
+	void setReadEnabled(bool);
 
 private slots:
 	void sn_read();
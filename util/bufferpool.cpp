@@ -0,0 +1,172 @@
+/*
+ * bufferpool.cpp - recycled I/O buffers
+ * Copyright (C) 2003  Justin Karneges
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+//! \class BufferPool bufferpool.h
+//! \brief Recycles the byte arrays used for reading
+//!
+//! Reading a socket normally means allocating a fresh QByteArray for every
+//! readiness event, and freeing it once the data has been passed on.
+//! BufferPool keeps arrays that are done with, sorted into size classes
+//! (powers of two from 256 bytes to 64k), and hands them out again, so that
+//! a connection in steady state stops going to the heap for its buffers.
+//!
+//! take() returns an array of exactly the requested size, from the pool if
+//! one of that class is available.  give() puts an array back, provided
+//! nothing else refers to it (QByteArray is explicitly shared), so it is
+//! always safe to give back an array after passing it to a signal.  Don't use
+//! the array after giving it back.
+//!
+//! Every thread has a pool of its own, so there is no locking.  Note that
+//! QByteArray::resize() reallocates, so an array reused for a smaller or
+//! larger size within its class still costs a realloc(), though no new
+//! array.
+//!
+//! \code
+//! QByteArray buf = BufferPool::take(8192);
+//! int r = sd->readBlock(buf.data(), buf.size());
+//! ...
+//! BufferPool::give(buf);
+//! \endcode
+
+#include"bufferpool.h"
+
+#ifdef QT_THREAD_SUPPORT
+#include<qthreadstorage.h>
+#endif
+
+// size classes, from 256 bytes doubling up to 64k
+#define POOL_CLASSES   9
+#define POOL_MIN_SIZE  256
+
+// arrays kept per class
+#define POOL_CLASS_MAX 64
+
+// CS_NAMESPACE_BEGIN
+
+class PoolLists
+{
+public:
+	PoolLists()
+	{
+		for(int n = 0; n < POOL_CLASSES; ++n)
+			count[n] = 0;
+		stats.hits = stats.misses = 0;
+		stats.recycled = stats.dropped = 0;
+	}
+
+	// slots are reset by sharing this, which allocates nothing
+	QByteArray empty;
+	QByteArray bufs[POOL_CLASSES][POOL_CLASS_MAX];
+	int count[POOL_CLASSES];
+	BufferPoolStats stats;
+};
+
+#ifdef QT_THREAD_SUPPORT
+static QThreadStorage<PoolLists *> storage;
+#else
+static PoolLists *pool = 0;
+#endif
+
+static PoolLists *lists()
+{
+#ifdef QT_THREAD_SUPPORT
+	if(!storage.hasLocalData())
+		storage.setLocalData(new PoolLists);
+	return storage.localData();
+#else
+	if(!pool)
+		pool = new PoolLists;
+	return pool;
+#endif
+}
+
+// smallest class that holds size, or -1 if it is too large to pool
+static int classOf(int size)
+{
+	int c = 0;
+	for(int s = POOL_MIN_SIZE; s < size; s <<= 1)
+		++c;
+	return (c < POOL_CLASSES ? c : -1);
+}
+
+//!
+//! Returns an array of \a size bytes.  Its contents are undefined.
+QByteArray BufferPool::take(int size)
+{
+	if(size <= 0)
+		return QByteArray();
+
+	PoolLists *p = lists();
+	int c = classOf(size);
+	if(c == -1 || p->count[c] == 0) {
+		++p->stats.misses;
+		return QByteArray(size);
+	}
+
+	++p->stats.hits;
+	int n = --p->count[c];
+	QByteArray a = p->bufs[c][n];
+	p->bufs[c][n] = p->empty;
+	if((int)a.size() != size)
+		a.resize(size);
+	return a;
+}
+
+//!
+//! Puts array \a a back into the pool, if it isn't shared with anything else
+//! and there is room for it.
+void BufferPool::give(const QByteArray &a)
+{
+	if(a.isNull())
+		return;
+
+	PoolLists *p = lists();
+	int c = classOf(a.size());
+	if(c == -1 || a.nrefs() != 1 || p->count[c] >= POOL_CLASS_MAX) {
+		++p->stats.dropped;
+		return;
+	}
+
+	++p->stats.recycled;
+	p->bufs[c][p->count[c]++] = a;
+}
+
+//!
+//! Frees all arrays held by the pool of the calling thread.
+void BufferPool::clear()
+{
+	PoolLists *p = lists();
+	for(int c = 0; c < POOL_CLASSES; ++c) {
+		while(p->count[c] > 0)
+			p->bufs[c][--p->count[c]] = p->empty;
+	}
+}
+
+//!
+//! Returns the counters of the calling thread's pool.  A hit is a take()
+//! served from the pool and a miss one that had to allocate.  Arrays given
+//! back are either recycled, or dropped because they were shared, too large,
+//! or the pool was full.
+BufferPoolStats BufferPool::stats()
+{
+	return lists()->stats;
+}
+
+// CS_NAMESPACE_END
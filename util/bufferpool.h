@@ -0,0 +1,48 @@
+/*
+ * bufferpool.h - recycled I/O buffers
+ * Copyright (C) 2003  Justin Karneges
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CS_BUFFERPOOL_H
+#define CS_BUFFERPOOL_H
+
+#include<qcstring.h>
+
+// CS_NAMESPACE_BEGIN
+
+struct BufferPoolStats
+{
+	Q_ULLONG hits, misses;
+	Q_ULLONG recycled, dropped;
+};
+
+class BufferPool
+{
+public:
+	static QByteArray take(int size);
+	static void give(const QByteArray &);
+	static void clear();
+	static BufferPoolStats stats();
+
+private:
+	BufferPool();
+};
+
+// CS_NAMESPACE_END
+
+#endif
@@ -20,8 +20,396 @@
 
 #include"bytestream.h"
 
+#include"bufferpool.h"
+
+#ifndef NO_STREAM_STATS
+# include<qdatetime.h>
+# define HAVE_STATS
+#endif
+
+// smallest segment allocated by ByteChain
+#define SEGMENT_SIZE 4096
+
 // CS_NAMESPACE_BEGIN
 
+#ifdef HAVE_STATS
+// counters of all streams together
+static ByteStreamStats total_stats;
+
+static int stats_msecs()
+{
+	static QTime clock;
+	static bool started = false;
+	if(!started) {
+		clock.start();
+		started = true;
+	}
+	return clock.elapsed();
+}
+
+static inline void count_copy(Q_ULLONG *copied, int size)
+{
+	*copied += size;
+	total_stats.bytesCopied += size;
+}
+#endif
+
+//! \class ByteStreamStats bytestream.h
+//! \brief I/O counters of a ByteStream
+//!
+//! bytesRead and readCalls count the data a stream took in from beneath it
+//! (the kernel, a QSocket, or the stream it wraps) and how many separate
+//! reads that took.  bytesWritten and writeCalls do the same for data passed
+//! down.  bytesCopied is the number of bytes memcpy'd while queueing data in
+//! the stream's buffers.  readHighWater and writeHighWater are the most data
+//! that was ever waiting to be read or written, and writePendingMsecs is the
+//! total time during which there was anything left to write.
+//!
+//! Counting can be compiled out by defining NO_STREAM_STATS, in which case
+//! all counters stay at zero.
+//! \sa ByteStream::stats(), ByteStream::totalStats()
+
+//!
+//! Constructs a set of counters, all zero.
+ByteStreamStats::ByteStreamStats()
+{
+	clear();
+}
+
+//!
+//! Sets all counters to zero.
+void ByteStreamStats::clear()
+{
+	bytesRead = bytesWritten = 0;
+	readCalls = writeCalls = 0;
+	bytesCopied = 0;
+	readHighWater = writeHighWater = 0;
+	writePendingMsecs = 0;
+}
+
+//! \class ByteChain bytestream.h
+//! \brief A byte queue made of a chain of segments
+//!
+//! ByteChain is the buffer behind the read and write queues of ByteStream.
+//! Rather than keeping one flat array that has to be reallocated on every
+//! append and shifted on every partial take, data is stored in a list of
+//! segments of at least SEGMENT_SIZE bytes.  Appending only copies into the
+//! free space of the last segment (linking a new one when it fills up),
+//! taking from the front only advances an offset, and taking a whole segment
+//! hands over the underlying array without copying it.  Segments are taken
+//! from BufferPool and given back to it once they have been consumed.
+//!
+//! Since QByteArray is explicitly shared, the segments are never exposed
+//! directly.  Use flatten() when a single contiguous array is required, or
+//! spans() to look at the data in place.  For scatter reads, prepare()
+//! returns free space at the end of the chain that can be filled directly
+//! (for instance with readv()), after which commit() makes it part of the
+//! data.
+
+//!
+//! Constructs an empty chain.
+ByteChain::ByteChain()
+{
+	head = 0;
+	total = 0;
+	exposed = false;
+	copied = 0;
+}
+
+//!
+//! Destroys the chain and frees all segments.
+ByteChain::~ByteChain()
+{
+	clear();
+}
+
+//!
+//! Returns the number of bytes in the chain.
+int ByteChain::size() const
+{
+	if(exposed)
+		return flat.size();
+	return total;
+}
+
+//!
+//! Returns TRUE if the chain holds no data.
+bool ByteChain::isEmpty() const
+{
+	return (size() == 0);
+}
+
+//!
+//! Removes all data from the chain.
+void ByteChain::clear()
+{
+	while(!segs.isEmpty())
+		dropFirst();
+	flat = QByteArray();
+	exposed = false;
+	head = 0;
+	total = 0;
+}
+
+//!
+//! Appends array \a a to the end of the chain.
+void ByteChain::append(const QByteArray &a)
+{
+	append(a.data(), a.size());
+}
+
+//!
+//! Appends \a size bytes starting at \a data to the end of the chain.
+void ByteChain::append(const char *data, int size)
+{
+	absorb();
+	if(size <= 0)
+		return;
+	total += size;
+
+	// fill the free space of the last segment first
+	if(!segs.isEmpty()) {
+		Segment &last = segs.last();
+		int room = last.buf.size() - last.len;
+		if(room > 0) {
+			int n = QMIN(room, size);
+			memcpy(last.buf.data() + last.len, data, n);
+#ifdef HAVE_STATS
+			count_copy(&copied, n);
+#endif
+			last.len += n;
+			data += n;
+			size -= n;
+		}
+	}
+
+	// link a new segment for the remainder
+	if(size > 0) {
+		Segment seg;
+		seg.buf = BufferPool::take(QMAX(SEGMENT_SIZE, size));
+		memcpy(seg.buf.data(), data, size);
+#ifdef HAVE_STATS
+		count_copy(&copied, size);
+#endif
+		seg.len = size;
+		if(segs.isEmpty())
+			head = 0;
+		segs.append(seg);
+	}
+}
+
+//!
+//! Returns \a size bytes from the start of the chain.
+//! If \a size is 0, then all available data will be returned.
+//! If \a del is TRUE, then the bytes are also removed.
+QByteArray ByteChain::take(int size, bool del)
+{
+	absorb();
+	if(size <= 0 || size > total)
+		size = total;
+	if(size == 0)
+		return QByteArray();
+
+	// exactly the first segment?  hand it over without copying
+	if(del && head == 0 && size == segs.first().len) {
+		QByteArray a = segs.first().buf;
+		segs.remove(segs.begin());
+		a.resize(size);
+		total -= size;
+		return a;
+	}
+
+	QByteArray a = BufferPool::take(size);
+	int at = 0;
+	int offset = head;
+	for(QValueList<Segment>::ConstIterator it = segs.begin(); at < size; ++it) {
+		int n = QMIN((*it).len - offset, size - at);
+		memcpy(a.data() + at, (*it).buf.data() + offset, n);
+		at += n;
+		offset = 0;
+	}
+#ifdef HAVE_STATS
+	count_copy(&copied, size);
+#endif
+	if(del)
+		discard(size);
+	return a;
+}
+
+//!
+//! Removes \a size bytes from the start of the chain.
+void ByteChain::discard(int size)
+{
+	absorb();
+	if(size > total)
+		size = total;
+	if(size <= 0)
+		return;
+
+	total -= size;
+	while(size > 0) {
+		int len = segs.first().len - head;
+		if(size < len) {
+			head += size;
+			break;
+		}
+		dropFirst();
+		head = 0;
+		size -= len;
+	}
+	trim();
+}
+
+//!
+//! Returns the contents of the chain as a single contiguous array.  The
+//! returned reference may be modified, and stays valid until the next
+//! operation on the chain.
+QByteArray & ByteChain::flatten()
+{
+	if(!exposed) {
+		flat = take();
+		exposed = true;
+	}
+	return flat;
+}
+
+//!
+//! Fills \a list with the contiguous pieces of data in the chain, in order,
+//! without copying them.  If \a max is greater than 0, then no more than
+//! \a max bytes are described.  Returns the number of bytes described.
+//! The spans stay valid until the chain is modified.
+int ByteChain::spans(ByteSpanList *list, int max) const
+{
+	list->clear();
+	if(max <= 0 || max > size())
+		max = size();
+
+	ByteSpan span;
+	if(exposed) {
+		if(max > 0) {
+			span.data = flat.data();
+			span.size = max;
+			list->append(span);
+		}
+		return max;
+	}
+
+	int at = 0;
+	int offset = head;
+	for(QValueList<Segment>::ConstIterator it = segs.begin(); at < max; ++it) {
+		span.data = (*it).buf.data() + offset;
+		span.size = QMIN((*it).len - offset, max - at);
+		if(span.size > 0)
+			list->append(span);
+		at += span.size;
+		offset = 0;
+	}
+	return at;
+}
+
+//!
+//! Makes room for at least \a size more bytes at the end of the chain, and
+//! fills \a list with the free space, in order.  Returns the number of bytes
+//! described, which may exceed \a size.  Call commit() with the number of
+//! bytes actually written into the spans.
+int ByteChain::prepare(int size, ByteSpanList *list)
+{
+	absorb();
+	list->clear();
+
+	ByteSpan span;
+	int room = 0;
+	if(!segs.isEmpty()) {
+		Segment &last = segs.last();
+		room = last.buf.size() - last.len;
+		if(room > 0) {
+			span.data = last.buf.data() + last.len;
+			span.size = room;
+			list->append(span);
+		}
+	}
+
+	if(room < size) {
+		Segment seg;
+		seg.buf = BufferPool::take(QMAX(SEGMENT_SIZE, size - room));
+		seg.len = 0;
+		if(segs.isEmpty())
+			head = 0;
+		segs.append(seg);
+
+		span.data = seg.buf.data();
+		span.size = seg.buf.size();
+		list->append(span);
+		room += span.size;
+	}
+	return room;
+}
+
+//!
+//! Adds \a size bytes, previously written into the space returned by
+//! prepare(), to the end of the chain.
+void ByteChain::commit(int size)
+{
+	if(size > 0) {
+		total += size;
+
+		// the free space starts at the first segment that isn't full
+		QValueList<Segment>::Iterator it = segs.begin();
+		while(it != segs.end() && (*it).len == (int)(*it).buf.size())
+			++it;
+		for(; it != segs.end() && size > 0; ++it) {
+			int n = QMIN((int)(*it).buf.size() - (*it).len, size);
+			(*it).len += n;
+			size -= n;
+		}
+	}
+	trim();
+}
+
+//!
+//! Returns the number of bytes copied so far in order to append or take data.
+Q_ULLONG ByteChain::bytesCopied() const
+{
+	return copied;
+}
+
+void ByteChain::absorb()
+{
+	if(!exposed)
+		return;
+	exposed = false;
+
+	// take back whatever was left in the flat array
+	QByteArray a = flat;
+	flat = QByteArray();
+	if(!a.isEmpty()) {
+		Segment seg;
+		seg.buf = a;
+		seg.len = a.size();
+		segs.append(seg);
+		head = 0;
+		total = seg.len;
+	}
+}
+
+void ByteChain::trim()
+{
+	// drop unused segments left over from prepare()
+	while(!segs.isEmpty() && segs.last().len == 0) {
+		QByteArray a = segs.last().buf;
+		segs.remove(segs.fromLast());
+		BufferPool::give(a);
+	}
+}
+
+void ByteChain::dropFirst()
+{
+	// the list holds a reference too, so unlink before recycling
+	QByteArray a = segs.first().buf;
+	segs.remove(segs.begin());
+	BufferPool::give(a);
+}
+
 //! \class ByteStream bytestream.h
 //! \brief Base class for "bytestreams"
 //! 
@@ -47,10 +435,36 @@
 //! If you need more advanced control, reimplement read(), write(), bytesAvailable(),
 //! and/or bytesToWrite() as necessary.
 //!
+//! For scatter/gather I/O, writev() queues several arrays at once without
+//! assembling them first, and peek() and consume() give access to the readable
+//! data in place, as a list of contiguous spans.  Reimplement these along with
+//! read() and write() if the data does not live in the ByteStream buffers.
+//!
 //! Use appendRead(), appendWrite(), takeRead(), and takeWrite() to modify the
 //! buffers.  If you have more advanced requirements, the buffers can be accessed
 //! directly with readBuf() and writeBuf().
 //!
+//! Both buffers are kept in a ByteChain, so appending and partially taking
+//! data costs only the bytes involved, regardless of how much is queued.
+//!
+//! Each stream keeps a few counters of its traffic, which can be read with
+//! stats().  Subclasses report the data they take in and pass down with
+//! recordRead() and recordWrite(), whereas data given to appendRead() is
+//! counted already.  totalStats() sums up all streams of the process.
+//!
+//! Neither buffer is bounded by default.  With setReadLimit(), the stream
+//! stops taking data from the underlying system once that much is waiting to
+//! be read, and carries on when the reader has brought it back down to the low
+//! mark.  Subclasses do this by reimplementing setReadEnabled().  With
+//! setWriteLimit(), the stream emits writePaused() once that much is waiting
+//! to be written, and writeResumed() when it has drained to the low mark, so
+//! that whoever is feeding it can hold off in the meantime.  The limits are
+//! checked whenever data is counted with recordRead() or recordWrite() (and
+//! so in appendRead()), before anyone hears about it.  Subclasses that change
+//! how much is waiting in some other way should call checkReadLimit() or
+//! checkWriteLimit() themselves, before emitting readyRead() or
+//! bytesWritten().
+//!
 //! Also available are the static convenience functions ByteStream::appendArray()
 //! and ByteStream::takeArray(), which make dealing with byte queues very easy.
 
@@ -59,7 +473,12 @@ class ByteStream::Private
 public:
 	Private() {}
 
-	QByteArray readBuf, writeBuf;
+	ByteChain readBuf, writeBuf;
+	int readHigh, readLow, writeHigh, writeLow;
+	bool readPaused, writePaused;
+	ByteStreamStats stats;
+	Q_ULLONG copyBase;
+	int writeSince;
 };
 
 //!
@@ -68,12 +487,22 @@ ByteStream::ByteStream(QObject *parent)
 :QObject(parent)
 {
 	d = new Private;
+	d->readHigh = d->readLow = 0;
+	d->writeHigh = d->writeLow = 0;
+	d->readPaused = false;
+	d->writePaused = false;
+	d->copyBase = 0;
+	d->writeSince = -1;
 }
 
 //!
 //! Destroys the object and frees allocated resources.
 ByteStream::~ByteStream()
 {
+#ifdef HAVE_STATS
+	if(d->writeSince != -1)
+		total_stats.writePendingMsecs += stats_msecs() - d->writeSince;
+#endif
 	delete d;
 }
 
@@ -104,6 +533,7 @@ void ByteStream::write(const QByteArray &a)
 	appendWrite(a);
 	if(doWrite)
 		tryWrite();
+	checkWriteLimit();
 }
 
 //!
@@ -111,7 +541,9 @@ void ByteStream::write(const QByteArray &a)
 //! \a read will return all available data.
 QByteArray ByteStream::read(int bytes)
 {
-	return takeRead(bytes);
+	QByteArray a = takeRead(bytes);
+	checkReadLimit();
+	return a;
 }
 
 //!
@@ -128,6 +560,173 @@ int ByteStream::bytesToWrite() const
 	return d->writeBuf.size();
 }
 
+//!
+//! Writes the arrays in \a list to the stream, in order, without joining them
+//! into one array first.
+void ByteStream::writev(const QValueList<QByteArray> &list)
+{
+	if(!isOpen())
+		return;
+
+	bool doWrite = bytesToWrite() == 0 ? true: false;
+	for(QValueList<QByteArray>::ConstIterator it = list.begin(); it != list.end(); ++it)
+		appendWrite(*it);
+	if(doWrite)
+		tryWrite();
+	checkWriteLimit();
+}
+
+//!
+//! Fills \a spans with the data available for reading, without removing or
+//! copying it.  If \a bytes is greater than 0, then no more than \a bytes are
+//! described.  Returns the number of bytes described.  The spans stay valid
+//! until the next read or consume() call, or until control returns to the
+//! event loop.
+//! \sa consume()
+int ByteStream::peek(ByteSpanList *spans, int bytes)
+{
+	return d->readBuf.spans(spans, bytes);
+}
+
+//!
+//! Removes \a bytes bytes from the start of the read buffer, typically after
+//! they have been examined with peek().
+void ByteStream::consume(int bytes)
+{
+	d->readBuf.discard(bytes);
+	checkReadLimit();
+}
+
+//!
+//! Returns TRUE if detachSocket() would succeed right now, that is, if the
+//! stream sits on a connected socket and has nothing buffered either way.
+//! \sa detachSocket()
+bool ByteStream::isDetachable() const
+{
+	return false;
+}
+
+//!
+//! Hands the underlying socket descriptor over to the caller, who becomes
+//! responsible for closing it, and leaves the stream idle.  Returns -1 if the
+//! stream has no such descriptor or still holds buffered data.
+//! \sa isDetachable()
+int ByteStream::detachSocket()
+{
+	return -1;
+}
+
+//!
+//! Stops taking data from the underlying system while \a high bytes or more
+//! are waiting to be read, until the reader has brought it down to \a low
+//! bytes.  If \a low is -1, then half of \a high is used.  A \a high of 0
+//! removes the limit, which is the default.
+//! \sa setReadEnabled()
+void ByteStream::setReadLimit(int high, int low)
+{
+	if(high < 0)
+		high = 0;
+	if(low < 0 || low > high)
+		low = high / 2;
+	d->readHigh = high;
+	d->readLow = low;
+
+	// let the subclass pick up the new limit as well
+	d->readPaused = (high > 0 && bytesAvailable() >= high);
+	setReadEnabled(!d->readPaused);
+}
+
+//!
+//! Returns the read limit, or 0 if there is none.
+int ByteStream::readLimit() const
+{
+	return d->readHigh;
+}
+
+//!
+//! Returns TRUE if the stream has stopped reading because of the read limit.
+bool ByteStream::isReadPaused() const
+{
+	return d->readPaused;
+}
+
+//!
+//! Emits writePaused() once \a high bytes or more are waiting to be written,
+//! and writeResumed() when that has drained to \a low bytes.  If \a low is -1,
+//! then half of \a high is used.  A \a high of 0 removes the limit, which is
+//! the default.
+void ByteStream::setWriteLimit(int high, int low)
+{
+	if(high < 0)
+		high = 0;
+	if(low < 0 || low > high)
+		low = high / 2;
+	d->writeHigh = high;
+	d->writeLow = low;
+
+	if(d->writePaused && (high == 0 || bytesToWrite() <= low)) {
+		d->writePaused = false;
+		writeResumed();
+	}
+	else
+		checkWriteLimit();
+}
+
+//!
+//! Returns the write limit, or 0 if there is none.
+int ByteStream::writeLimit() const
+{
+	return d->writeHigh;
+}
+
+//!
+//! Returns TRUE if writePaused() has been emitted, and writeResumed() has not
+//! followed yet.
+bool ByteStream::isWritePaused() const
+{
+	return d->writePaused;
+}
+
+//!
+//! Returns the counters of this stream.
+//! \sa ByteStreamStats
+ByteStreamStats ByteStream::stats() const
+{
+	ByteStreamStats s = d->stats;
+#ifdef HAVE_STATS
+	s.bytesCopied += d->readBuf.bytesCopied() + d->writeBuf.bytesCopied() - d->copyBase;
+	if(d->writeSince != -1)
+		s.writePendingMsecs += stats_msecs() - d->writeSince;
+#endif
+	return s;
+}
+
+//!
+//! Sets the counters of this stream back to zero.  The process-wide totals
+//! are not affected.
+void ByteStream::clearStats()
+{
+	d->stats.clear();
+	d->copyBase = d->readBuf.bytesCopied() + d->writeBuf.bytesCopied();
+#ifdef HAVE_STATS
+	if(d->writeSince != -1)
+		d->writeSince = stats_msecs();
+#endif
+}
+
+//!
+//! Returns the counters of all streams in the process added together, including
+//! those that no longer exist, and the bytes copied by appendArray() and
+//! takeArray().  The high-water marks are those of the busiest stream.
+ByteStreamStats ByteStream::totalStats()
+{
+#ifdef HAVE_STATS
+	return total_stats;
+#else
+	return ByteStreamStats();
+#endif
+}
+
 //!
 //! Writes string \a cs to the stream.
 void ByteStream::write(const QCString &cs)
@@ -141,28 +740,29 @@ void ByteStream::write(const QCString &cs)
 //! Clears the read buffer.
 void ByteStream::clearReadBuffer()
 {
-	d->readBuf.resize(0);
+	d->readBuf.clear();
 }
 
 //!
 //! Clears the write buffer.
 void ByteStream::clearWriteBuffer()
 {
-	d->writeBuf.resize(0);
+	d->writeBuf.clear();
 }
 
 //!
 //! Appends \a block to the end of the read buffer.
 void ByteStream::appendRead(const QByteArray &block)
 {
-	appendArray(&d->readBuf, block);
+	d->readBuf.append(block);
+	recordRead(block.size());
 }
 
 //!
 //! Appends \a block to the end of the write buffer.
 void ByteStream::appendWrite(const QByteArray &block)
 {
-	appendArray(&d->writeBuf, block);
+	d->writeBuf.append(block);
 }
 
 //!
@@ -171,7 +771,7 @@ void ByteStream::appendWrite(const QByteArray &block)
 //! If \a del is TRUE, then the bytes are also removed.
 QByteArray ByteStream::takeRead(int size, bool del)
 {
-	return takeArray(&d->readBuf, size, del);
+	return d->readBuf.take(size, del);
 }
 
 //!
@@ -180,19 +780,35 @@ QByteArray ByteStream::takeRead(int size, bool del)
 //! If \a del is TRUE, then the bytes are also removed.
 QByteArray ByteStream::takeWrite(int size, bool del)
 {
-	return takeArray(&d->writeBuf, size, del);
+	return d->writeBuf.take(size, del);
 }
 
 //!
-//! Returns a reference to the read buffer.
+//! Returns a reference to the read buffer as a contiguous array.  The reference
+//! stays valid until the next operation on the read buffer.
 QByteArray & ByteStream::readBuf()
 {
-	return d->readBuf;
+	return d->readBuf.flatten();
 }
 
 //!
-//! Returns a reference to the write buffer.
+//! Returns a reference to the write buffer as a contiguous array.  The reference
+//! stays valid until the next operation on the write buffer.
 QByteArray & ByteStream::writeBuf()
+{
+	return d->writeBuf.flatten();
+}
+
+//!
+//! Returns the chain that holds the read buffer.
+ByteChain & ByteStream::readChain()
+{
+	return d->readBuf;
+}
+
+//!
+//! Returns the chain that holds the write buffer.
+ByteChain & ByteStream::writeChain()
 {
 	return d->writeBuf;
 }
@@ -205,6 +821,122 @@ int ByteStream::tryWrite()
 	return -1;
 }
 
+//!
+//! Called with \a b FALSE when the read limit has been reached, and with \a b
+//! TRUE once the reader has caught up.  Reimplement this to stop and restart
+//! reading from the underlying system.  It is also called whenever the limit
+//! is changed.  The default implementation does nothing.
+//! \sa setReadLimit()
+void ByteStream::setReadEnabled(bool)
+{
+}
+
+//!
+//! Pauses or resumes reading according to the read limit.  This is done
+//! automatically in recordRead(), read() and consume().
+void ByteStream::checkReadLimit()
+{
+#ifdef HAVE_STATS
+	int n = bytesAvailable();
+	if(n > d->stats.readHighWater) {
+		d->stats.readHighWater = n;
+		if(n > total_stats.readHighWater)
+			total_stats.readHighWater = n;
+	}
+	if(d->readHigh <= 0)
+		return;
+#else
+	if(d->readHigh <= 0)
+		return;
+	int n = bytesAvailable();
+#endif
+	if(!d->readPaused && n >= d->readHigh) {
+		d->readPaused = true;
+		setReadEnabled(false);
+	}
+	else if(d->readPaused && n <= d->readLow) {
+		d->readPaused = false;
+		setReadEnabled(true);
+	}
+}
+
+//!
+//! Emits writePaused() or writeResumed() according to the write limit.  This
+//! is done automatically in recordWrite(), write() and writev().
+void ByteStream::checkWriteLimit()
+{
+#ifdef HAVE_STATS
+	int n = bytesToWrite();
+	if(n > d->stats.writeHighWater) {
+		d->stats.writeHighWater = n;
+		if(n > total_stats.writeHighWater)
+			total_stats.writeHighWater = n;
+	}
+
+	// time how long the write buffer stays non-empty
+	if(n > 0 && d->writeSince == -1)
+		d->writeSince = stats_msecs();
+	else if(n == 0 && d->writeSince != -1) {
+		int t = stats_msecs() - d->writeSince;
+		d->stats.writePendingMsecs += t;
+		total_stats.writePendingMsecs += t;
+		d->writeSince = -1;
+	}
+
+	if(d->writeHigh <= 0)
+		return;
+#else
+	if(d->writeHigh <= 0)
+		return;
+	int n = bytesToWrite();
+#endif
+	if(!d->writePaused && n >= d->writeHigh) {
+		d->writePaused = true;
+		writePaused();
+	}
+	else if(d->writePaused && n <= d->writeLow) {
+		d->writePaused = false;
+		writeResumed();
+	}
+}
+
+//!
+//! Counts \a bytes taken in from the underlying system in one operation,
+//! and checks the read limit.
+void ByteStream::recordRead(int bytes)
+{
+#ifdef HAVE_STATS
+	if(bytes > 0) {
+		d->stats.bytesRead += bytes;
+		++d->stats.readCalls;
+		total_stats.bytesRead += bytes;
+		++total_stats.readCalls;
+	}
+#else
+	Q_UNUSED(bytes);
+#endif
+	checkReadLimit();
+}
+
+//!
+//! Counts \a bytes passed down to the underlying system in one operation,
+//! and checks the write limit.  Call it once the write buffer has been
+//! updated.
+void ByteStream::recordWrite(int bytes)
+{
+#ifdef HAVE_STATS
+	if(bytes > 0) {
+		d->stats.bytesWritten += bytes;
+		++d->stats.writeCalls;
+		total_stats.bytesWritten += bytes;
+		++total_stats.writeCalls;
+	}
+#else
+	Q_UNUSED(bytes);
+#endif
+	checkWriteLimit();
+}
+
 //!
 //! Append array \a b to the end of the array pointed to by \a a.
 void ByteStream::appendArray(QByteArray *a, const QByteArray &b)
@@ -212,6 +944,9 @@ void ByteStream::appendArray(QByteArray *a, const QByteArray &b)
 	int oldsize = a->size();
 	a->resize(oldsize + b.size());
 	memcpy(a->data() + oldsize, b.data(), b.size());
+#ifdef HAVE_STATS
+	total_stats.bytesCopied += b.size();
+#endif
 }
 
 //!
@@ -225,6 +960,9 @@ QByteArray ByteStream::takeArray(QByteArray *from, int size, bool del)
 		a = from->copy();
 		if(del)
 			from->resize(0);
+#ifdef HAVE_STATS
+		total_stats.bytesCopied += a.size();
+#endif
 	}
 	else {
 		if(size > (int)from->size())
@@ -237,6 +975,9 @@ QByteArray ByteStream::takeArray(QByteArray *from, int size, bool del)
 			memmove(r, r+size, newsize);
 			from->resize(newsize);
 		}
+#ifdef HAVE_STATS
+		total_stats.bytesCopied += size + (del ? from->size() : 0);
+#endif
 	}
 	return a;
 }
@@ -264,4 +1005,13 @@ QByteArray ByteStream::takeArray(QByteArray *from, int size, bool del)
 //! This signal is emitted when an error occurs in the stream.  The reason for
 //! error is indicated by \a code.
 
+//! \fn void ByteStream::writePaused()
+//! This signal is emitted when the data waiting to be written has reached the
+//! write limit.  Stop writing until writeResumed() is emitted.
+//! \sa setWriteLimit()
+
+//! \fn void ByteStream::writeResumed()
+//! This signal is emitted when the data waiting to be written has drained to
+//! the low mark after writePaused().
+
 // CS_NAMESPACE_END
@@ -23,10 +23,70 @@
 
 #include<qobject.h>
 #include<qcstring.h>
+#include<qvaluelist.h>
 
 // CS_NAMESPACE_BEGIN
 
 // CS_EXPORT_BEGIN
+struct ByteSpan
+{
+	char *data;
+	int size;
+};
+typedef QValueList<ByteSpan> ByteSpanList;
+
+struct ByteStreamStats
+{
+	ByteStreamStats();
+	void clear();
+
+	Q_ULLONG bytesRead, bytesWritten;
+	Q_ULLONG readCalls, writeCalls;
+	Q_ULLONG bytesCopied;
+	int readHighWater, writeHighWater;
+	Q_ULLONG writePendingMsecs;
+};
+
+class ByteChain
+{
+public:
+	ByteChain();
+	~ByteChain();
+
+	int size() const;
+	bool isEmpty() const;
+	void clear();
+	void append(const QByteArray &);
+	void append(const char *data, int size);
+	QByteArray take(int size=0, bool del=true);
+	void discard(int size);
+	QByteArray & flatten();
+
+	int spans(ByteSpanList *list, int max=0) const;
+	int prepare(int size, ByteSpanList *list);
+	void commit(int size);
+
+	Q_ULLONG bytesCopied() const;
+
+private:
+	struct Segment
+	{
+		QByteArray buf;
+		int len;
+	};
+	QValueList<Segment> segs;
+	int head, total;
+	QByteArray flat;
+	bool exposed;
+	Q_ULLONG copied;
+
+	ByteChain(const ByteChain &);
+	ByteChain & operator=(const ByteChain &);
+	void absorb();
+	void trim();
+	void dropFirst();
+};
+
 class ByteStream : public QObject
 {
 	Q_OBJECT
@@ -42,6 +102,24 @@ public:
 	virtual int bytesAvailable() const;
 	virtual int bytesToWrite() const;
 
+	virtual void writev(const QValueList<QByteArray> &);
+	virtual int peek(ByteSpanList *spans, int bytes=0);
+	virtual void consume(int bytes);
+
+	virtual bool isDetachable() const;
+	virtual int detachSocket();
+
+	void setReadLimit(int high, int low=-1);
+	int readLimit() const;
+	bool isReadPaused() const;
+	void setWriteLimit(int high, int low=-1);
+	int writeLimit() const;
+	bool isWritePaused() const;
+
+	ByteStreamStats stats() const;
+	void clearStats();
+	static ByteStreamStats totalStats();
+
 	void write(const QCString &);
 
 	static void appendArray(QByteArray *a, const QByteArray &b);
@@ -53,6 +131,8 @@ signals:
 	void readyRead();
 	void bytesWritten(int);
 	void error(int);
+	void writePaused();
+	void writeResumed();
 
 protected:
 	void clearReadBuffer();
@@ -63,7 +143,14 @@ protected:
 	QByteArray takeWrite(int size=0, bool del=true);
 	QByteArray & readBuf();
 	QByteArray & writeBuf();
+	ByteChain & readChain();
+	ByteChain & writeChain();
 	virtual int tryWrite();
+	virtual void setReadEnabled(bool);
+	void checkReadLimit();
+	void checkWriteLimit();
+	void recordRead(int bytes);
+	void recordWrite(int bytes);
 
 private:
 //! \if _hide_doc_
@@ -0,0 +1,409 @@
+/*
+ * reactor.cpp - socket readiness notification, optionally through epoll
+ * Copyright (C) 2003  Justin Karneges
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+//! \class SocketWatcher reactor.h
+//! \brief Drop-in replacement for QSocketNotifier
+//!
+//! SocketWatcher emits activated() when its socket is ready, just like
+//! QSocketNotifier.  Normally it is a QSocketNotifier underneath, and every
+//! socket takes part in Qt's select() call.  When the Reactor is enabled,
+//! the socket is instead registered with a single edge-triggered epoll
+//! descriptor, so the cost of a wakeup no longer depends on how many sockets
+//! are open.
+//!
+//! Being edge-triggered, the watcher only fires again once new data arrives.
+//! The receiver must therefore read (or write) until the call would block.
+//! A receiver that stops early on purpose should call retry(), which fires
+//! the watcher again from the event loop.
+//!
+//! \code
+//! #include "reactor.h"
+//!
+//! ...
+//!
+//! // before any sockets are created
+//! Reactor::setEnabled(true);
+//!
+//! SocketWatcher *sw = new SocketWatcher(fd, SocketWatcher::Read);
+//! connect(sw, SIGNAL(activated(int)), SLOT(readAll()));
+//! \endcode
+
+#include"reactor.h"
+
+#include<qapplication.h>
+#include<qsocketnotifier.h>
+#include<qptrlist.h>
+#include<qintdict.h>
+#include<qguardedptr.h>
+#include<qtimer.h>
+
+#if defined(Q_OS_LINUX) && !defined(NO_EPOLL)
+#define HAVE_EPOLL
+#include<sys/epoll.h>
+#include<unistd.h>
+#endif
+
+#define REACTOR_EVENTS  256  // events taken per epoll_wait()
+#define REACTOR_ROUNDS  4    // epoll_wait() calls per wakeup
+
+// CS_NAMESPACE_BEGIN
+
+static Reactor *reactor = 0;
+static bool reactor_enabled = false;
+
+//----------------------------------------------------------------------------
+// SocketWatcher
+//----------------------------------------------------------------------------
+class SocketWatcher::Private
+{
+public:
+	Private() {}
+
+	int socket;
+	Type type;
+	bool enabled;
+	QSocketNotifier *sn;
+	Reactor *r;
+};
+
+//! \fn void SocketWatcher::activated(int socket)
+//! This signal is emitted when \a socket is ready for reading or writing, depending on type().
+
+//!
+//! Watches \a socket for readiness of type \a type (Read or Write).  The watcher starts out enabled.
+SocketWatcher::SocketWatcher(int socket, Type type, QObject *parent)
+:QObject(parent)
+{
+	d = new Private;
+	d->socket = socket;
+	d->type = type;
+	d->enabled = true;
+	d->sn = 0;
+	d->r = 0;
+
+	if(Reactor::isEnabled()) {
+		Reactor *r = Reactor::instance();
+		if(r && r->add(this))
+			d->r = r;
+	}
+
+	// epoll not wanted or not usable for this descriptor (e.g. a plain file)
+	if(!d->r) {
+		d->sn = new QSocketNotifier(socket, type == Read ? QSocketNotifier::Read : QSocketNotifier::Write);
+		connect(d->sn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
+	}
+}
+
+//!
+//! Stops watching and frees allocated resources.
+SocketWatcher::~SocketWatcher()
+{
+	if(d->r && reactor == d->r)
+		d->r->remove(this);
+	delete d->sn;
+	delete d;
+}
+
+//!
+//! Returns the socket being watched.
+int SocketWatcher::socket() const
+{
+	return d->socket;
+}
+
+//!
+//! Returns the type of readiness being watched for.
+SocketWatcher::Type SocketWatcher::type() const
+{
+	return d->type;
+}
+
+//!
+//! Returns TRUE if the watcher is enabled.
+bool SocketWatcher::isEnabled() const
+{
+	return d->enabled;
+}
+
+//!
+//! Enables or disables the watcher according to \a b.
+void SocketWatcher::setEnabled(bool b)
+{
+	if(d->enabled == b)
+		return;
+	d->enabled = b;
+	if(d->sn)
+		d->sn->setEnabled(b);
+	else if(reactor == d->r)
+		d->r->update(this);
+}
+
+//!
+//! Fires activated() again from the event loop.  Call this after stopping before the socket was drained.
+void SocketWatcher::retry()
+{
+	// level-triggered notifiers will fire again by themselves
+	if(d->r && reactor == d->r)
+		d->r->retry(this);
+}
+
+void SocketWatcher::sn_activated(int)
+{
+	activated(d->socket);
+}
+
+void SocketWatcher::dispatch()
+{
+	if(d->enabled)
+		activated(d->socket);
+}
+
+//----------------------------------------------------------------------------
+// Reactor
+//----------------------------------------------------------------------------
+class Reactor::Private
+{
+public:
+	class Entry
+	{
+	public:
+		SocketWatcher *read, *write;
+	};
+
+	Private() : fds(1021) {}
+
+	int epfd;
+	QSocketNotifier *sn;
+	QIntDict<Entry> fds;
+	QPtrList<SocketWatcher> retries;
+	QTimer t;
+
+#ifdef HAVE_EPOLL
+	bool apply(int fd, Entry *e, int op)
+	{
+		epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLET;
+		if(e->read && e->read->isEnabled())
+			ev.events |= EPOLLIN;
+		if(e->write && e->write->isEnabled())
+			ev.events |= EPOLLOUT;
+		ev.data.fd = fd;
+		return (epoll_ctl(epfd, op, fd, &ev) == 0);
+	}
+#endif
+};
+
+Reactor::Reactor()
+:QObject(qApp)
+{
+	d = new Private;
+	d->fds.setAutoDelete(true);
+	d->sn = 0;
+	d->epfd = -1;
+	connect(&d->t, SIGNAL(timeout()), SLOT(t_retry()));
+
+#ifdef HAVE_EPOLL
+	d->epfd = epoll_create(1024);
+	if(d->epfd != -1) {
+		// the epoll descriptor itself is all that Qt has to select() on
+		d->sn = new QSocketNotifier(d->epfd, QSocketNotifier::Read);
+		connect(d->sn, SIGNAL(activated(int)), SLOT(sn_activated(int)));
+	}
+#endif
+}
+
+Reactor::~Reactor()
+{
+	delete d->sn;
+#ifdef HAVE_EPOLL
+	if(d->epfd != -1)
+		::close(d->epfd);
+#endif
+	delete d;
+	reactor = 0;
+}
+
+//!
+//! Returns TRUE if epoll can be used on this system.
+bool Reactor::isAvailable()
+{
+#ifdef HAVE_EPOLL
+	return true;
+#else
+	return false;
+#endif
+}
+
+//!
+//! Returns TRUE if new SocketWatchers register with epoll.
+bool Reactor::isEnabled()
+{
+	return reactor_enabled && isAvailable();
+}
+
+//!
+//! Sets whether new SocketWatchers register with epoll.  Existing ones are not affected.
+void Reactor::setEnabled(bool b)
+{
+	reactor_enabled = b;
+}
+
+Reactor *Reactor::instance()
+{
+	if(!reactor) {
+		reactor = new Reactor;
+		if(reactor->d->epfd == -1) {
+			delete reactor;
+			reactor = 0;
+			reactor_enabled = false;
+		}
+	}
+	return reactor;
+}
+
+bool Reactor::add(SocketWatcher *w)
+{
+#ifdef HAVE_EPOLL
+	int fd = w->socket();
+	Private::Entry *e = d->fds.find(fd);
+	bool isNew = false;
+	if(!e) {
+		e = new Private::Entry;
+		e->read = 0;
+		e->write = 0;
+		d->fds.insert(fd, e);
+		isNew = true;
+	}
+
+	SocketWatcher **slot = (w->type() == SocketWatcher::Read) ? &e->read : &e->write;
+	if(*slot)
+		return false; // one of each per descriptor
+	*slot = w;
+
+	if(!d->apply(fd, e, isNew ? EPOLL_CTL_ADD : EPOLL_CTL_MOD)) {
+		*slot = 0;
+		if(isNew)
+			d->fds.remove(fd);
+		return false;
+	}
+	return true;
+#else
+	Q_UNUSED(w);
+	return false;
+#endif
+}
+
+void Reactor::remove(SocketWatcher *w)
+{
+#ifdef HAVE_EPOLL
+	d->retries.removeRef(w);
+
+	int fd = w->socket();
+	Private::Entry *e = d->fds.find(fd);
+	if(!e)
+		return;
+	if(e->read == w)
+		e->read = 0;
+	else if(e->write == w)
+		e->write = 0;
+
+	if(!e->read && !e->write) {
+		// the descriptor may be closed already, in which case the kernel dropped it for us
+		epoll_event ev;
+		epoll_ctl(d->epfd, EPOLL_CTL_DEL, fd, &ev);
+		d->fds.remove(fd);
+	}
+	else
+		d->apply(fd, e, EPOLL_CTL_MOD);
+#else
+	Q_UNUSED(w);
+#endif
+}
+
+void Reactor::update(SocketWatcher *w)
+{
+#ifdef HAVE_EPOLL
+	// re-arming also reports a descriptor that is ready right now
+	Private::Entry *e = d->fds.find(w->socket());
+	if(e)
+		d->apply(w->socket(), e, EPOLL_CTL_MOD);
+#else
+	Q_UNUSED(w);
+#endif
+}
+
+void Reactor::retry(SocketWatcher *w)
+{
+	if(d->retries.findRef(w) == -1)
+		d->retries.append(w);
+	if(!d->t.isActive())
+		d->t.start(0, true);
+}
+
+void Reactor::sn_activated(int)
+{
+#ifdef HAVE_EPOLL
+	QGuardedPtr<Reactor> self = this;
+	epoll_event ev[REACTOR_EVENTS];
+	for(int round = 0; round < REACTOR_ROUNDS; ++round) {
+		int n = epoll_wait(d->epfd, ev, REACTOR_EVENTS, 0);
+		if(n <= 0)
+			break;
+
+		// collect first, since the receivers may delete any watcher
+		QValueList< QGuardedPtr<SocketWatcher> > list;
+		for(int i = 0; i < n; ++i) {
+			Private::Entry *e = d->fds.find(ev[i].data.fd);
+			if(!e)
+				continue;
+			if(e->read && ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				list += QGuardedPtr<SocketWatcher>(e->read);
+			if(e->write && ev[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+				list += QGuardedPtr<SocketWatcher>(e->write);
+		}
+		for(QValueList< QGuardedPtr<SocketWatcher> >::Iterator it = list.begin(); it != list.end(); ++it) {
+			if(*it)
+				(*it)->dispatch();
+			if(!self)
+				return;
+		}
+
+		if(n < REACTOR_EVENTS)
+			break;
+	}
+#endif
+}
+
+void Reactor::t_retry()
+{
+	QValueList< QGuardedPtr<SocketWatcher> > list;
+	QPtrListIterator<SocketWatcher> it(d->retries);
+	for(SocketWatcher *w; (w = it.current()); ++it)
+		list += QGuardedPtr<SocketWatcher>(w);
+	d->retries.clear();
+
+	for(QValueList< QGuardedPtr<SocketWatcher> >::Iterator lit = list.begin(); lit != list.end(); ++lit) {
+		if(*lit)
+			(*lit)->dispatch();
+	}
+}
+
+// CS_NAMESPACE_END
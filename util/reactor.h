@@ -0,0 +1,87 @@
+/*
+ * reactor.h - socket readiness notification, optionally through epoll
+ * Copyright (C) 2003  Justin Karneges
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef CS_REACTOR_H
+#define CS_REACTOR_H
+
+#include<qobject.h>
+
+// CS_NAMESPACE_BEGIN
+
+class Reactor;
+
+class SocketWatcher : public QObject
+{
+	Q_OBJECT
+public:
+	enum Type { Read, Write };
+	SocketWatcher(int socket, Type type, QObject *parent=0);
+	~SocketWatcher();
+
+	int socket() const;
+	Type type() const;
+	bool isEnabled() const;
+	void setEnabled(bool);
+	void retry();
+
+signals:
+	void activated(int socket);
+
+private slots:
+	void sn_activated(int);
+
+private:
+	class Private;
+	Private *d;
+
+	friend class Reactor;
+	void dispatch();
+};
+
+class Reactor : public QObject
+{
+	Q_OBJECT
+public:
+	~Reactor();
+
+	static bool isAvailable();
+	static bool isEnabled();
+	static void setEnabled(bool);
+
+private slots:
+	void sn_activated(int);
+	void t_retry();
+
+private:
+	class Private;
+	Private *d;
+
+	friend class SocketWatcher;
+	Reactor();
+	static Reactor *instance();
+	bool add(SocketWatcher *);
+	void remove(SocketWatcher *);
+	void update(SocketWatcher *);
+	void retry(SocketWatcher *);
+};
+
+// CS_NAMESPACE_END
+
+#endif